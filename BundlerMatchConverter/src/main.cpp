@@ -0,0 +1,196 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+
+#include "MatchFile.h"
+
+//Bundler matrix.txt: number of matches of each pair, one row per image
+static bool writeMatrix(const SiftFile::MatchReader& reader, unsigned int nbImage, const std::string& filename)
+{
+	std::vector<unsigned int> matrix((size_t) nbImage*nbImage, 0);
+	for (unsigned int i=0; i<reader.getPairCount(); ++i)
+	{
+		const SiftFile::MatchFileEntry& entry = reader.getPair(i);
+		matrix[(size_t) entry.indexA*nbImage+entry.indexB] = entry.nbMatch;
+	}
+
+	std::ofstream output(filename.c_str());
+	for (unsigned int i=0; i<nbImage; ++i)
+	{
+		for (unsigned int j=0; j<nbImage; ++j)
+			output << matrix[(size_t) i*nbImage+j] << ";";
+		output << std::endl;
+	}
+	output.close();
+
+	return !output.fail();
+}
+
+//number of images of list.txt (one per non empty line, as BundlerMatcher)
+static bool readImageCount(const std::string& filename, unsigned int& nbImage)
+{
+	std::ifstream input(filename.c_str());
+	if (!input.is_open())
+		return false;
+
+	nbImage = 0;
+	std::string line;
+	while (std::getline(input, line))
+	{
+		if (line != "")
+			nbImage++;
+	}
+
+	return true;
+}
+
+//Merge the match files of the shards (binary or text) into one gpu.matches.txt and matrix.txt
+//the sorted binary file is kept as <gpu.matches.txt>.bin (previous matches of incremental matching)
+static int mergeShards(const std::string& listFilename, const std::string& matchFilename, const std::string& matrixFilename, int nbShard, char** shardFilenames)
+{
+	//the last images may have no pair in any shard: the count comes from list.txt
+	unsigned int nbImage;
+	if (!readImageCount(listFilename, nbImage))
+	{
+		std::cout << "Error : can not open file : " << listFilename << std::endl;
+		return 1;
+	}
+	for (int i=0; i<nbShard; ++i)
+	{
+		SiftFile::MatchReader shard;
+		if (shard.open(shardFilenames[i]) && shard.getImageCount() != nbImage)
+		{
+			std::cout << "Error : shard " << shardFilenames[i] << " has " << shard.getImageCount() << " images, " << listFilename << " has " << nbImage << std::endl;
+			return 1;
+		}
+	}
+
+	std::string mergedFilename = matchFilename + ".bin";
+	SiftFile::MatchWriter writer;
+	if (!writer.open(mergedFilename, nbImage))
+	{
+		std::cout << "Error : can not open file : " << mergedFilename << std::endl;
+		return 1;
+	}
+
+	for (int i=0; i<nbShard; ++i)
+	{
+		//binary shards: encoded records are copied as is
+		SiftFile::MatchReader shard;
+		bool valid;
+		if (shard.open(shardFilenames[i]))
+		{
+			valid = true;
+			for (unsigned int j=0; j<shard.getPairCount() && valid; ++j)
+			{
+				const SiftFile::MatchFileEntry& entry = shard.getPair(j);
+				const unsigned char* record = shard.getRecord(j);
+				valid = writer.append(entry.indexA, entry.indexB, entry.nbMatch, std::vector<unsigned char>(record, record + entry.size));
+			}
+		}
+		else
+			valid = SiftFile::readMatchText(shardFilenames[i], writer);
+
+		if (!valid)
+		{
+			std::cout << "Error : can not read shard : " << shardFilenames[i] << std::endl;
+			return 1;
+		}
+	}
+
+	SiftFile::MatchReader reader;
+	if (!writer.close() || !reader.open(mergedFilename))
+	{
+		std::cout << "Error : can not write file : " << mergedFilename << std::endl;
+		return 1;
+	}
+
+	//a pair in several shards (same shard given twice, shards of different runs) or an image out
+	//of list.txt (text shards do not store the number of images): the merged file is not kept
+	for (unsigned int i=0; i<reader.getPairCount(); ++i)
+	{
+		const SiftFile::MatchFileEntry& entry = reader.getPair(i);
+		bool duplicate = (i > 0 && entry.indexA == reader.getPair(i-1).indexA && entry.indexB == reader.getPair(i-1).indexB);
+		if (duplicate || entry.indexA >= nbImage || entry.indexB >= nbImage)
+		{
+			if (duplicate)
+				std::cout << "Error : pair " << entry.indexA << " " << entry.indexB << " found in several shards" << std::endl;
+			else
+				std::cout << "Error : pair " << entry.indexA << " " << entry.indexB << " out of " << listFilename << " (" << nbImage << " images)" << std::endl;
+			reader.close();
+			remove(mergedFilename.c_str());
+			return 1;
+		}
+	}
+
+	if (!SiftFile::writeMatchText(reader, matchFilename))
+	{
+		std::cout << "Error : can not write file : " << matchFilename << std::endl;
+		return 1;
+	}
+	if (!writeMatrix(reader, nbImage, matrixFilename))
+	{
+		std::cout << "Error : can not write file : " << matrixFilename << std::endl;
+		return 1;
+	}
+
+	std::cout << "[" << nbShard << " shards merged: " << reader.getPairCount() << " pairs, " << nbImage << " images]" << std::endl;
+
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc >= 6 && std::string(argv[1]) == "merge")
+		return mergeShards(argv[2], argv[3], argv[4], argc-5, argv+5);
+
+	if (argc != 3)
+	{
+		std::cout << "Usage: " << argv[0] << " <matches.bin> <gpu.matches.txt>" << std::endl;
+		std::cout << "Convert a binary match file written by BundlerMatcher (binmatches option) to Bundler text format" << std::endl;
+		std::cout << "Usage: " << argv[0] << " merge <list.txt> <gpu.matches.txt> <matrix.txt> <shard matches> [<shard matches> ...]" << std::endl;
+		std::cout << "Merge the match files written by BundlerMatcher shards (shard option, text or binary)" << std::endl;
+		return -1;
+	}
+	SiftFile::MatchReader reader;
+	if (!reader.open(argv[1]))
+	{
+		std::cout << "Error : can not open file : " << argv[1] << std::endl;
+		return 1;
+	}
+
+	if (!SiftFile::writeMatchText(reader, argv[2]))
+	{
+		std::cout << "Error : can not write file : " << argv[2] << std::endl;
+		return 1;
+	}
+
+	std::cout << "[" << reader.getPairCount() << " pairs converted]" << std::endl;
+
+	return 0;
+}
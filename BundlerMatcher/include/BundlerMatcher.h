@@ -26,55 +26,58 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <deque>
 #include <fstream>
+#include <time.h>
 
 #include "SiftGPU.h"
-
-//GPU Buffer usage for large key-point set matching
-#define MATCH_BUFFER 24576
-
-typedef std::pair<unsigned int, unsigned int> Match;
-
-typedef std::vector<SiftGPU::SiftKeypoint> SiftKeyPoints;
-typedef std::vector<float> SiftKeyDescriptors;
-typedef std::vector<Match> Pairs;
-
-struct MatchInfo
+#include "SiftMatcher.h"
+#include "PairScheduler.h"
+#include "FeatureInfo.h"
+#include "FeatureStore.h"
+#include "ImageDecoder.h"
+#include "SiftFile.h"
+#include "MatchFile.h"
+#include "GeometricVerifier.h"
+#include "SiftExtractor.h"
+
+typedef std::pair<int, FeatureInfo*> ExtractedFeature;
+
+//putative matches of a pair waiting for the geometric verification (features stay acquired until verified)
+struct VerificationJob
 {
-	MatchInfo(int indexA, int indexB, std::vector<Match>& matches)
-	{
-		this->indexA = indexA;
-		this->indexB = indexB;
-		this->matches = matches;
-	}
-
-	int indexA;
-	int indexB;
+	int                indexA;
+	int                indexB;
+	const FeatureInfo* featureA;
+	const FeatureInfo* featureB;
 	std::vector<Match> matches;
+	std::vector<float> ratios; //SiftMatcher::getRatios (empty with SiftMatchGPU)
 };
 
-struct FeatureInfo
-{
-	FeatureInfo(int width, int height, SiftKeyPoints& points, SiftKeyDescriptors& descriptors)
-	{
-		this->width  = width;
-		this->height = height;
-		this->points = points;
-		this->descriptors = descriptors;
-	}
-
-	int width;
-	int height;
-	SiftKeyPoints points;
-	SiftKeyDescriptors descriptors;
-};
+//Vocabulary tree used to select pairs (retrieval matching): 10^6 words max
+#define RETRIEVAL_BRANCHING   10
+#define RETRIEVAL_DEPTH       6
+#define RETRIEVAL_SAMPLE_SIZE 500000
+
+//one pair out of ANN_RECALL_PERIOD is also matched exactly to measure the recall of approximate matching
+#define ANN_RECALL_PERIOD 500
+
+//pairs with less matches consistent with a fundamental matrix are dropped by the verification
+#define VERIFY_MIN_INLIER 16
 
-class BundlerMatcher
+//default memory budget (megabytes) of the images decoded and extracted in parallel
+#define EXTRACTION_MEMORY 2048
+
+class BundlerMatcher : public PairWorker, public FeatureLoader
 {
 	public:
 		BundlerMatcher(float distanceThreshold, float ratioThreshold, int firstOctave = 1,
 			bool binaryWritingEnabled = false, bool sequenceMatching = false, int sequenceMatchingLength = 5,
-			bool tileMatching = false, int tileNum = 1, float tilePercent = 1.0, bool pairMatchingEnabled = false);
+			bool tileMatching = false, int tileNum = 1, float tilePercent = 1.0, bool pairMatchingEnabled = false,
+			bool cpuMatching = false, int nbThread = 0, bool compactDescriptors = false, size_t featureCacheSize = 0,
+			bool featureDatabase = false, bool matchStreaming = false, bool incrementalMatching = false,
+			int retrievalNeighbours = 0, int approximateChecks = 0, float verifyThreshold = 0.0f, int checkpointPeriod = 0,
+			int shardIndex = 1, int shardCount = 1, bool cpuExtraction = false, size_t extractionMemory = 0);
 		~BundlerMatcher();
 		 
 		//load list.txt and output gpu.matches.txt + one key file per pictures
@@ -82,16 +85,45 @@ class BundlerMatcher
 			const std::string& pairsFilename);
 
 	protected:
+		friend class ImageDecoderThread;
+		friend class KeyWriterThread;
+		friend class ExtractionWorkerThread;
+		friend class VerificationWorkerThread;
 		
 		//Feature extraction
-		int extractSiftFeature(int fileIndex);
-		void saveAsciiKeyFile(int fileIndex);
-		void saveBinaryKeyFile(int fileIndex);
-		int readAsciiKeyFile(int fileIndex);
+		void extractSiftFeatures(long& featuresum, double bytesPerFeature);
+		void extractImages(SiftExtractor* extractor);
+		int extractSiftFeature(SiftExtractor& extractor, const DecodedImage& image, FeatureInfo& info);
+		bool decodeNextImage(DecodedImage& image);
+		void decodeImages();
+		void writeKeyFiles();
+		void writeKeyFile(const ExtractedFeature& feature);
+		void saveAsciiKeyFile(int fileIndex, const FeatureInfo& info);
+		void saveBinaryKeyFile(int fileIndex, const FeatureInfo& info);
+		int readAsciiKeyFile(int fileIndex, FeatureInfo& info);
+		int readBinaryKeyFile(int fileIndex, FeatureInfo& info);
+		int readFeatureCount(int fileIndex);
+		bool getImageDimension(int fileIndex, int& width, int& height);
+		virtual bool loadFeatures(int fileIndex, FeatureInfo& info);
 
 		//Feature matching
-		void matchSiftFeature(int fileIndexA, int fileIndexB);	
+		void createMatchers(int nbPair);
+		void destroyMatchers();
+		void matchPairs(const Pairs& pairs);
+		virtual void processPair(int workerIndex, const Match& pair);
+		void matchSiftFeature(int fileIndexA, int fileIndexB, SiftMatcher& matcher, std::deque<MatchInfo>& matchInfos);
+		void verifyPairs(int verifierIndex);
+		void verifyPair(int verifierIndex, VerificationJob* job);
+		const KdForest& getForest(int fileIndex, const FeatureInfo& info);
 		void saveMatches(const std::string& filename);
+		void writeMatches(std::deque<MatchInfo>& matchInfos);
+		void loadPreviousMatches(const std::string& outMatchFilename, Pairs& pairs);
+		void addPreviousMatches();
+		void addStoredMatches(const SiftFile::MatchReader& reader, unsigned int index);
+		void resumeCheckpoint(const std::string& outMatchFilename, Pairs& pairs);
+		void selectRetrievalPairs(Pairs& pairs);
+		void buildPairs(Pairs& pairs);
+		bool selectShardPairs(Pairs& pairs, std::vector<bool>& shardImages);
 
 		//Helpers
 		bool parseListFile(const std::string& filename);
@@ -102,7 +134,6 @@ class BundlerMatcher
 		void saveMatrix();
 		void saveVector();
 public:	
-		bool                     mIsInitialized;
 		bool                     mBinaryKeyFileWritingEnabled;
 		bool                     mSequenceMatchingEnabled;
 		int                      mSequenceMatchingLength;
@@ -111,14 +142,74 @@ public:
 		float					 mTilePercent;
 		bool					 mPairedMatchingEnabled;
 		Pairs					 mPairs;
-		SiftGPU*                 mSift;
-		SiftMatchGPU*            mMatcher;
+		bool                     mRetrievalMatchingEnabled;
+		int                      mRetrievalNeighbours; //images retrieved by the vocabulary tree for each image
+		bool                     mCpuMatchingEnabled;
+		bool                     mCompactDescriptorsEnabled; //descriptors stored as unsigned char (4x less RAM)
+		bool                     mApproximateMatchingEnabled;
+		int                      mApproximateChecks;  //descriptors compared per query in the k-d forests
+		Mutex                    mForestMutex;
+		int                      mNbRecallTicket;     //pairs matched approximately (one out of ANN_RECALL_PERIOD is checked)
+		int                      mNbRecallPair;
+		long                     mNbExactMatch;       //matches of the exact matcher on the checked pairs
+		long                     mNbRecalledMatch;    //... also found by the approximate matcher
+		int                      mNbThread;
+		SiftExtractor*           mExtractor;  //SiftGPU (NULL when features are extracted on CPU)
+		bool                     mCpuExtractionEnabled;
+		int                      mFirstOctave;
+		std::vector<SiftMatcher*> mMatchers;  //one per worker thread
+		bool                     mVerificationEnabled;
+		float                    mVerifyThreshold;    //maximum Sampson distance in pixels
+		std::vector<GeometricVerifier*> mVerifiers; //one per verification worker (independent of the matchers)
+		BlockingQueue<VerificationJob*> mVerificationJobs;
+		bool                     mVerifiersStarted;   //false: matching workers verify their pairs one at a time
+		Mutex                    mVerificationMutex;
+		long                     mNbPutativeMatch;    //matches before the verification
+		long                     mNbVerifiedMatch;
+		int                      mNbVerifiedPair;     //pairs with at least VERIFY_MIN_INLIER inliers
+		Mutex                    mProgressMutex;
+		int                      mNbPairMatched;
+		int                      mNbPairToMatch;
 		//int                      mMatchBuffer[4096][2];
 		float                    mDistanceThreshold;
 		float					 mRatioThreshold;
 		std::string              mInputPath;
 
+		std::vector<int>         mExtractionJobs;    //images without key file
+		int                      mNextExtractionJob;
+		Mutex                    mExtractionMutex;
+		std::vector<SiftExtractor*> mExtractors;     //one per extraction worker
+		MemoryBudget             mExtractionBudget;  //images decoded ahead and being extracted
+		size_t                   mExtractionMemory;
+		bool                     mDecodersStarted;
+		bool                     mKeyWriterStarted;
+		int                      mNextExtractedImage; //images taken by the extraction workers
+		int                      mNbExtractedImage;
+		long                     mExtractedFeatureSum;
+		double                   mBytesPerFeature;
+		BlockingQueue<DecodedImage*>     mDecodedImages;
+		BlockingQueue<ExtractedFeature>  mExtractedFeatures;
+
 		std::vector<std::string> mFilenames;    //N images
-		std::vector<FeatureInfo> mFeatureInfos; //N FeatureInfo
-		std::vector<MatchInfo>   mMatchInfos;   //N(N-1)/2 MatchInfo
+		FeatureStore             mFeatureStore; //N FeatureInfo (bounded by mFeatureCacheSize)
+		size_t                   mFeatureCacheSize;
+		bool                     mFeatureDatabaseEnabled;
+		SiftFile::Database       mFeatureDatabase; //binary features of all images in one file (instead of .key.bin)
+		std::vector<MatchInfo>   mMatchInfos;   //N(N-1)/2 MatchInfo (empty when matches are streamed)
+		bool                     mMatchStreamingEnabled;
+		SiftFile::MatchWriter    mMatchWriter;  //matches written as pairs complete
+		Mutex                    mMatchWriterMutex;
+		std::string              mMatchStreamFilename;
+		bool                     mIncrementalMatchingEnabled;
+		SiftFile::MatchReader    mPreviousMatches; //pairs of the previous run (incremental matching)
+		std::string              mPreviousMatchFilename;
+		bool                     mCheckpointEnabled;
+		int                      mCheckpointPeriod;  //seconds between two syncs of the checkpoint log
+		SiftFile::MatchLog       mCheckpoint;        //pairs matched so far (resumed after a crash)
+		Mutex                    mCheckpointMutex;
+		time_t                   mLastCheckpoint;
+		std::string              mCheckpointFilename;
+		int                      mShardIndex;        //1..mShardCount
+		int                      mShardCount;        //pairs split between mShardCount processes (1: no sharding)
+		std::vector<std::deque<MatchInfo> > mWorkerMatchInfos; //MatchInfo found by each matcher then each verifier (deque: no reallocation copy)
 };
\ No newline at end of file
@@ -0,0 +1,104 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <math.h>
+
+#include "SiftGPU.h"
+#include "SiftMatcher.h"
+#include "KdForest.h"
+
+typedef std::vector<SiftGPU::SiftKeypoint> SiftKeyPoints;
+typedef std::vector<float> SiftKeyDescriptors;
+typedef std::vector<unsigned char> SiftKeyCompactDescriptors;
+
+//descriptor value as stored in .key file and in compact mode: floor(0.5+512*d) clamped to [0,255]
+inline unsigned char quantizeDescriptor(float value)
+{
+	int quantized = (int) floor(0.5+512.0f*value);
+	return (unsigned char) (quantized < 0 ? 0 : (quantized > 255 ? 255 : quantized));
+}
+
+struct MatchInfo
+{
+	MatchInfo(int indexA, int indexB, std::vector<Match>& matches)
+	{
+		this->indexA = indexA;
+		this->indexB = indexB;
+		this->matches = matches;
+	}
+
+	int indexA;
+	int indexB;
+	std::vector<Match> matches;
+};
+
+struct FeatureInfo
+{
+	FeatureInfo(int width, int height)
+	{
+		this->width  = width;
+		this->height = height;
+		this->forest = NULL;
+	}
+
+	~FeatureInfo()
+	{
+		delete forest;
+	}
+
+	//descriptor value as stored in .key file: floor(0.5+512*d)
+	unsigned int getQuantizedDescriptor(int index) const
+	{
+		if (!compactDescriptors.empty())
+			return compactDescriptors[index];
+		return (unsigned int) floor(0.5+512.0f*descriptors[index]);
+	}
+
+	//descriptor value normalized to 1.0 as returned by SiftGPU
+	float getDescriptor(int index) const
+	{
+		if (!compactDescriptors.empty())
+			return compactDescriptors[index]/512.0f;
+		return descriptors[index];
+	}
+
+	//RAM used by key-points, descriptors and k-d forest
+	size_t getMemorySize() const
+	{
+		size_t forestSize = (forest ? forest->getMemorySize() : 0);
+		return points.capacity()*sizeof(SiftGPU::SiftKeypoint) + descriptors.capacity()*sizeof(float) + compactDescriptors.capacity() + forestSize;
+	}
+
+	int width;
+	int height;
+	SiftKeyPoints points;
+	SiftKeyDescriptors descriptors;               //128 floats per key-point
+	SiftKeyCompactDescriptors compactDescriptors; //128 bytes per key-point (used instead of descriptors in compact mode)
+	mutable KdForest* forest;                     //built on first approximate matching (owned, freed with the features)
+
+	private:
+		FeatureInfo(const FeatureInfo&);
+		FeatureInfo& operator=(const FeatureInfo&);
+};
@@ -0,0 +1,94 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <list>
+
+#include "FeatureInfo.h"
+#include "Threading.h"
+
+//Load the features of an image from disk (called by the FeatureStore from any thread)
+class FeatureLoader
+{
+	public:
+		virtual ~FeatureLoader() {}
+
+		virtual bool loadFeatures(int fileIndex, FeatureInfo& info) = 0;
+};
+
+//Features of all images with a bounded LRU cache
+//Features which are not in use can be evicted when the cache is full, they are
+//paged in again from their key file by the FeatureLoader on the next acquire
+class FeatureStore
+{
+	public:
+		FeatureStore();
+		~FeatureStore();
+
+		//cacheSize in bytes (0: unlimited, features are never evicted)
+		void reset(int nbImage, size_t cacheSize, FeatureLoader* loader);
+
+		//take ownership of the features of an image (already saved on disk)
+		void insert(int fileIndex, FeatureInfo* info);
+
+		//return the features of an image (loaded if needed), they stay in RAM until released
+		const FeatureInfo* acquire(int fileIndex);
+		void release(int fileIndex);
+
+		//account for RAM allocated after loading by an acquired image (k-d forest)
+		void updateMemorySize(int fileIndex);
+
+		int  getFeatureCount(int fileIndex);
+		int  getImageCount() const { return (int) mEntries.size(); }
+		bool isBounded() const     { return mCacheSize > 0; }
+		size_t getCacheSize() const { return mCacheSize; }
+		size_t getAverageImageSize();
+
+	protected:
+		struct Entry
+		{
+			Entry() : info(NULL), refCount(0), loading(false), inCache(false), width(0), height(0), nbFeature(0), size(0) {}
+
+			FeatureInfo*             info;
+			int                      refCount;
+			bool                     loading;
+			bool                     inCache;  //in mLRU (loaded and not acquired)
+			std::list<int>::iterator position; //position in mLRU
+			int                      width;
+			int                      height;
+			int                      nbFeature;
+			size_t                   size;     //RAM used when loaded
+		};
+
+		void clear();
+		void evict();
+
+		std::vector<Entry> mEntries;
+		std::list<int>     mLRU;        //unused loaded entries, most recently used first
+		size_t             mCacheSize;
+		size_t             mMemoryUsed;
+		FeatureLoader*     mLoader;
+		Mutex              mMutex;
+		Condition          mLoaded;
+};
@@ -0,0 +1,60 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "FeatureInfo.h"
+
+//Geometric verification of the putative matches of a pair with a fundamental matrix
+//7-point RANSAC with PROSAC sampling (most distinctive matches first), early termination
+//once the confidence is reached and a normalized 8-point refit on the inliers
+class GeometricVerifier
+{
+	public:
+		//threshold: maximum Sampson distance in pixels, minInlier: pairs with less inliers are dropped
+		GeometricVerifier(float threshold, int minInlier);
+
+		//keep the matches consistent with the best fundamental matrix (all matches are removed
+		//when less than minInlier are found), return the number of matches kept
+		//ratios: score of each match from the matcher (SiftMatcher::getRatios), when empty the
+		//matches are ranked by descriptor dot product instead
+		int verify(const FeatureInfo& featureA, const FeatureInfo& featureB, std::vector<Match>& matches, const std::vector<float>& ratios);
+
+	protected:
+		void sortByRatio(const std::vector<float>& ratios);
+		void sortBySimilarity(const FeatureInfo& featureA, const FeatureInfo& featureB, const std::vector<Match>& matches);
+		void drawSample(int nbCandidate, bool includeLast, int* sample);
+		int findInliers(const double* F, std::vector<unsigned char>& inliers) const;
+
+		float                      mThreshold;
+		int                        mMinInlier;
+		unsigned int               mSeed;        //reset for each pair: same result whatever the worker
+		std::vector<int>           mOrder;       //match indices by increasing ratio (or decreasing similarity)
+		std::vector<double>        mPointsA;     //x y in pixels, in mOrder order
+		std::vector<double>        mPointsB;
+		std::vector<double>        mNormalizedA; //centered and scaled to a mean distance of sqrt(2)
+		std::vector<double>        mNormalizedB;
+		std::vector<unsigned char> mInliers;
+		std::vector<unsigned char> mBestInliers;
+};
@@ -0,0 +1,56 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+//Luminance tile of an image given to SiftGPU
+struct ImageTile
+{
+	int x;
+	int y;
+	int width;
+	int height;
+	std::vector<unsigned char> pixels;
+};
+
+struct DecodedImage
+{
+	DecodedImage() : fileIndex(-1), width(0), height(0), loaded(false), memory(0) {}
+
+	int                    fileIndex;
+	int                    width;
+	int                    height;
+	bool                   loaded;
+	size_t                 memory; //bytes reserved for the decoding and the extraction of the image
+	std::vector<ImageTile> tiles;
+};
+
+//Decode an image as luminance and split it in tileNum x tileNum tiles (each using tilePercent of its tile)
+//Can be called from several threads: jpeg files are decoded with libjpeg, other formats
+//with DevIL which is serialized since it is not thread-safe
+bool decodeImageTiles(const std::string& filename, int tileNum, float tilePercent, DecodedImage& image);
+
+//Image width and height, read from the header only for jpeg files
+bool readImageDimension(const std::string& filename, int& width, int& height);
@@ -0,0 +1,98 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+//Randomized k-d trees over Sift descriptors for approximate nearest neighbour search
+//(Silpa-Anan and Hartley, Optimised KD-trees for fast image descriptor matching, CVPR 2008)
+//All trees are explored with a single priority queue of branches, the search stops
+//once nbCheck descriptors have been compared
+class KdForest
+{
+	public:
+		class SearchBuffer;
+
+		KdForest();
+
+		//descriptors are 128 unsigned char per key-point, read in place (they must outlive the forest)
+		void build(const unsigned char* descriptors, int nbDescriptor, int nbTree);
+
+		//float descriptors normalized to 1.0 are quantized in a copy owned by the forest
+		void build(const float* descriptors, int nbDescriptor, int nbTree);
+
+		//two nearest descriptors (squared euclidean distance) among the checked ones, -1 when not found
+		//buffer is scratch memory reused across queries (one per thread)
+		void findNearest(const unsigned char* query, int nbCheck, int& best, int& second, SearchBuffer& buffer) const;
+
+		const unsigned char* getDescriptors() const   { return mDescriptors; }
+		const unsigned char* getDescriptor(int index) const { return mDescriptors + (size_t) index*128; }
+		int getDescriptorCount() const { return mNbDescriptor; }
+		size_t getMemorySize() const;
+
+	protected:
+		struct Node
+		{
+			int dimension; //-1 for leaves
+			int split;     //queries below split go to the first child
+			int first;     //inner node: first child (second child is first+1), leaf: first index in mIndices
+			int last;      //leaf: last index in mIndices (excluded)
+		};
+
+		struct Branch
+		{
+			Branch(int node, int distance) : node(node), distance(distance) {}
+			bool operator<(const Branch& other) const { return distance > other.distance; } //std heap: nearest first
+
+			int node;
+			int distance; //lower bound of the distance to the descriptors of the branch
+		};
+
+	public:
+		//scratch memory of findNearest: stamps of the checked descriptors and branch queue
+		class SearchBuffer
+		{
+			public:
+				SearchBuffer() : mStamp(0) {}
+
+			protected:
+				friend class KdForest;
+
+				std::vector<unsigned int> mVisited; //stamp of the last query that checked each descriptor
+				unsigned int              mStamp;
+				std::vector<Branch>       mBranches;
+		};
+
+	protected:
+		void buildNode(int nodeIndex, int begin, int end);
+		int chooseDimension(int begin, int end, int& split);
+
+		const unsigned char*       mDescriptors;
+		std::vector<unsigned char> mQuantizedDescriptors; //owned copy of float descriptors
+		int                        mNbDescriptor;
+		std::vector<Node>          mNodes;
+		std::vector<int>           mRoots;   //root node of each tree
+		std::vector<int>           mIndices; //descriptor indices of the leaves (nbDescriptor per tree)
+		unsigned int               mSeed;    //deterministic random split dimensions
+};
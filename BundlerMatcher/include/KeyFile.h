@@ -0,0 +1,43 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include "FeatureInfo.h"
+#include "SiftFile.h"
+
+//Format features as a Lowe .key file (same bytes as the former std::ostream code) in one buffer
+void formatAsciiKeyFile(const FeatureInfo& info, std::vector<char>& buffer);
+
+//Parse a Lowe .key file held in memory, return the number of key-points or -1 if the file is invalid
+int parseAsciiKeyFile(const char* data, size_t size, FeatureInfo& info, bool compactDescriptors);
+
+//Save features as a SiftFile container (.key.bin), descriptors stored as bytes in compact mode
+bool writeSiftFile(const std::string& filename, const FeatureInfo& info);
+bool writeSiftFile(SiftFile::Database& database, const std::string& name, const FeatureInfo& info);
+
+//Load a .key.bin file (current or legacy layout), return the number of key-points or -1 if the file is invalid
+int readSiftFile(const std::string& filename, FeatureInfo& info, bool compactDescriptors);
+int readSiftFile(const SiftFile::Database& database, const std::string& name, FeatureInfo& info, bool compactDescriptors);
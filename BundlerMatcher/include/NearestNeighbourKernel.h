@@ -0,0 +1,140 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <math.h>
+
+#include <emmintrin.h>
+
+//Brute force nearest neighbour kernels of SiftMatcherCPU
+//The dot product matrix of queries (rows) and train descriptors (columns) is computed
+//tile by tile, the best and second best dot products of each row and each column are
+//updated from the same tile so that both matching directions take a single pass
+
+//train descriptors of a tile: compared to all queries while they are in L1 cache (32 KB when widened)
+#define KERNEL_TRAIN_BLOCK 128
+
+//descriptors normalized to 1.0 are stored as floor(0.5+512*d), so a dot product of 512*512 means 1.0
+const float DOT_PRODUCT_SCALE = 1.0f/(512.0f*512.0f);
+
+//same test as SiftMatchGPU: distance is acos(d1*d2) and ratio is computed on distances
+inline bool acceptMatch(int bestDot, int secondDot, float distanceThreshold, float ratioThreshold)
+{
+	float best   = acos(std::min(bestDot*DOT_PRODUCT_SCALE, 1.0f));
+	float second = acos(std::min(secondDot*DOT_PRODUCT_SCALE, 1.0f));
+
+	return best < distanceThreshold && best < second*ratioThreshold;
+}
+
+//ratio between best and second best angle of an accepted match (the lower, the more distinctive)
+inline float getMatchRatio(int bestDot, int secondDot)
+{
+	float best   = acos(std::min(bestDot*DOT_PRODUCT_SCALE, 1.0f));
+	float second = acos(std::min(secondDot*DOT_PRODUCT_SCALE, 1.0f));
+
+	return second > 0.0f ? best/second : 1.0f;
+}
+
+inline int dotProduct(const unsigned char* a, const unsigned char* b)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sum = _mm_setzero_si128();
+
+	for (int k=0; k<128; k+=16)
+	{
+		__m128i va = _mm_loadu_si128((const __m128i*) (a+k));
+		__m128i vb = _mm_loadu_si128((const __m128i*) (b+k));
+		sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero)));
+		sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero)));
+	}
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+	return _mm_cvtsi128_si32(sum);
+}
+
+//best and second best dot products of a row or a column
+struct NearestState
+{
+	NearestState() : bestDot(0), secondDot(0), bestIndex(-1) {}
+
+	//strict comparisons in ascending index order: ties keep the first descriptor
+	void update(int dot, int index)
+	{
+		if (dot > bestDot)
+		{
+			secondDot = bestDot;
+			bestDot   = dot;
+			bestIndex = index;
+		}
+		else if (dot > secondDot)
+			secondDot = dot;
+	}
+
+	//fold the state of the following indices (same result as updating with them in order)
+	void merge(const NearestState& other)
+	{
+		if (other.bestIndex == -1)
+			return;
+		update(other.bestDot, other.bestIndex);
+		update(other.secondDot, other.bestIndex);
+	}
+
+	bool accept(float distanceThreshold, float ratioThreshold) const
+	{
+		return bestIndex != -1 && acceptMatch(bestDot, secondDot, distanceThreshold, ratioThreshold);
+	}
+
+	float getRatio() const
+	{
+		return getMatchRatio(bestDot, secondDot);
+	}
+
+	int bestDot;
+	int secondDot;
+	int bestIndex;
+};
+
+enum NearestNeighbourKernel
+{
+	KERNEL_SSE2,
+	KERNEL_AVX2,
+	KERNEL_AVX512
+};
+
+//widest kernel supported by the CPU, the operating system and the compiler
+NearestNeighbourKernel getNearestNeighbourKernel();
+const char* getKernelName(NearestNeighbourKernel kernel);
+
+//unsigned char train descriptors widened to 16 bits (input of the AVX kernels)
+void widenDescriptors(const unsigned char* descriptors, int nbDescriptor, short* output);
+
+//update rows[i-begin] for queries begin..end-1 and columns[j] for train descriptors blockBegin..blockEnd-1
+//with all the dot products of the tile (results are identical for all kernels)
+void updateNearestSSE2(const unsigned char* queries, int begin, int end, const unsigned char* train, int blockBegin, int blockEnd,
+	NearestState* rows, NearestState* columns);
+void updateNearestAVX2(const unsigned char* queries, int begin, int end, const short* train, int blockBegin, int blockEnd,
+	NearestState* rows, NearestState* columns);
+void updateNearestAVX512(const unsigned char* queries, int begin, int end, const short* train, int blockBegin, int blockEnd,
+	NearestState* rows, NearestState* columns);
@@ -0,0 +1,85 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "SiftMatcher.h"
+#include "Threading.h"
+
+//Interface called by the PairScheduler for each pair (from any worker thread)
+class PairWorker
+{
+	public:
+		virtual ~PairWorker() {}
+
+		virtual void processPair(int workerIndex, const Match& pair) = 0;
+};
+
+//Work-stealing scheduler distributing image pairs over worker threads
+//Each worker owns a contiguous range of pairs and steals half of the largest
+//remaining range once its own range is empty
+class PairScheduler
+{
+	public:
+		PairScheduler(int nbWorker);
+		~PairScheduler();
+
+		//process all pairs and return once they are done (nbWorker == 1 runs in the calling thread)
+		void run(const Pairs& pairs, PairWorker& worker);
+
+		int getWorkerCount() const { return mNbWorker; }
+
+	protected:
+		struct WorkRange
+		{
+			Mutex mutex;
+			int   begin;
+			int   end;
+		};
+
+		class WorkerThread : public Thread
+		{
+			public:
+				WorkerThread(PairScheduler* scheduler, int workerIndex) : mScheduler(scheduler), mWorkerIndex(workerIndex) {}
+
+			protected:
+				virtual void run() { mScheduler->work(mWorkerIndex); }
+
+				PairScheduler* mScheduler;
+				int            mWorkerIndex;
+		};
+
+		void work(int workerIndex);
+		bool popPair(int workerIndex, int& pairIndex);
+		bool stealPairs(int workerIndex);
+
+		int                     mNbWorker;
+		std::vector<WorkRange*> mRanges;
+		const Pairs*            mPairs;
+		PairWorker*             mWorker;
+};
+
+
+//sort pairs by blocks of blockSize images (blocked traversal of the pair matrix)
+void sortPairsByBlock(Pairs& pairs, int blockSize);
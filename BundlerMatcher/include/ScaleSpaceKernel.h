@@ -0,0 +1,60 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+//Scale space kernels of SiftExtractorCPU: separable Gaussian blur, difference of Gaussian and 2x downsampling
+//of float images (rows of width floats). Each function processes a range of rows so that callers can split
+//an image between threads. All kernels compute the same operations in the same order (no fused multiply-add)
+//and give identical results
+
+enum ScaleSpaceKernel
+{
+	SCALE_SPACE_SSE2,
+	SCALE_SPACE_AVX2
+};
+
+//widest kernel supported by the CPU, the operating system and the compiler
+ScaleSpaceKernel getScaleSpaceKernel();
+const char* getScaleSpaceKernelName(ScaleSpaceKernel kernel);
+
+//half of a normalized Gaussian kernel of radius ceil(4*sigma): coefficients[0] is the center
+void createGaussianKernel(float sigma, std::vector<float>& coefficients);
+
+//horizontal pass of the rows begin..end-1, borders are replicated (padded: width + 2*radius floats)
+void convolveRowsSSE2(const float* input, float* output, int width, int begin, int end, const float* coefficients, int radius, float* padded);
+void convolveRowsAVX2(const float* input, float* output, int width, int begin, int end, const float* coefficients, int radius, float* padded);
+
+//vertical pass of the rows begin..end-1, rows above and below the image are replicated
+void convolveColumnsSSE2(const float* input, float* output, int width, int height, int begin, int end, const float* coefficients, int radius);
+void convolveColumnsAVX2(const float* input, float* output, int width, int height, int begin, int end, const float* coefficients, int radius);
+
+//output = b - a for the pixels begin..end-1
+void subtractSSE2(const float* a, const float* b, float* output, size_t begin, size_t end);
+void subtractAVX2(const float* a, const float* b, float* output, size_t begin, size_t end);
+
+//rows begin..end-1 of the (width/2) x (height/2) output: even pixels of the even rows
+void downsampleSSE2(const float* input, int width, float* output, int begin, int end);
+void downsampleAVX2(const float* input, int width, float* output, int begin, int end);
@@ -0,0 +1,128 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "SiftGPU.h"
+#include "FeatureInfo.h"
+#include "ScaleSpaceKernel.h"
+#include "Threading.h"
+
+//Sift feature extraction backend
+//Key-points as returned by SiftGPU: x, y in pixels (pixel centers at +0.5), scale in pixels,
+//orientation in radians, descriptors are 128 floats per key-point normalized to 1.0
+class SiftExtractor
+{
+	public:
+		virtual ~SiftExtractor();
+
+		//features of a luminance image (replace keys and descriptors), return the number of key-points or -1 on error
+		virtual int extract(int width, int height, const unsigned char* pixels, SiftKeyPoints& keys, SiftKeyDescriptors& descriptors) = 0;
+
+		//RAM used while extracting an image (pyramid buffers, excluding the input pixels)
+		virtual size_t getMemoryUsage(int width, int height) const = 0;
+};
+
+//SiftGPU wrapper (need an OpenGL context)
+class SiftExtractorGPU : public SiftExtractor
+{
+	public:
+		SiftExtractorGPU(int firstOctave);
+		virtual ~SiftExtractorGPU();
+
+		bool isInitialized() const { return mIsInitialized; }
+
+		virtual int extract(int width, int height, const unsigned char* pixels, SiftKeyPoints& keys, SiftKeyDescriptors& descriptors);
+		virtual size_t getMemoryUsage(int width, int height) const;
+
+	protected:
+		SiftGPU* mSift;
+		bool     mIsInitialized;
+};
+
+//float image of the scale space
+struct SiftImage
+{
+	SiftImage() : width(0), height(0) {}
+
+	void resize(int width, int height)
+	{
+		this->width  = width;
+		this->height = height;
+		pixels.resize((size_t) width*height);
+	}
+
+	float* getRow(int y)             { return &pixels[(size_t) y*width]; }
+	const float* getRow(int y) const { return &pixels[(size_t) y*width]; }
+
+	int width;
+	int height;
+	std::vector<float> pixels;
+};
+
+//key-point found in the difference of Gaussian of an octave (octave pixels)
+struct SiftCandidate
+{
+	float x;
+	float y;
+	float sigma;
+	int   level; //Gaussian level used for orientation and descriptor
+};
+
+//Multithreaded CPU implementation of SiftGPU (Lowe 2004 with SiftGPU defaults: 3 levels per octave,
+//sigma 1.6, DoG threshold 0.02/3, edge threshold 10, 2 orientations max)
+//Gaussian levels are built with the SSE2/AVX2 kernels of ScaleSpaceKernel, octaves are processed one after the other
+class SiftExtractorCPU : public SiftExtractor
+{
+	public:
+		//firstOctave: -1 upsamples the image, 0 is the full resolution, 1 half resolution...
+		SiftExtractorCPU(int firstOctave, int nbThread = 1);
+		virtual ~SiftExtractorCPU();
+
+		//buffers are released after each image so that the memory used is bounded by getMemoryUsage
+		virtual int extract(int width, int height, const unsigned char* pixels, SiftKeyPoints& keys, SiftKeyDescriptors& descriptors);
+		virtual size_t getMemoryUsage(int width, int height) const;
+
+		ScaleSpaceKernel getKernel() const { return mKernel; }
+		void setKernel(ScaleSpaceKernel kernel) { mKernel = kernel; } //must be supported (benchmark)
+
+	protected:
+		//base image blurred to sigma0 in mGaussians[0], buildOctave/nextOctave while hasOctave
+		void createScaleSpace(int width, int height, const unsigned char* pixels);
+		bool hasOctave() const;
+		void createBase(int width, int height, const unsigned char* pixels);
+		void buildOctave();
+		void nextOctave();
+		void findCandidates(std::vector<SiftCandidate>& candidates);
+		void computeDescriptors(const std::vector<SiftCandidate>& candidates, float scale, float offset, SiftKeyPoints& keys, SiftKeyDescriptors& descriptors);
+
+		int                    mFirstOctave;
+		ThreadPool             mPool;      //threads reused for every pass of every image
+		int                    mNbThread;
+		ScaleSpaceKernel       mKernel;
+		float                  mBaseOffset; //input position of the first pixel of the base image
+		std::vector<SiftImage> mGaussians; //levels per octave + 3 Gaussian images of the current octave
+		std::vector<SiftImage> mDoGs;      //levels per octave + 2 differences of Gaussian
+		SiftImage              mBlurred;   //horizontal pass of the separable convolution
+};
@@ -0,0 +1,150 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <utility>
+
+#include "SiftGPU.h"
+#include "KdForest.h"
+#include "NearestNeighbourKernel.h"
+#include "Threading.h"
+
+//Largest key-point set matched on GPU (larger pairs are matched exactly by the CPU block engine)
+#define MATCH_BUFFER 24576
+
+//Randomized k-d trees per image for approximate matching
+#define ANN_TREE 4
+
+typedef std::pair<unsigned int, unsigned int> Match;
+typedef std::vector<Match> Pairs;
+
+//Sift descriptor matching backend
+//Descriptors are 128 floats per key-point normalized to 1.0 (SiftGPU output)
+//or 128 unsigned char per key-point normalized to 512 (.key file values)
+class SiftMatcher
+{
+	public:
+		SiftMatcher(float distanceThreshold, float ratioThreshold);
+		virtual ~SiftMatcher();
+
+		//match descriptors of A against B and append (indexA, indexB) to matches
+		//descriptors are read in place (no copy), return the number of matches found
+		virtual int match(const float* descriptorsA, int nbA, const float* descriptorsB, int nbB, std::vector<Match>& matches) = 0;
+		virtual int match(const unsigned char* descriptorsA, int nbA, const unsigned char* descriptorsB, int nbB, std::vector<Match>& matches) = 0;
+
+		//ratio between best and second best angle of each match found by the last call to match
+		//(the worst of both directions), empty when the backend does not report it (SiftMatchGPU)
+		const std::vector<float>& getRatios() const { return mRatios; }
+
+	protected:
+		float              mDistanceThreshold; //maximum angle between two descriptors: acos(d1*d2)
+		float              mRatioThreshold;    //maximum ratio between best and second best angle
+		std::vector<float> mRatios;
+};
+
+class SiftMatcherCPU;
+
+//SiftMatchGPU wrapper (need an OpenGL context)
+//SiftMatchGPU only returns the final matches: pairs with more than MATCH_BUFFER key-points can not
+//be split in blocks without losing the global ratio test, they are matched by a SiftMatcherCPU
+class SiftMatcherGPU : public SiftMatcher
+{
+	public:
+		SiftMatcherGPU(float distanceThreshold, float ratioThreshold, int nbThread = 1);
+		virtual ~SiftMatcherGPU();
+
+		bool isInitialized() const { return mIsInitialized; }
+
+		virtual int match(const float* descriptorsA, int nbA, const float* descriptorsB, int nbB, std::vector<Match>& matches);
+		virtual int match(const unsigned char* descriptorsA, int nbA, const unsigned char* descriptorsB, int nbB, std::vector<Match>& matches);
+
+	protected:
+		template <typename T>
+		int matchGPU(const T* descriptorsA, int nbA, const T* descriptorsB, int nbB, std::vector<Match>& matches);
+
+		SiftMatchGPU*   mMatcher;
+		bool            mIsInitialized;
+		int           (*mMatchBuffer)[2];  //reused for every pair (MATCH_BUFFER matches)
+		SiftMatcherCPU* mLargePairMatcher; //pairs with more than MATCH_BUFFER key-points
+};
+
+//Multithreaded CPU implementation of SiftMatchGPU::GetSiftMatch (mutual best match)
+//Both directions are computed in a single pass over the dot product matrix
+//Descriptors are quantized to 0..255 (as in .key files) and compared with SSE2, AVX2 or AVX-512
+//dot products (widest kernel supported by the CPU)
+class SiftMatcherCPU : public SiftMatcher
+{
+	public:
+		SiftMatcherCPU(float distanceThreshold, float ratioThreshold, int nbThread = 1);
+		virtual ~SiftMatcherCPU();
+
+		virtual int match(const float* descriptorsA, int nbA, const float* descriptorsB, int nbB, std::vector<Match>& matches);
+		virtual int match(const unsigned char* descriptorsA, int nbA, const unsigned char* descriptorsB, int nbB, std::vector<Match>& matches);
+
+		NearestNeighbourKernel getKernel() const { return mKernel; }
+		void setKernel(NearestNeighbourKernel kernel) { mKernel = kernel; } //must be supported (benchmark)
+
+	protected:
+		//best and second best dot products of each descriptor of A (mRows) and of B (mColumns) in a single pass
+		void findMutualNearest(const unsigned char* descriptorsA, int nbA, const unsigned char* descriptorsB, int nbB);
+
+		ThreadPool                 mPool;         //threads reused for every pair
+		int                        mNbThread;
+		NearestNeighbourKernel     mKernel;
+		std::vector<short>         mTrainWide;    //train descriptors of the AVX kernels
+		std::vector<unsigned char> mDescriptorsA; //quantized float descriptors
+		std::vector<unsigned char> mDescriptorsB;
+		std::vector<NearestState>  mRows;         //A -> B
+		std::vector<NearestState>  mColumns;      //B -> A
+		std::vector<std::vector<NearestState> > mThreadColumns; //B -> A for the rows of each thread
+		std::vector<int>           mNearestA;     //A -> B (approximate matching)
+		std::vector<int>           mNearestB;     //B -> A (approximate matching)
+		std::vector<float>         mNearestRatiosA; //ratio of mNearestA
+		std::vector<float>         mNearestRatiosB;
+};
+
+//Approximate CPU matcher: nearest neighbours are searched in randomized k-d forests
+//built once per image, each query compares at most nbCheck descriptors
+//Same distance, ratio and mutual tests as SiftMatcherCPU on the two nearest candidates found
+class SiftMatcherANN : public SiftMatcherCPU
+{
+	public:
+		SiftMatcherANN(float distanceThreshold, float ratioThreshold, int nbCheck, int nbThread = 1);
+		virtual ~SiftMatcherANN();
+
+		//mutual approximate best matches between the descriptors indexed by two forests
+		int match(const KdForest& forestA, const KdForest& forestB, std::vector<Match>& matches);
+
+		//forests are built for each call (use the KdForest version to reuse them)
+		virtual int match(const float* descriptorsA, int nbA, const float* descriptorsB, int nbB, std::vector<Match>& matches);
+		virtual int match(const unsigned char* descriptorsA, int nbA, const unsigned char* descriptorsB, int nbB, std::vector<Match>& matches);
+
+		//brute force matching (reference used to measure the recall)
+		int matchExact(const unsigned char* descriptorsA, int nbA, const unsigned char* descriptorsB, int nbB, std::vector<Match>& matches);
+
+	protected:
+		void findApproximateNearest(const KdForest& queries, const KdForest& train, std::vector<int>& nearest, std::vector<float>& ratios);
+
+		int mNbCheck;
+};
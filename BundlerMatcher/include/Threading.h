@@ -0,0 +1,244 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <stddef.h>
+
+//Minimal threading helpers (Win32 threads on Windows, pthreads elsewhere)
+
+class Mutex
+{
+	public:
+		Mutex();
+		~Mutex();
+
+		void lock();
+		void unlock();
+
+	protected:
+		Mutex(const Mutex&);
+		Mutex& operator=(const Mutex&);
+
+		void* mHandle;
+
+		friend class Condition;
+};
+
+//Condition variable used with a locked Mutex
+class Condition
+{
+	public:
+		Condition();
+		~Condition();
+
+		void wait(Mutex& mutex); //mutex must be locked by the caller
+		void notifyOne();
+		void notifyAll();
+
+	protected:
+		Condition(const Condition&);
+		Condition& operator=(const Condition&);
+
+		void* mHandle;
+};
+
+class ScopedLock
+{
+	public:
+		ScopedLock(Mutex& mutex) : mMutex(mutex) { mMutex.lock(); }
+		~ScopedLock() { mMutex.unlock(); }
+
+	protected:
+		ScopedLock(const ScopedLock&);
+		ScopedLock& operator=(const ScopedLock&);
+
+		Mutex& mMutex;
+};
+
+class Thread
+{
+	public:
+		Thread();
+		virtual ~Thread();
+
+		bool start();
+		void join();
+
+		//entry point called from the native thread
+		static void execute(Thread* thread);
+
+	protected:
+		virtual void run() = 0;
+
+		Thread(const Thread&);
+		Thread& operator=(const Thread&);
+
+		void* mHandle;
+};
+
+//Range of a job processed by one thread of a ThreadPool (threadIndex selects the output of the thread)
+typedef void (*RangeFunction)(void* context, int threadIndex, int begin, int end);
+
+//Worker threads created once and reused for every job: 0..count-1 is split in min(threadCount, count)
+//contiguous ranges, range i is processed by thread i (range 0 by the calling thread)
+class ThreadPool
+{
+	public:
+		ThreadPool(int nbThread = 1);
+		~ThreadPool();
+
+		//threads that could be started (the calling thread included)
+		int getThreadCount() const { return (int) mThreads.size() + 1; }
+
+		//process all ranges and return once they are done (not reentrant: one job at a time)
+		void run(RangeFunction function, void* context, int count);
+
+	protected:
+		class WorkerThread : public Thread
+		{
+			public:
+				WorkerThread(ThreadPool* pool, int threadIndex) : mPool(pool), mThreadIndex(threadIndex) {}
+
+			protected:
+				virtual void run() { mPool->work(mThreadIndex); }
+
+				ThreadPool* mPool;
+				int         mThreadIndex;
+		};
+
+		void work(int threadIndex);
+		void runRange(int threadIndex);
+
+		ThreadPool(const ThreadPool&);
+		ThreadPool& operator=(const ThreadPool&);
+
+		std::vector<WorkerThread*> mThreads;
+		Mutex                      mMutex;
+		Condition                  mJobReady;
+		Condition                  mJobDone;
+		RangeFunction              mFunction;
+		void*                      mContext;
+		int                        mCount;
+		int                        mNbRange;
+		int                        mNbPending;  //ranges of the current job not done yet
+		int                        mJobIndex;   //incremented for each job
+		bool                       mStopping;
+};
+
+//Bounded FIFO queue between producer and consumer threads
+template <typename T>
+class BlockingQueue
+{
+	public:
+		BlockingQueue(unsigned int capacity = 1) : mCapacity(capacity), mClosed(false) {}
+
+		void reset(unsigned int capacity)
+		{
+			ScopedLock lock(mMutex);
+			mItems.clear();
+			mCapacity = (capacity > 0 ? capacity : 1);
+			mClosed   = false;
+		}
+
+		//block while the queue is full
+		void push(const T& item)
+		{
+			ScopedLock lock(mMutex);
+			while (mItems.size() >= mCapacity)
+				mNotFull.wait(mMutex);
+			mItems.push_back(item);
+			mNotEmpty.notifyOne();
+		}
+
+		//block while the queue is empty, return false once the queue is closed and empty
+		bool pop(T& item)
+		{
+			ScopedLock lock(mMutex);
+			while (mItems.empty() && !mClosed)
+				mNotEmpty.wait(mMutex);
+			if (mItems.empty())
+				return false;
+			item = mItems.front();
+			mItems.pop_front();
+			mNotFull.notifyOne();
+			return true;
+		}
+
+		//no more items will be pushed
+		void close()
+		{
+			ScopedLock lock(mMutex);
+			mClosed = true;
+			mNotEmpty.notifyAll();
+		}
+
+	protected:
+		std::deque<T> mItems;
+		unsigned int  mCapacity;
+		bool          mClosed;
+		Mutex         mMutex;
+		Condition     mNotEmpty;
+		Condition     mNotFull;
+};
+
+//Bytes shared by several threads: acquire blocks until the bytes fit in the budget
+//(a request larger than the whole budget is granted once nothing else is in use)
+class MemoryBudget
+{
+	public:
+		MemoryBudget(size_t capacity = 0) : mCapacity(capacity), mUsed(0) {}
+
+		void reset(size_t capacity)
+		{
+			ScopedLock lock(mMutex);
+			mCapacity = capacity;
+			mUsed     = 0;
+		}
+
+		void acquire(size_t bytes)
+		{
+			ScopedLock lock(mMutex);
+			while (mUsed > 0 && mUsed + bytes > mCapacity)
+				mReleased.wait(mMutex);
+			mUsed += bytes;
+		}
+
+		void release(size_t bytes)
+		{
+			ScopedLock lock(mMutex);
+			mUsed -= std::min(bytes, mUsed);
+			mReleased.notifyAll();
+		}
+
+	protected:
+		size_t    mCapacity;
+		size_t    mUsed;
+		Mutex     mMutex;
+		Condition mReleased;
+};
+
+//number of logical cores available to the process
+int getProcessorCount();
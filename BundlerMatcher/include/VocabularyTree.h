@@ -0,0 +1,90 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <utility>
+
+#include "Threading.h"
+
+//Hierarchical k-means tree quantizing Sift descriptors to visual words
+//(Nister and Stewenius, Scalable Recognition with a Vocabulary Tree, CVPR 2006)
+//Descriptors are 128 unsigned char per key-point (.key file values)
+class VocabularyTree
+{
+	public:
+		VocabularyTree(int nbThread = 1);
+
+		//build a tree of at most branching^depth words from nbDescriptor sample descriptors
+		void train(const unsigned char* descriptors, int nbDescriptor, int branching, int depth);
+
+		//word of each descriptor (leaf reached by following the nearest center at each level)
+		void quantize(const unsigned char* descriptors, int nbDescriptor, std::vector<int>& words) const;
+		int quantize(const unsigned char* descriptor) const;
+
+		int getWordCount() const { return mNbWord; }
+
+	protected:
+		struct Node
+		{
+			int firstChild; //children are contiguous in mNodes
+			int nbChild;    //0 for leaves
+			int word;       //-1 for inner nodes
+		};
+
+		void trainNode(int nodeIndex, const unsigned char* descriptors, std::vector<int>& indices, int level);
+		int assignClusters(const unsigned char* descriptors, const std::vector<int>& indices,
+			const std::vector<float>& centers, int nbCenter, std::vector<int>& assignment);
+		int addLeaf(int nodeIndex);
+
+		std::vector<Node>  mNodes;
+		std::vector<float> mCenters; //128 floats per node
+		int                mBranching;
+		int                mDepth;
+		int                mNbWord;
+		unsigned int       mSeed;    //deterministic center initialization
+		mutable ThreadPool mPool;    //threads reused for every k-means iteration and every image
+		std::vector<int>   mChanged; //changed assignments counted by each thread of the pool
+};
+
+//TF-IDF weighted inverted file of the visual words of each image
+class RetrievalIndex
+{
+	public:
+		void reset(int nbWord, int nbImage);
+
+		//words of all descriptors of an image (any order, repeated words are counted)
+		void addImage(int imageIndex, const std::vector<int>& words);
+
+		//compute idf weights and normalize image vectors (call once all images are added)
+		void finalize();
+
+		//the nbResult images most similar to imageIndex (cosine of tf-idf vectors), best first
+		void query(int imageIndex, int nbResult, std::vector<int>& results) const;
+
+	protected:
+		typedef std::pair<int, float> Entry; //(word or image index, weight)
+
+		std::vector<std::vector<Entry> > mImageWords;   //word frequencies of each image
+		std::vector<std::vector<Entry> > mInvertedFile; //images containing each word
+};
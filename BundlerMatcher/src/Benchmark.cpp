@@ -0,0 +1,430 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include "Benchmark.h"
+#include "SiftMatcher.h"
+#include "FeatureStore.h"
+#include "NearestNeighbourKernel.h"
+#include "SiftExtractor.h"
+#include "ScaleSpaceKernel.h"
+#include "KeyFile.h"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include <new>
+
+//each measure is repeated for at least this long, the fastest run is kept (the slower ones are disturbed)
+#define BENCHMARK_SECONDS 2.0
+
+//octaves of the scale space benchmark (the smaller ones are too short to be measured)
+#define BENCHMARK_OCTAVES 4
+
+//key-points of the .key parsing benchmark (a large photo)
+#define BENCHMARK_KEY_POINTS 10000
+
+static unsigned int sSeed = 1;
+
+//heap bytes allocated while sCountAllocations is set: a deep copy of key-points or descriptors
+//allocates its size (benchmarks are single threaded, the other threads are idle)
+static bool   sCountAllocations = false;
+static size_t sAllocatedBytes   = 0;
+
+void* operator new(size_t size)
+{
+	if (sCountAllocations)
+		sAllocatedBytes += size;
+	void* memory = malloc(size > 0 ? size : 1);
+	if (!memory)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void* memory)
+{
+	free(memory);
+}
+
+static unsigned int nextRandom()
+{
+	sSeed = sSeed*1103515245 + 12345;
+	return (sSeed >> 16) & 0x7FFF;
+}
+
+//Sift-like descriptors: sparse values normalized to 512 (.key file scale)
+static void createDescriptors(int nbDescriptor, std::vector<unsigned char>& descriptors)
+{
+	descriptors.resize((size_t) nbDescriptor*128);
+	std::vector<float> values(128);
+	for (int i=0; i<nbDescriptor; ++i)
+	{
+		float norm = 0.0f;
+		for (int k=0; k<128; ++k)
+		{
+			values[k] = (nextRandom() % 4 == 0) ? (float) (nextRandom() % 256) : 0.0f;
+			norm += values[k]*values[k];
+		}
+		norm = (norm > 0.0f ? 512.0f/sqrt(norm) : 0.0f);
+		for (int k=0; k<128; ++k)
+			descriptors[(size_t) i*128+k] = (unsigned char) std::min((int) (values[k]*norm + 0.5f), 255);
+	}
+}
+
+//half of the descriptors of B are noisy copies of descriptors of A (they should match)
+static void perturbDescriptors(const std::vector<unsigned char>& source, std::vector<unsigned char>& descriptors)
+{
+	for (size_t i=0; i<descriptors.size()/128; i+=2)
+	{
+		for (int k=0; k<128; ++k)
+		{
+			int value = source[i*128+k] + (int) (nextRandom() % 9) - 4;
+			descriptors[i*128+k] = (unsigned char) std::min(std::max(value, 0), 255);
+		}
+	}
+}
+
+static double getSeconds()
+{
+	return (double) clock() / CLOCKS_PER_SEC;
+}
+
+static void benchmarkMatching(int nbDescriptor)
+{
+	std::vector<unsigned char> descriptorsA;
+	std::vector<unsigned char> descriptorsB;
+	createDescriptors(nbDescriptor, descriptorsA);
+	createDescriptors(nbDescriptor, descriptorsB);
+	perturbDescriptors(descriptorsA, descriptorsB);
+
+	std::cout << "[Matching: " << nbDescriptor << " x " << nbDescriptor << " descriptors, both directions]" << std::endl;
+
+	SiftMatcherCPU matcher(0.6f, 0.8f, 1);
+	std::vector<Match> reference;
+	for (int kernel=KERNEL_SSE2; kernel<=getNearestNeighbourKernel(); ++kernel)
+	{
+		matcher.setKernel((NearestNeighbourKernel) kernel);
+
+		std::vector<Match> matches;
+		double best  = 0.0;
+		double start = getSeconds();
+		int nbRun = 0;
+		while (nbRun < 3 || getSeconds() - start < BENCHMARK_SECONDS)
+		{
+			matches.clear();
+			double runStart = getSeconds();
+			matcher.match(&descriptorsA[0], nbDescriptor, &descriptorsB[0], nbDescriptor, matches);
+			double elapsed = getSeconds() - runStart;
+			if (nbRun == 0 || elapsed < best)
+				best = elapsed;
+			nbRun++;
+		}
+
+		//all kernels must find the same matches
+		if (kernel == KERNEL_SSE2)
+			reference = matches;
+		bool identical = (matches == reference);
+
+		double pairs = (double) nbDescriptor*nbDescriptor / std::max(best, 1e-6);
+		std::cout << std::setw(8) << getKernelName((NearestNeighbourKernel) kernel) << ": " << std::fixed << std::setprecision(0)
+			<< pairs/1e6 << "M descriptor pairs/s, " << matches.size() << " matches" << (identical ? "" : " (DIFFERENT FROM SSE2)") << std::endl;
+	}
+}
+
+static FeatureInfo* createFeatures(const std::vector<unsigned char>& descriptors, int nbFeature)
+{
+	FeatureInfo* info = new FeatureInfo(0, 0);
+	info->points.resize(nbFeature);
+	info->descriptors.resize((size_t) nbFeature*128);
+	for (size_t i=0; i<info->descriptors.size(); ++i)
+		info->descriptors[i] = descriptors[i]/512.0f;
+
+	return info;
+}
+
+//previous BundlerMatcher::matchSiftFeature: key-points and descriptors of both images copied for each pair
+static void matchCopies(FeatureStore& store, SiftMatcher& matcher, std::vector<Match>& matches)
+{
+	SiftKeyPoints pointsA           = store.acquire(0)->points;
+	SiftKeyDescriptors descriptorsA = store.acquire(0)->descriptors;
+	SiftKeyPoints pointsB           = store.acquire(1)->points;
+	SiftKeyDescriptors descriptorsB = store.acquire(1)->descriptors;
+	matcher.match(&descriptorsA[0], (int) pointsA.size(), &descriptorsB[0], (int) pointsB.size(), matches);
+	store.release(0);
+	store.release(0);
+	store.release(1);
+	store.release(1);
+}
+
+//BundlerMatcher::matchSiftFeature: features read in place from the store
+static void matchInPlace(FeatureStore& store, SiftMatcher& matcher, std::vector<Match>& matches)
+{
+	const FeatureInfo& featureA = *store.acquire(0);
+	const FeatureInfo& featureB = *store.acquire(1);
+	matcher.match(&featureA.descriptors[0], (int) featureA.points.size(), &featureB.descriptors[0], (int) featureB.points.size(), matches);
+	store.release(0);
+	store.release(1);
+}
+
+//heap bytes per pair once the matcher buffers are allocated (the match list is reused and not counted)
+static void benchmarkPairCopies(int nbDescriptor)
+{
+	std::vector<unsigned char> descriptorsA;
+	std::vector<unsigned char> descriptorsB;
+	createDescriptors(nbDescriptor, descriptorsA);
+	createDescriptors(nbDescriptor, descriptorsB);
+	perturbDescriptors(descriptorsA, descriptorsB);
+
+	FeatureStore store;
+	store.reset(2, 0, NULL);
+	store.insert(0, createFeatures(descriptorsA, nbDescriptor));
+	store.insert(1, createFeatures(descriptorsB, nbDescriptor));
+
+	std::cout << "[Pair setup: " << nbDescriptor << " x " << nbDescriptor << " key-points, float descriptors, heap bytes per pair]" << std::endl;
+
+	SiftMatcherCPU matcher(0.6f, 0.8f, 1);
+	std::vector<Match> matches;
+	const char* names[2] = {"copies", "in place"};
+	for (int path=0; path<2; ++path)
+	{
+		const int nbPair = 3;
+		size_t bytes = 0;
+		for (int pair=0; pair<=nbPair; ++pair)
+		{
+			//the first pair allocates the matcher buffers
+			matches.clear();
+			sAllocatedBytes   = 0;
+			sCountAllocations = (pair > 0);
+			if (path == 0)
+				matchCopies(store, matcher, matches);
+			else
+				matchInPlace(store, matcher, matches);
+			sCountAllocations = false;
+			bytes += sAllocatedBytes;
+		}
+		std::cout << std::setw(8) << names[path] << ": " << bytes/nbPair << " bytes per pair, " << matches.size() << " matches" << std::endl;
+	}
+}
+
+//Scale space of SiftExtractorCPU built octave by octave (Gaussian levels and differences of Gaussian,
+//key-points are not detected) on a single thread
+class ScaleSpaceBenchmark : public SiftExtractorCPU
+{
+	public:
+		ScaleSpaceBenchmark(ScaleSpaceKernel kernel) : SiftExtractorCPU(0, 1) { setKernel(kernel); }
+
+		//best time of each octave, checksums of its differences of Gaussian (identical for all kernels)
+		void run(int width, int height, const unsigned char* pixels, std::vector<double>& seconds,
+			std::vector<double>& megapixels, std::vector<unsigned int>& checksums)
+		{
+			createScaleSpace(width, height, pixels);
+			for (int octave=0; octave<BENCHMARK_OCTAVES && hasOctave(); ++octave)
+			{
+				double best  = 0.0;
+				double start = getSeconds();
+				int nbRun = 0;
+				while (nbRun < 3 || getSeconds() - start < BENCHMARK_SECONDS/BENCHMARK_OCTAVES)
+				{
+					double runStart = getSeconds();
+					buildOctave();
+					double elapsed = getSeconds() - runStart;
+					if (nbRun == 0 || elapsed < best)
+						best = elapsed;
+					nbRun++;
+				}
+
+				unsigned int checksum = 2166136261u;
+				for (unsigned int i=0; i<mDoGs.size(); ++i)
+				{
+					const unsigned char* bytes = (const unsigned char*) &mDoGs[i].pixels[0];
+					for (size_t k=0; k<mDoGs[i].pixels.size()*sizeof(float); ++k)
+						checksum = (checksum ^ bytes[k]) * 16777619u;
+				}
+
+				seconds.push_back(best);
+				megapixels.push_back((double) mGaussians[0].width*mGaussians[0].height / 1e6);
+				checksums.push_back(checksum);
+				nextOctave();
+			}
+		}
+};
+
+//previous BundlerMatcher key reader: operator>> on a stream (setprecision has no effect on input)
+static int parseKeyStream(const std::string& text, FeatureInfo& info)
+{
+	std::istringstream input(text);
+	unsigned int num = 0;
+	unsigned int descCount = 0;
+	input >> num;
+	input >> descCount;
+	if (descCount != 128)
+		return -1;
+
+	info.points.resize(num);
+	info.descriptors.resize((size_t) num*128);
+	size_t index = 0;
+	for (unsigned int i=0; i<num; ++i)
+	{
+		input >> std::setprecision(2) >> info.points[i].y;
+		input >> std::setprecision(2) >> info.points[i].x;
+		input >> std::setprecision(3) >> info.points[i].s;
+		input >> std::setprecision(3) >> info.points[i].o;
+
+		unsigned int feature;
+		for (int k=0; k<128; ++k, ++index)
+		{
+			input >> feature;
+			info.descriptors[index] = ((float)feature)/512.0f;
+		}
+	}
+
+	return (int) num;
+}
+
+//both readers parse the same text from memory, the disk is not measured
+static void benchmarkKeyParsing(int nbPoint)
+{
+	std::vector<unsigned char> descriptors;
+	createDescriptors(nbPoint, descriptors);
+	FeatureInfo* feature = createFeatures(descriptors, nbPoint);
+	for (int i=0; i<nbPoint; ++i)
+	{
+		SiftGPU::SiftKeypoint& point = feature->points[i];
+		point.x = (float) (nextRandom() % 400000) / 100.0f;
+		point.y = (float) (nextRandom() % 300000) / 100.0f;
+		point.s = (float) (nextRandom() % 20000) / 1000.0f + 1.0f;
+		point.o = (float) ((int) (nextRandom() % 6284) - 3142) / 1000.0f;
+	}
+	std::vector<char> buffer;
+	formatAsciiKeyFile(*feature, buffer);
+	delete feature;
+	std::string text(buffer.begin(), buffer.end());
+
+	std::cout << "[Key parsing: " << nbPoint << " key-points, " << text.size()/1024 << " KB of text]" << std::endl;
+
+	const char* names[] = {"stream", "parser"};
+	FeatureInfo streamResult(0, 0);
+	FeatureInfo parserResult(0, 0);
+	FeatureInfo* results[2] = {&streamResult, &parserResult};
+	for (int reader=0; reader<2; ++reader)
+	{
+		double best  = 0.0;
+		double start = getSeconds();
+		int nbRun = 0;
+		int nbParsed = 0;
+		while (nbRun < 3 || getSeconds() - start < BENCHMARK_SECONDS)
+		{
+			double runStart = getSeconds();
+			if (reader == 0)
+				nbParsed = parseKeyStream(text, *results[reader]);
+			else
+				nbParsed = parseAsciiKeyFile(text.c_str(), text.size(), *results[reader], false);
+			double elapsed = getSeconds() - runStart;
+			if (nbRun == 0 || elapsed < best)
+				best = elapsed;
+			nbRun++;
+		}
+
+		//both readers must give the same key-points and descriptors
+		bool identical = (results[reader]->descriptors == results[0]->descriptors);
+		for (unsigned int i=0; identical && i<results[reader]->points.size(); ++i)
+		{
+			const SiftGPU::SiftKeypoint& a = results[reader]->points[i];
+			const SiftGPU::SiftKeypoint& b = results[0]->points[i];
+			identical = (a.x == b.x && a.y == b.y && a.s == b.s && a.o == b.o);
+		}
+
+		std::cout << std::setw(8) << names[reader] << ": " << std::fixed << std::setprecision(1) << best*1000.0 << " ms, "
+			<< text.size()/1024.0/1024.0/std::max(best, 1e-6) << " MB/s, " << nbParsed << " key-points" << (identical ? "" : " (DIFFERENT FROM STREAM)") << std::endl;
+	}
+}
+
+//textured image: gradients and noise (a flat image would be cheaper for no kernel)
+static void createImage(int width, int height, std::vector<unsigned char>& pixels)
+{
+	pixels.resize((size_t) width*height);
+	for (int y=0; y<height; ++y)
+		for (int x=0; x<width; ++x)
+			pixels[(size_t) y*width+x] = (unsigned char) ((x*7 + y*3 + nextRandom() % 32) & 255);
+}
+
+static void benchmarkScaleSpace(double megapixels)
+{
+	//4:3 image, large enough for BENCHMARK_OCTAVES octaves
+	int height = std::max((int) sqrt(megapixels*1e6*3.0/4.0), 128);
+	int width  = height*4/3;
+	std::vector<unsigned char> pixels;
+	createImage(width, height, pixels);
+
+	std::cout << "[Scale space: " << width << " x " << height << " pixels, Gaussian levels and differences of Gaussian per octave]" << std::endl;
+
+	std::vector<unsigned int> reference;
+	for (int kernel=SCALE_SPACE_SSE2; kernel<=getScaleSpaceKernel(); ++kernel)
+	{
+		ScaleSpaceBenchmark benchmark((ScaleSpaceKernel) kernel);
+		std::vector<double> seconds, octaveMegapixels;
+		std::vector<unsigned int> checksums;
+		benchmark.run(width, height, &pixels[0], seconds, octaveMegapixels, checksums);
+
+		//all kernels must build the same scale space
+		if (kernel == SCALE_SPACE_SSE2)
+			reference = checksums;
+		bool identical = (checksums == reference);
+
+		double totalSeconds = 0.0, totalMegapixels = 0.0;
+		std::cout << std::setw(8) << getScaleSpaceKernelName((ScaleSpaceKernel) kernel) << ":" << std::fixed << std::setprecision(1);
+		for (unsigned int i=0; i<seconds.size(); ++i)
+		{
+			std::cout << " octave " << i << " " << octaveMegapixels[i]/std::max(seconds[i], 1e-6) << " MP/s,";
+			totalSeconds    += seconds[i];
+			totalMegapixels += octaveMegapixels[i];
+		}
+		std::cout << " all " << totalMegapixels/std::max(totalSeconds, 1e-6) << " MP/s" << (identical ? "" : " (DIFFERENT FROM SSE2)") << std::endl;
+	}
+}
+
+int runBenchmark(int argc, char* argv[])
+{
+	int nbDescriptor = (argc > 0 ? atoi(argv[0]) : 8192);
+	if (nbDescriptor <= 0)
+	{
+		std::cerr << "Benchmark size [" << nbDescriptor << "] invalid" << std::endl;
+		return 1;
+	}
+	double megapixels = (argc > 1 ? atof(argv[1]) : 12.0);
+	if (megapixels <= 0.0)
+	{
+		std::cerr << "Benchmark image size [" << megapixels << "] invalid" << std::endl;
+		return 1;
+	}
+
+	benchmarkMatching(nbDescriptor);
+	benchmarkPairCopies(nbDescriptor);
+	benchmarkKeyParsing(BENCHMARK_KEY_POINTS);
+	benchmarkScaleSpace(megapixels);
+
+	return 0;
+}
@@ -21,6 +21,11 @@
 */
 
 #include "BundlerMatcher.h"
+#include "PairScheduler.h"
+#include "ImageDecoder.h"
+#include "KeyFile.h"
+#include "VocabularyTree.h"
+#include "MappedFile.h"
 
 #include <iostream>
 #include <fstream>
@@ -28,6 +33,11 @@
 #include <string>
 #include <sstream>
 #include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <set>
+#include <iterator>
+#include <stdio.h>
 
 #define GL_RGB  0x1907
 #define GL_RGBA 0x1908
@@ -36,7 +46,8 @@
 #include <IL/il.h>
 
 BundlerMatcher::BundlerMatcher(float distanceThreshold, float ratioThreshold, int firstOctave, bool binaryWritingEnabled,
-	bool sequenceMatching, int sequenceMatchingLength, bool tileMatching, int tileNum, float tilePercent, bool pairsMatchingEnabled)
+	bool sequenceMatching, int sequenceMatchingLength, bool tileMatching, int tileNum, float tilePercent, bool pairsMatchingEnabled,
+	bool cpuMatching, int nbThread, bool compactDescriptors, size_t featureCacheSize, bool featureDatabase, bool matchStreaming, bool incrementalMatching, int retrievalNeighbours, int approximateChecks, float verifyThreshold, int checkpointPeriod, int shardIndex, int shardCount, bool cpuExtraction, size_t extractionMemory)
 {
 	mBinaryKeyFileWritingEnabled = binaryWritingEnabled;
 	mSequenceMatchingEnabled     = sequenceMatching;
@@ -45,6 +56,27 @@ BundlerMatcher::BundlerMatcher(float distanceThreshold, float ratioThreshold, in
 	mTileNum = tileNum;
 	mPairedMatchingEnabled = pairsMatchingEnabled;
 	mTilePercent = tilePercent;
+	mCpuMatchingEnabled = cpuMatching;
+	mCompactDescriptorsEnabled = compactDescriptors;
+	mFeatureCacheSize = featureCacheSize;
+	mFeatureDatabaseEnabled = featureDatabase;
+	mMatchStreamingEnabled = matchStreaming;
+	mIncrementalMatchingEnabled = incrementalMatching;
+	mRetrievalMatchingEnabled   = retrievalNeighbours > 0;
+	mRetrievalNeighbours        = retrievalNeighbours;
+	mApproximateMatchingEnabled = approximateChecks > 0;
+	mApproximateChecks          = approximateChecks;
+	if (mApproximateMatchingEnabled)
+		mCpuMatchingEnabled = true;
+	mVerificationEnabled        = verifyThreshold > 0.0f;
+	mVerifiersStarted           = false;
+	mVerifyThreshold            = verifyThreshold;
+	mCheckpointEnabled          = checkpointPeriod > 0;
+	mCheckpointPeriod           = checkpointPeriod;
+	mShardIndex                 = shardIndex;
+	mShardCount                 = std::max(shardCount, 1);
+	mNbThread = (nbThread > 0 ? nbThread : getProcessorCount());
+	mExtractionMemory = (extractionMemory > 0 ? extractionMemory : (size_t) EXTRACTION_MEMORY*1048576);
 
 	//DevIL init
 	ilInit();
@@ -54,26 +86,25 @@ BundlerMatcher::BundlerMatcher(float distanceThreshold, float ratioThreshold, in
 	std::cout << "[BundlerMatcher]"<<std::endl;
 	std::cout << "[Initialization]";
 
-	mIsInitialized = true;
 	mDistanceThreshold = distanceThreshold; //0.0 means few match and 1.0 many match (0.0-infinity)
 	mRatioThreshold = ratioThreshold; //0.1 means few matches and 1.0 has no effect (0.1-1.0)
 
-	char fo[10];
-	sprintf(fo, "%d", firstOctave);
-	char* args[] = {"-fo", fo};
-
-	mSift = new SiftGPU;	
-	mSift->ParseParam(2, args);	
-	mSift->SetVerbose(-2);
-
-	int support = mSift->CreateContextGL();
-	if (support != SiftGPU::SIFTGPU_FULL_SUPPORTED)
-		mIsInitialized = false;
-
-	if (mIsInitialized)
-		mSift->AllocatePyramid(12800, 12800);
-
-	mMatcher = new SiftMatchGPU(8192);
+	//SiftGPU when an OpenGL context is available, CPU extractors (one per worker) are created with the extraction jobs
+	mExtractor = NULL;
+	mFirstOctave = firstOctave;
+	mCpuExtractionEnabled = cpuExtraction;
+	if (!cpuExtraction)
+	{
+		SiftExtractorGPU* extractor = new SiftExtractorGPU(firstOctave);
+		if (extractor->isInitialized())
+			mExtractor = extractor;
+		else
+		{
+			delete extractor;
+			mCpuExtractionEnabled = true;
+			std::cout << std::endl << "SiftGPU is not supported, using the CPU extractor" << std::endl;
+		}
+	}
 }
 
 BundlerMatcher::~BundlerMatcher()
@@ -93,6 +124,9 @@ bool BundlerMatcher::keyAsciiExists(const std::string& imagefile)
 
 bool BundlerMatcher::keyBinaryExists(const std::string& imagefile)
 {
+	if (mFeatureDatabaseEnabled)
+		return mFeatureDatabase.contains(imagefile);
+
 	std::stringstream filepath;
 	filepath << mInputPath << imagefile.substr(0, imagefile.size()-4) << ".key.bin";
 
@@ -105,12 +139,6 @@ void BundlerMatcher::open(const std::string& inputPath, const std::string& input
 {
 	mInputPath = inputPath;
 
-	if (!mIsInitialized)
-	{
-		std::cout << "Error : can not initialize opengl context for SiftGPU" <<std::endl;
-		return;
-	}
-
 	if (!parseListFile(inputFilename))
 	{
 		std::cout << "Error : can not open file : " <<inputFilename.c_str() <<std::endl;
@@ -127,108 +155,740 @@ void BundlerMatcher::open(const std::string& inputPath, const std::string& input
 	}
 	
 	//Sift Feature Extraction
+	//(shards share the database: it is only read, its images are extracted by a run without shard)
+	if (mFeatureDatabaseEnabled)
+	{
+		std::stringstream filepath;
+		filepath << mInputPath << "features.db";
+		if (!mFeatureDatabase.open(filepath.str(), mShardCount > 1))
+			std::cout << "Warning : invalid feature database index, features will be extracted again : " << filepath.str() << std::endl;
+		std::cout << "[Feature database: " << mFeatureDatabase.getRecordCount() << " images]" << std::endl;
+	}
+	mFeatureStore.reset((int) mFilenames.size(), mFeatureCacheSize, this);
+	if (mFeatureStore.isBounded())
+		std::cout << "[Feature cache enabled: " << mFeatureCacheSize/1048576 << "MB]" << std::endl;
+
+	//Shard mode: the pairs of the shard are known before reading features, only its images are read
+	//(retrieval pairs need the features of all images: they are selected after reading them)
+	Pairs pairs;
+	std::vector<bool> shardImages(mFilenames.size(), true);
+	bool shardSelected = false;
+	if (mShardCount > 1 && !mRetrievalMatchingEnabled)
+	{
+		buildPairs(pairs);
+		if (!selectShardPairs(pairs, shardImages))
+			return;
+		shardSelected = true;
+	}
+	for (unsigned int i=0; i<mFilenames.size() && mFeatureDatabase.isReadOnly(); ++i)
+	{
+		if (shardImages[i] && !mFeatureDatabase.contains(mFilenames[i]))
+		{
+			std::cout << "Error : image not in the feature database, run once without shard to extract it : " << mFilenames[i] << std::endl;
+			return;
+		}
+	}
+
 	//Estimate total RAM usage
 	long featuresum = 0;
+	double bytesPerFeature = sizeof(SiftGPU::SiftKeypoint) + 128*(mCompactDescriptorsEnabled ? sizeof(unsigned char) : sizeof(float));
+
+	//Populate internal table with existing key file data, images without key file are extracted afterwards
+	mExtractionJobs.clear();
 	for (unsigned int i=0; i<mFilenames.size(); ++i)
 	{	
+		//images of other shards are never read
+		if (!shardImages[i])
+			continue;
+
+		//binary lookup first: no file access with the feature database
+		if(!(keyBinaryExists(mFilenames[i]) || keyAsciiExists(mFilenames[i])))
+		{
+			mExtractionJobs.push_back(i);
+			continue;
+		}
+
 		int percent = (int)(((i+1)*100.0f) / (1.0f*mFilenames.size()));
-		if(!(keyAsciiExists(mFilenames[i]) || keyBinaryExists(mFilenames[i])))
-		{				
-			int nbFeature = extractSiftFeature(i);
-			featuresum += nbFeature;
-			unsigned int totalRAM = (featuresum*(int)mFilenames.size())/((i+1)*2097152);
-			saveAsciiKeyFile(i);
-			if (mBinaryKeyFileWritingEnabled)
-				saveBinaryKeyFile(i);
-			clearScreen();
-			std::cout << "[Saving Sift Key files: ("<<totalRAM<< "GB) "<< percent << "%] - ("<<i+1<<"/"<<mFilenames.size()<<") #" << nbFeature <<" features";
+		FeatureInfo* info = new FeatureInfo(0, 0);
+
+		//binary key files load at memcpy speed, fall back on ascii when missing or invalid
+		int nbFeature = -1;
+		if (keyBinaryExists(mFilenames[i]))
+			nbFeature = readBinaryKeyFile(i, *info);
+
+		//image size is stored in binary key files (but not in legacy ones)
+		if (info->width <= 0 || info->height <= 0)
+			getImageDimension(i, info->width, info->height);
+
+		if (nbFeature < 0)
+		{
+			nbFeature = readAsciiKeyFile(i, *info);
+			if ((mFeatureStore.isBounded() || mFeatureDatabaseEnabled) && nbFeature >= 0)
+				saveBinaryKeyFile(i, *info);
 		}
-		else
+		else if (!keyAsciiExists(mFilenames[i]))
 		{
-			//Populate internal table with existing key file data
-			//TODO: What about binary key files ?
-			int nbFeature = readAsciiKeyFile(i);
-			featuresum += nbFeature;
-			unsigned int totalRAM = (featuresum*(int)mFilenames.size())/((i+1)*2097152);
-			clearScreen();
-			std::cout << "[Reading Sift Key files: ("<<totalRAM<< "GB) "<< percent << "%] - ("<<i+1<<"/"<<mFilenames.size()<<") #" << nbFeature <<" features";
+			//Bundler only reads ascii key files
+			saveAsciiKeyFile(i, *info);
 		}
+		featuresum += std::max(nbFeature, 0); //-1: key file unreadable
+		unsigned int totalRAM = (unsigned int) ((featuresum*bytesPerFeature*mFilenames.size())/((i+1)*1073741824.0));
+		clearScreen();
+		std::cout << "[Reading Sift Key files: ("<<totalRAM<< "GB) "<< percent << "%] - ("<<i+1<<"/"<<mFilenames.size()<<") #" << nbFeature <<" features";
+
+		//Save Feature in RAM (or in the cache when it is bounded)
+		mFeatureStore.insert(i, info);
 	}
+
+	if (!mExtractionJobs.empty())
+		extractSiftFeatures(featuresum, bytesPerFeature);
+	if (mFeatureDatabaseEnabled && !mFeatureDatabase.commit())
+		std::cout << "Error : can not write feature database index" << std::endl;
 	clearScreen();
 	std::cout << "[Sift Feature extracted]"<<std::endl;	
-	saveVector();
+	if (mShardCount <= 1)
+		saveVector();
 	clearScreen();		
 	std::cout << "[Sift Key files saved]"<<std::endl;	
 
-	delete mSift;
-	mSift = NULL;
-
-	mMatcher->VerifyContextGL();
+	delete mExtractor;
+	mExtractor = NULL;
 
 	//Sift Matching
-	int currentIteration = 0;
+	if (!shardSelected)
+	{
+		buildPairs(pairs);
+		if (mShardCount > 1 && !selectShardPairs(pairs, shardImages))
+			return;
+	}
+
+	//each shard writes its own match file (merged by BundlerMatchConverter)
+	std::string matchFilename = outMatchFilename;
+	if (mShardCount > 1)
+	{
+		std::stringstream shardFilename;
+		shardFilename << outMatchFilename << ".shard" << mShardIndex << "of" << mShardCount;
+		matchFilename = shardFilename.str();
+	}
+
+	//Only pairs missing from the previous run are matched
+	if (mIncrementalMatchingEnabled)
+		loadPreviousMatches(matchFilename, pairs);
+
+	//Binary match file written as pairs complete instead of keeping all matches in RAM
+	if (mMatchStreamingEnabled)
+	{
+		mMatchStreamFilename = matchFilename + ".bin";
+		if (!mMatchWriter.open(mMatchStreamFilename, (unsigned int) mFilenames.size()))
+		{
+			std::cout << "Error : can not open file : " << mMatchStreamFilename << std::endl;
+			mMatchStreamingEnabled = false;
+		}
+	}
+
+	if (mIncrementalMatchingEnabled)
+		addPreviousMatches();
+
+	//Pairs completed by an interrupted run are skipped, the others are logged as they complete
+	if (mCheckpointEnabled)
+		resumeCheckpoint(matchFilename, pairs);
+
+	matchPairs(pairs);
+
+	if (mCheckpointEnabled && !mCheckpoint.sync())
+		std::cout << "Error : can not write file : " << mCheckpointFilename << std::endl;
+	if (mMatchStreamingEnabled && !mMatchWriter.close())
+		std::cout << "Error : can not write file : " << mMatchStreamFilename << std::endl;
+
+	clearScreen();
+	std::cout << "[Sift Feature matched]"<<std::endl;
 
+	saveMatches(matchFilename);
+	if (mShardCount <= 1)
+		saveMatrix();
+
+	if (!mPreviousMatchFilename.empty())
+		remove(mPreviousMatchFilename.c_str());
+
+	//the checkpoint is only needed until the matches are saved
+	if (mCheckpointEnabled)
+	{
+		mCheckpoint.close();
+		remove(mCheckpointFilename.c_str());
+	}
+}
+
+void BundlerMatcher::buildPairs(Pairs& pairs)
+{
 	if (mSequenceMatchingEnabled) //sequence matching (video input)
 	{
 		std::cout << "[Sequence matching enabled: length " << mSequenceMatchingLength << "]" << std::endl;
-		int maxIterations = (int) (mFilenames.size()-mSequenceMatchingLength)*mSequenceMatchingLength + mSequenceMatchingLength*(mSequenceMatchingLength-1)/2; // (N-m).m + m(m-1)/2
-		for (unsigned int i=0; i<mFilenames.size()-1; ++i)
+		for (unsigned int i=0; i<mFilenames.size(); ++i)
+			for (int j=1; j<=mSequenceMatchingLength && i+j<mFilenames.size(); ++j)
+				pairs.push_back(Match(i, i+j));
+	}
+	else if(mPairedMatchingEnabled)//pair-wise matching based on GPS location of photos and camera orientation
+	{
+		std::cout << "[Pair-wise matching enabled: using " << mPairs.size() << " pairs]" << std::endl;
+		pairs = mPairs;
+	}
+	else if (mRetrievalMatchingEnabled) //unordered collection: each image matched against its most similar images only
+	{
+		selectRetrievalPairs(pairs);
+	}
+	else //classic quadratic matching: n(n-1)/2 pairs
+	{
+		for (unsigned int i=0; i<mFilenames.size(); ++i)
+			for (unsigned int j=i+1; j<mFilenames.size(); ++j)
+				pairs.push_back(Match(i, j));
+	}
+}
+
+bool BundlerMatcher::selectShardPairs(Pairs& pairs, std::vector<bool>& shardImages)
+{
+	//every shard computes the same partition: pair weights only depend on the key file headers
+	int nbImage = (int) mFilenames.size();
+	std::vector<double> nbFeature(nbImage);
+	for (int i=0; i<nbImage; ++i)
+	{
+		int count = readFeatureCount(i);
+		if (count < 0)
 		{
-			for (int j=1; j<=mSequenceMatchingLength; ++j)
-			{
-				int indexA = i;
-				int indexB = i+j;
+			std::cout << "Error : shard mode needs the key files of all images (missing : " << mFilenames[i] << ")" << std::endl;
+			return false;
+		}
+		nbFeature[i] = std::max(count, 1);
+	}
 
-				if (indexB >= mFilenames.size())
-					continue;
-				else
-				{
-					clearScreen();
-					int percent = (int) (currentIteration*100.0f / maxIterations*1.0f);
-					std::cout << "[Matching Sift Feature : " << percent << "%] - (" << indexA << "/" << indexB << ")";
-					matchSiftFeature(indexA, indexB);
-					currentIteration++;
-				}
-			}
+	//blocked order: consecutive pairs share their images, a shard covers a few blocks of the pair matrix
+	int blockSize = (int) ceil(nbImage / sqrt(2.0*mShardCount));
+	sortPairsByBlock(pairs, blockSize);
+
+	//contiguous ranges of equal matching cost (key-points of A x key-points of B)
+	double totalWeight = 0.0;
+	for (unsigned int i=0; i<pairs.size(); ++i)
+		totalWeight += nbFeature[pairs[i].first] * nbFeature[pairs[i].second];
+
+	Pairs shardPairs;
+	double shardWeight = 0.0;
+	double position = 0.0;
+	shardImages.assign(nbImage, false);
+	for (unsigned int i=0; i<pairs.size(); ++i)
+	{
+		double weight = nbFeature[pairs[i].first] * nbFeature[pairs[i].second];
+		int shard = std::min((int) ((position + weight/2.0) * mShardCount / totalWeight), mShardCount-1);
+		position += weight;
+		if (shard != mShardIndex-1)
+			continue;
+
+		shardPairs.push_back(pairs[i]);
+		shardWeight += weight;
+		shardImages[pairs[i].first]  = true;
+		shardImages[pairs[i].second] = true;
+	}
+
+	int nbShardImage = (int) std::count(shardImages.begin(), shardImages.end(), true);
+	std::cout << "[Shard " << mShardIndex << "/" << mShardCount << ": " << shardPairs.size() << "/" << pairs.size() << " pairs, "
+		<< std::fixed << std::setprecision(1) << (totalWeight > 0.0 ? shardWeight*100.0/totalWeight : 0.0) << "% of the matching cost, "
+		<< nbShardImage << "/" << nbImage << " images]" << std::endl;
+	pairs.swap(shardPairs);
+
+	return true;
+}
+
+//descriptors of an image as 128 unsigned char per key-point (quantized in buffer unless compact)
+static const unsigned char* getCompactDescriptors(const FeatureInfo& info, std::vector<unsigned char>& buffer)
+{
+	if (!info.compactDescriptors.empty())
+		return &info.compactDescriptors[0];
+
+	buffer.resize(info.descriptors.size());
+	for (unsigned int i=0; i<info.descriptors.size(); ++i)
+		buffer[i] = quantizeDescriptor(info.descriptors[i]);
+
+	return buffer.empty() ? NULL : &buffer[0];
+}
+
+void BundlerMatcher::selectRetrievalPairs(Pairs& pairs)
+{
+	int nbImage = (int) mFilenames.size();
+
+	//Vocabulary tree trained on descriptors sampled uniformly over all images
+	double nbFeature = 0.0;
+	for (int i=0; i<nbImage; ++i)
+		nbFeature += mFeatureStore.getFeatureCount(i);
+	double step = std::max(nbFeature / RETRIEVAL_SAMPLE_SIZE, 1.0);
+
+	std::vector<unsigned char> samples;
+	std::vector<unsigned char> buffer;
+	double next = 0.0;
+	double position = 0.0;
+	for (int i=0; i<nbImage; ++i)
+	{
+		const FeatureInfo& info = *mFeatureStore.acquire(i);
+		int nbPoint = (int) info.points.size();
+		const unsigned char* descriptors = getCompactDescriptors(info, buffer);
+		for (; next < position+nbPoint; next += step)
+		{
+			const unsigned char* descriptor = descriptors + (size_t) (next-position)*128;
+			samples.insert(samples.end(), descriptor, descriptor+128);
 		}
+		position += nbPoint;
+		mFeatureStore.release(i);
+
+		clearScreen();
+		std::cout << "[Sampling descriptors: " << (int)(((i+1)*100.0f) / nbImage) << "%] - (" << i+1 << "/" << nbImage << ")";
 	}
-	else if(mPairedMatchingEnabled)//pair-wise matching based on GPS location of photos and camera orientation
+
+	clearScreen();
+	std::cout << "[Training vocabulary tree: " << samples.size()/128 << " descriptors]";
+	VocabularyTree tree(mNbThread);
+	tree.train(samples.empty() ? NULL : &samples[0], (int) (samples.size()/128), RETRIEVAL_BRANCHING, RETRIEVAL_DEPTH);
+	std::vector<unsigned char>().swap(samples);
+
+	//Inverted file of the visual words of each image
+	RetrievalIndex index;
+	index.reset(tree.getWordCount(), nbImage);
+	std::vector<int> words;
+	for (int i=0; i<nbImage; ++i)
 	{
-		std::cout << "[Pair-wise matching enabled: using " << mPairs.size() << " pairs]" << std::endl;
-		for(unsigned int i=0;i <mPairs.size(); ++i)
+		const FeatureInfo& info = *mFeatureStore.acquire(i);
+		int nbPoint = (int) info.points.size();
+		const unsigned char* descriptors = getCompactDescriptors(info, buffer);
+		tree.quantize(descriptors, nbPoint, words);
+		mFeatureStore.release(i);
+		index.addImage(i, words);
+
+		clearScreen();
+		std::cout << "[Indexing images: " << (int)(((i+1)*100.0f) / nbImage) << "%] - (" << i+1 << "/" << nbImage << ")";
+	}
+	index.finalize();
+
+	//Top-K retrieved images of each image, the union is symmetric: (i, j) with i < j
+	std::set<Match> selected;
+	std::vector<int> results;
+	for (int i=0; i<nbImage; ++i)
+	{
+		index.query(i, mRetrievalNeighbours, results);
+		for (unsigned int j=0; j<results.size(); ++j)
+			selected.insert(Match(std::min(i, results[j]), std::max(i, results[j])));
+	}
+	pairs.assign(selected.begin(), selected.end());
+
+	clearScreen();
+	std::cout << "[Vocabulary tree retrieval: " << tree.getWordCount() << " words, top " << mRetrievalNeighbours << " images, " << pairs.size() << " pairs]" << std::endl;
+}
+
+void BundlerMatcher::loadPreviousMatches(const std::string& outMatchFilename, Pairs& pairs)
+{
+	//previous matches are moved to a binary file as the outputs are overwritten at the end
+	//<out>.bin is only moved once it is known to be valid, the text matches are converted otherwise
+	std::string binFilename = outMatchFilename + ".bin";
+	mPreviousMatchFilename  = outMatchFilename + ".previous.bin";
+
+	bool moved = mPreviousMatches.open(binFilename);
+	mPreviousMatches.close();
+	if (moved)
+	{
+		remove(mPreviousMatchFilename.c_str());
+		moved = rename(binFilename.c_str(), mPreviousMatchFilename.c_str()) == 0;
+	}
+
+	if (!moved)
+	{
+		std::string convertedFilename = mPreviousMatchFilename + ".tmp";
+		SiftFile::MatchWriter writer;
+		bool converted = writer.open(convertedFilename, (unsigned int) mFilenames.size()) &&
+			SiftFile::readMatchText(outMatchFilename, writer);
+		converted = writer.close() && converted;
+
+		if (converted)
 		{
-			unsigned int indexA = mPairs[i].first;
-			unsigned int indexB = mPairs[i].second;
-			clearScreen();
-			int percent = (int) (i*100.0f / mPairs.size()*1.0f);
-			std::cout << "[Matching Sift Feature : " << percent << "%] - (" << indexA << "/" << indexB << ")";
-			matchSiftFeature(indexA, indexB);
+			remove(mPreviousMatchFilename.c_str());
+			converted = rename(convertedFilename.c_str(), mPreviousMatchFilename.c_str()) == 0;
+		}
+		if (!converted)
+		{
+			std::cout << "[Incremental matching: no previous matches found]" << std::endl;
+			remove(convertedFilename.c_str());
+			mPreviousMatchFilename.clear();
+			return;
 		}
 	}
-	else //classic quadratic matching
+
+	if (!mPreviousMatches.open(mPreviousMatchFilename))
 	{
-		int maxIterations = (int) mFilenames.size()*((int) mFilenames.size()-1)/2; // Sum(1 -> n) = n(n-1)/2
-		for (unsigned int i=0; i<mFilenames.size(); ++i)
+		std::cout << "Error : can not read previous matches : " << mPreviousMatchFilename << std::endl;
+		mPreviousMatchFilename.clear();
+		return;
+	}
+
+	//new images are appended to list.txt: previous indices must still be valid
+	if (mPreviousMatches.getImageCount() > mFilenames.size())
+		std::cout << "Warning : previous matches use " << mPreviousMatches.getImageCount() << " images, list has " << mFilenames.size() << std::endl;
+
+	std::set<Match> previousPairs;
+	for (unsigned int i=0; i<mPreviousMatches.getPairCount(); ++i)
+	{
+		const SiftFile::MatchFileEntry& entry = mPreviousMatches.getPair(i);
+		previousPairs.insert(Match(entry.indexA, entry.indexB));
+		previousPairs.insert(Match(entry.indexB, entry.indexA));
+	}
+
+	Pairs remainingPairs;
+	for (unsigned int i=0; i<pairs.size(); ++i)
+	{
+		if (previousPairs.find(pairs[i]) == previousPairs.end())
+			remainingPairs.push_back(pairs[i]);
+	}
+
+	std::cout << "[Incremental matching: " << mPreviousMatches.getPairCount() << " previous pairs, " << remainingPairs.size() << " new pairs]" << std::endl;
+	pairs.swap(remainingPairs);
+}
+
+void BundlerMatcher::addPreviousMatches()
+{
+	if (mPreviousMatchFilename.empty())
+		return;
+
+	for (unsigned int i=0; i<mPreviousMatches.getPairCount(); ++i)
+		addStoredMatches(mPreviousMatches, i);
+
+	mPreviousMatches.close();
+}
+
+void BundlerMatcher::addStoredMatches(const SiftFile::MatchReader& reader, unsigned int index)
+{
+	const SiftFile::MatchFileEntry& entry = reader.getPair(index);
+	if (mMatchStreamingEnabled)
+	{
+		//encoded records are copied as is
+		const unsigned char* record = reader.getRecord(index);
+		mMatchWriter.append(entry.indexA, entry.indexB, entry.nbMatch, std::vector<unsigned char>(record, record + entry.size));
+	}
+	else
+	{
+		std::vector<Match> matches;
+		reader.getMatches(index, matches);
+		mMatchInfos.push_back(MatchInfo(entry.indexA, entry.indexB, matches));
+	}
+}
+
+static bool comparePairIndex(const std::pair<Match, int>& a, const std::pair<Match, int>& b)
+{
+	return a.first < b.first;
+}
+
+void BundlerMatcher::resumeCheckpoint(const std::string& outMatchFilename, Pairs& pairs)
+{
+	//the log of the interrupted run is moved aside and its complete entries copied to the new log:
+	//a torn tail is dropped and a crash during the copy leaves the moved log untouched for the next run
+	mCheckpointFilename = outMatchFilename + ".checkpoint";
+	std::string interruptedFilename = outMatchFilename + ".checkpoint.previous";
+
+	SiftFile::MatchReader interrupted;
+	if (!interrupted.openLog(interruptedFilename))
+	{
+		remove(interruptedFilename.c_str());
+		if (rename(mCheckpointFilename.c_str(), interruptedFilename.c_str()) == 0)
+			interrupted.openLog(interruptedFilename);
+	}
+	if (interrupted.getPairCount() > 0 && interrupted.getImageCount() != mFilenames.size())
+	{
+		std::cout << "Warning : checkpoint uses " << interrupted.getImageCount() << " images, list has " << mFilenames.size() << ": ignored" << std::endl;
+		interrupted.close();
+	}
+
+	if (!mCheckpoint.open(mCheckpointFilename, (unsigned int) mFilenames.size()))
+	{
+		std::cout << "Error : can not open file : " << mCheckpointFilename << std::endl;
+		mCheckpointEnabled = false;
+		return;
+	}
+
+	//completed-pair bitmap: logged pairs are looked up in the sorted pairs to match
+	std::vector<std::pair<Match, int> > sortedPairs(pairs.size());
+	for (unsigned int i=0; i<pairs.size(); ++i)
+		sortedPairs[i] = std::make_pair(pairs[i], (int) i);
+	std::sort(sortedPairs.begin(), sortedPairs.end(), comparePairIndex);
+
+	std::vector<bool> completed(pairs.size(), false);
+	int nbCompleted = 0;
+	for (unsigned int i=0; i<interrupted.getPairCount(); ++i)
+	{
+		const SiftFile::MatchFileEntry& entry = interrupted.getPair(i);
+		std::pair<Match, int> key(Match(entry.indexA, entry.indexB), 0);
+		std::vector<std::pair<Match, int> >::const_iterator it = std::lower_bound(sortedPairs.begin(), sortedPairs.end(), key, comparePairIndex);
+		if (it == sortedPairs.end() || it->first != key.first || completed[it->second])
+			continue;
+
+		completed[it->second] = true;
+		nbCompleted++;
+		addStoredMatches(interrupted, i);
+
+		const unsigned char* record = interrupted.getRecord(i);
+		mCheckpoint.append(entry.indexA, entry.indexB, entry.nbMatch, std::vector<unsigned char>(record, record + entry.size));
+	}
+
+	if (!mCheckpoint.sync())
+		std::cout << "Error : can not write file : " << mCheckpointFilename << std::endl;
+	interrupted.close();
+	remove(interruptedFilename.c_str());
+	mLastCheckpoint = time(NULL);
+
+	if (nbCompleted == 0)
+	{
+		std::cout << "[Checkpoint enabled: " << mCheckpointFilename << " synced every " << mCheckpointPeriod << "s]" << std::endl;
+		return;
+	}
+
+	Pairs remainingPairs;
+	for (unsigned int i=0; i<pairs.size(); ++i)
+	{
+		if (!completed[i])
+			remainingPairs.push_back(pairs[i]);
+	}
+
+	std::cout << "[Checkpoint: resuming after " << nbCompleted << " matched pairs, " << remainingPairs.size() << " pairs left]" << std::endl;
+	pairs.swap(remainingPairs);
+}
+
+void BundlerMatcher::createMatchers(int nbPair)
+{
+	//Sift Matching backend: SiftMatchGPU unless disabled or no opengl context available
+	if (!mCpuMatchingEnabled)
+	{
+		SiftMatcherGPU* matcher = new SiftMatcherGPU(mDistanceThreshold, mRatioThreshold, mNbThread);
+		if (matcher->isInitialized())
 		{
-			for (unsigned int j=i+1; j<mFilenames.size(); ++j)
-			{
-				clearScreen();
-				int percent = (int) (currentIteration*100.0f / maxIterations*1.0f);
-				std::cout << "[Matching Sift Feature : " << percent << "%] - (" << i << "/" << j << ")";
-				matchSiftFeature(i, j);
-				currentIteration++;
-			}
+			//the opengl context is bound to this thread: only one worker (all threads match the pairs larger than MATCH_BUFFER)
+			mMatchers.push_back(matcher);
+			return;
 		}
+
+		std::cout << "[Can not initialize opengl context for SiftMatchGPU: using CPU matching]" << std::endl;
+		delete matcher;
+	}
+
+	//one matcher per worker, remaining threads are used inside each pair when there are few pairs
+	int nbWorker = std::max(std::min(mNbThread, nbPair), 1);
+	int nbThreadPerWorker = std::max(mNbThread / nbWorker, 1);
+
+	std::cout << "[CPU matching enabled: " << mNbThread << " threads, " << getKernelName(getNearestNeighbourKernel()) << "]" << std::endl;
+	if (mApproximateMatchingEnabled)
+	{
+		std::cout << "[Approximate matching enabled: " << ANN_TREE << " k-d trees, " << mApproximateChecks << " checks]" << std::endl;
+		for (int i=0; i<nbWorker; ++i)
+			mMatchers.push_back(new SiftMatcherANN(mDistanceThreshold, mRatioThreshold, mApproximateChecks, nbThreadPerWorker));
+		return;
+	}
+	for (int i=0; i<nbWorker; ++i)
+		mMatchers.push_back(new SiftMatcherCPU(mDistanceThreshold, mRatioThreshold, nbThreadPerWorker));
+}
+
+void BundlerMatcher::destroyMatchers()
+{
+	for (unsigned int i=0; i<mMatchers.size(); ++i)
+		delete mMatchers[i];
+	mMatchers.clear();
+
+	for (unsigned int i=0; i<mVerifiers.size(); ++i)
+		delete mVerifiers[i];
+	mVerifiers.clear();
+}
+
+static bool compareMatchInfo(const MatchInfo* a, const MatchInfo* b)
+{
+	if (a->indexA != b->indexA)
+		return a->indexA < b->indexA;
+	return a->indexB < b->indexB;
+}
+
+//Verify the pairs matched by the matching workers (the GPU matcher has a single worker)
+class VerificationWorkerThread : public Thread
+{
+	public:
+		VerificationWorkerThread(BundlerMatcher* matcher, int verifierIndex) : mMatcher(matcher), mVerifierIndex(verifierIndex) {}
+
+	protected:
+		virtual void run()
+		{
+			mMatcher->verifyPairs(mVerifierIndex);
+		}
+
+		BundlerMatcher* mMatcher;
+		int             mVerifierIndex;
+};
+
+void BundlerMatcher::matchPairs(const Pairs& pairs)
+{
+	createMatchers((int) pairs.size());
+	if (mVerificationEnabled)
+	{
+		std::cout << "[Geometric verification enabled: " << mVerifyThreshold << " pixels, " << VERIFY_MIN_INLIER << " inliers min, " << mNbThread << " threads]" << std::endl;
+		for (int i=0; i<mNbThread; ++i)
+			mVerifiers.push_back(new GeometricVerifier(mVerifyThreshold, VERIFY_MIN_INLIER));
+	}
+
+	mNbPairToMatch = (int) pairs.size();
+	mNbPairMatched = 0;
+	mNbRecallTicket  = 0;
+	mNbRecallPair    = 0;
+	mNbExactMatch    = 0;
+	mNbRecalledMatch = 0;
+	mNbPutativeMatch = 0;
+	mNbVerifiedMatch = 0;
+	mNbVerifiedPair  = 0;
+	mWorkerMatchInfos.clear();
+	mWorkerMatchInfos.resize(mMatchers.size() + mVerifiers.size());
+
+	//Blocked traversal of the pair matrix when the cache is bounded: each worker
+	//processes its pairs block after block so that 2 blocks of images stay in cache
+	Pairs orderedPairs = pairs;
+	if (mFeatureStore.isBounded())
+	{
+		size_t imageSize = std::max(mFeatureStore.getAverageImageSize(), (size_t) 1);
+		int blockSize = (int) std::max(mFeatureStore.getCacheSize() / (2*mMatchers.size()*imageSize), (size_t) 1);
+		sortPairsByBlock(orderedPairs, blockSize);
+		std::cout << "[Blocked matching: " << blockSize << " images per block]" << std::endl;
+	}
+
+	//verification overlaps the matching: pairs are queued with their features still acquired
+	std::vector<Thread*> verifiers;
+	mVerificationJobs.reset(2*(unsigned int) mVerifiers.size());
+	for (unsigned int i=0; i<mVerifiers.size(); ++i)
+	{
+		Thread* verifier = new VerificationWorkerThread(this, i);
+		if (verifier->start())
+			verifiers.push_back(verifier);
+		else
+			delete verifier;
 	}
+	mVerifiersStarted = !verifiers.empty();
 
+	PairScheduler scheduler((int) mMatchers.size());
+	scheduler.run(orderedPairs, *this);
+
+	mVerificationJobs.close();
+	for (unsigned int i=0; i<verifiers.size(); ++i)
+	{
+		verifiers[i]->join();
+		delete verifiers[i];
+	}
+
+	destroyMatchers();
+
+	if (mApproximateMatchingEnabled && mNbRecallPair > 0)
+	{
+		clearScreen();
+		std::cout << "[Approximate matching recall: " << std::fixed << std::setprecision(1) << (mNbExactMatch > 0 ? mNbRecalledMatch*100.0/mNbExactMatch : 100.0)
+			<< "% (" << mNbRecalledMatch << "/" << mNbExactMatch << " exact matches found on " << mNbRecallPair << " pairs)]" << std::endl;
+	}
+
+	if (mVerificationEnabled)
+	{
+		clearScreen();
+		std::cout << "[Geometric verification: " << mNbVerifiedPair << "/" << mNbPairToMatch << " pairs and "
+			<< mNbVerifiedMatch << "/" << mNbPutativeMatch << " matches kept]" << std::endl;
+	}
+
+	//deterministic merge of previous and per-worker results ordered by (indexA, indexB)
+	std::vector<MatchInfo*> sorted;
+	for (unsigned int i=0; i<mMatchInfos.size(); ++i)
+		sorted.push_back(&mMatchInfos[i]);
+	for (unsigned int i=0; i<mWorkerMatchInfos.size(); ++i)
+		for (unsigned int j=0; j<mWorkerMatchInfos[i].size(); ++j)
+			sorted.push_back(&mWorkerMatchInfos[i][j]);
+	std::stable_sort(sorted.begin(), sorted.end(), compareMatchInfo);
+
+	std::vector<Match> empty;
+	std::vector<MatchInfo> merged;
+	merged.reserve(sorted.size());
+	for (unsigned int i=0; i<sorted.size(); ++i)
+	{
+		merged.push_back(MatchInfo(sorted[i]->indexA, sorted[i]->indexB, empty));
+		merged.back().matches.swap(sorted[i]->matches);
+	}
+	mMatchInfos.swap(merged);
+	mWorkerMatchInfos.clear();
+}
+
+void BundlerMatcher::processPair(int workerIndex, const Match& pair)
+{
+	//verified pairs are written by verifyPair
+	matchSiftFeature(pair.first, pair.second, *mMatchers[workerIndex], mWorkerMatchInfos[workerIndex]);
+	if (!mVerificationEnabled && (mMatchStreamingEnabled || mCheckpointEnabled))
+		writeMatches(mWorkerMatchInfos[workerIndex]);
+
+	ScopedLock lock(mProgressMutex);
+	mNbPairMatched++;
 	clearScreen();
-	std::cout << "[Sift Feature matched]"<<std::endl;
+	int percent = (int) (mNbPairMatched*100.0f / mNbPairToMatch*1.0f);
+	std::cout << "[Matching Sift Feature : " << percent << "%] - (" << pair.first << "/" << pair.second << ")";
+}
+
+void BundlerMatcher::verifyPairs(int verifierIndex)
+{
+	VerificationJob* job;
+	while (mVerificationJobs.pop(job))
+		verifyPair(verifierIndex, job);
+}
+
+void BundlerMatcher::verifyPair(int verifierIndex, VerificationJob* job)
+{
+	int nbPutativeMatch = (int) job->matches.size();
+	int nbVerifiedMatch = mVerifiers[verifierIndex]->verify(*job->featureA, *job->featureB, job->matches, job->ratios);
+	mFeatureStore.release(job->indexA);
+	mFeatureStore.release(job->indexB);
+
+	{
+		ScopedLock lock(mProgressMutex);
+		mNbPutativeMatch += nbPutativeMatch;
+		mNbVerifiedMatch += nbVerifiedMatch;
+		if (nbVerifiedMatch > 0)
+			mNbVerifiedPair++;
+	}
 
-	delete mMatcher;
-	mMatcher = NULL;
+	std::deque<MatchInfo>& matchInfos = mWorkerMatchInfos[mMatchers.size() + verifierIndex];
+	std::vector<Match> empty;
+	matchInfos.push_back(MatchInfo(job->indexA, job->indexB, empty));
+	matchInfos.back().matches.swap(job->matches);
+	delete job;
 
-	saveMatches(outMatchFilename);
-	saveMatrix();
+	if (mMatchStreamingEnabled || mCheckpointEnabled)
+		writeMatches(matchInfos);
+}
+
+void BundlerMatcher::writeMatches(std::deque<MatchInfo>& matchInfos)
+{
+	//encoding is done by the worker, only the writes are serialized
+	const MatchInfo& info = matchInfos.back();
+	std::vector<unsigned char> record;
+	SiftFile::encodeMatches(info.matches, record);
+
+	if (mCheckpointEnabled)
+	{
+		ScopedLock lock(mCheckpointMutex);
+		mCheckpoint.append(info.indexA, info.indexB, (unsigned int) info.matches.size(), record);
+
+		//pairs logged since the last sync are matched again if the run is interrupted
+		time_t now = time(NULL);
+		if (now - mLastCheckpoint >= mCheckpointPeriod)
+		{
+			if (!mCheckpoint.sync())
+				std::cout << "Error : can not write file : " << mCheckpointFilename << std::endl;
+			mLastCheckpoint = now;
+		}
+	}
+
+	if (mMatchStreamingEnabled)
+	{
+		{
+			ScopedLock lock(mMatchWriterMutex);
+			mMatchWriter.append(info.indexA, info.indexB, (unsigned int) info.matches.size(), record);
+		}
+		matchInfos.pop_back();
+	}
 }
 
 bool BundlerMatcher::parseListFile(const std::string& filename)
@@ -268,278 +928,519 @@ bool BundlerMatcher::parsePairsFile(const std::string& filename)
 	return true;
 }
 
-int BundlerMatcher::extractSiftFeature(int fileIndex)
+//Decode images ahead of the extraction (several decoders can run in parallel)
+class ImageDecoderThread : public Thread
 {
-	std::stringstream filepath;
-	filepath << mInputPath << mFilenames[fileIndex];
+	public:
+		ImageDecoderThread(BundlerMatcher* matcher) : mMatcher(matcher) {}
 
-	std::string tmp = filepath.str();
-	char* filename = &tmp[0];
-	bool extracted = true;
+	protected:
+		virtual void run()
+		{
+			mMatcher->decodeImages();
+		}
 
-	unsigned int imgId = 0;
-	ilGenImages(1, &imgId);
-	ilBindImage(imgId); 
-	int nbFeatureFound = -1;
+		BundlerMatcher* mMatcher;
+};
 
-	if(ilLoadImage(filename))
-	{
-		int w = ilGetInteger(IL_IMAGE_WIDTH);
-		int h = ilGetInteger(IL_IMAGE_HEIGHT);
-		int format = ilGetInteger(IL_IMAGE_FORMAT);
+//Write key files while the next images are extracted
+class KeyWriterThread : public Thread
+{
+	public:
+		KeyWriterThread(BundlerMatcher* matcher) : mMatcher(matcher) {}
+
+	protected:
+		virtual void run()
+		{
+			mMatcher->writeKeyFiles();
+		}
 
-		int wtile = w/mTileNum;
-		int htile = h/mTileNum;
+		BundlerMatcher* mMatcher;
+};
 
-		SiftKeyDescriptors all_descriptors;
-		SiftKeyPoints all_keys;
+//Extract the decoded images with its own extractor (several workers with CPU extraction)
+class ExtractionWorkerThread : public Thread
+{
+	public:
+		ExtractionWorkerThread(BundlerMatcher* matcher, SiftExtractor* extractor) : mMatcher(matcher), mExtractor(extractor) {}
 
-		for(int woff = 0; woff < w; woff+=wtile)
+	protected:
+		virtual void run()
 		{
-			for(int hoff = 0; hoff < h; hoff+=htile)
-			{
+			mMatcher->extractImages(mExtractor);
+		}
 
-				//If the image is too large use ilCopyPixels to internal buffers
-				//to copy subset of images to CPU RAM and call RunSIFT in a loop
-				//which does not choke the Graphics RAM
-				int wactual = std::min((int)(w-woff),(int)(wtile*mTilePercent));
-				int hactual = std::min((int)(h-hoff),(int)(htile*mTilePercent));
+		BundlerMatcher* mMatcher;
+		SiftExtractor*  mExtractor;
+};
 
-				ILubyte* data = (ILubyte*)malloc(wactual*hactual*sizeof(ILubyte));
-				ilCopyPixels(woff,hoff,0,wactual,hactual,1,IL_LUMINANCE,IL_UNSIGNED_BYTE,data);
+bool BundlerMatcher::decodeNextImage(DecodedImage& image)
+{
+	int job;
+	{
+		ScopedLock lock(mExtractionMutex);
+		if (mNextExtractionJob >= (int) mExtractionJobs.size())
+			return false;
+		job = mNextExtractionJob++;
+	}
 
-				if (mSift->RunSIFT(wactual, hactual, data, IL_LUMINANCE, GL_UNSIGNED_BYTE))
-				{
-					int num = mSift->GetFeatureNum();
+	std::stringstream filepath;
+	filepath << mInputPath << mFilenames[mExtractionJobs[job]];
 
-					if(num>0)
-					{
-						SiftKeyDescriptors descriptors(128*num);
-						SiftKeyPoints keys(num);
+	image.fileIndex = mExtractionJobs[job];
 
-						mSift->GetFeatureVector(&keys[0], &descriptors[0]);
+	//the budget bounds the images decoded ahead and being extracted (decoding holds the RGB image and its luminance)
+	int width  = 0;
+	int height = 0;
+	if (readImageDimension(filepath.str(), width, height))
+		image.memory = 4*(size_t) width*height + mExtractors[0]->getMemoryUsage(width, height);
+	mExtractionBudget.acquire(image.memory);
 
-						if(nbFeatureFound == -1) nbFeatureFound = num;
-						else nbFeatureFound += num;
+	decodeImageTiles(filepath.str(), mTileNum, mTilePercent, image);
 
-						for(int i=0;i<keys.size();i++)
-						{
-							keys[i].x+=woff;
-							keys[i].y+=hoff;
-						}
+	return true;
+}
 
-						all_descriptors.insert(all_descriptors.end(),descriptors.begin(),descriptors.end());
-						all_keys.insert(all_keys.end(),keys.begin(),keys.end());
-					}
-				}
-				else
-				{
-					extracted = false;
-				}
+void BundlerMatcher::decodeImages()
+{
+	DecodedImage* image = new DecodedImage;
+	while (decodeNextImage(*image))
+	{
+		mDecodedImages.push(image);
+		image = new DecodedImage;
+	}
+	delete image;
+}
 
-				free(data);
-			}
-		}
+void BundlerMatcher::writeKeyFiles()
+{
+	ExtractedFeature feature;
+	while (mExtractedFeatures.pop(feature))
+		writeKeyFile(feature);
+}
 
-		//Save Feature in RAM
-		//This can get filled up if the number of images is large
-		mFeatureInfos.push_back(FeatureInfo(w, h, all_keys, all_descriptors));
+void BundlerMatcher::writeKeyFile(const ExtractedFeature& feature)
+{
+	saveAsciiKeyFile(feature.first, *feature.second);
+	//binary key files are needed to page features in when the cache is bounded
+	if (mBinaryKeyFileWritingEnabled || mFeatureStore.isBounded() || mFeatureDatabaseEnabled)
+		saveBinaryKeyFile(feature.first, *feature.second);
+
+	//Save Feature in RAM (or in the cache when it is bounded)
+	mFeatureStore.insert(feature.first, feature.second);
+}
+
+void BundlerMatcher::extractSiftFeatures(long& featuresum, double bytesPerFeature)
+{
+	//Pipeline: decoders -> extraction workers -> key file writer
+	//SiftGPU has a single worker (this thread owns the opengl context), CPU extraction runs images in parallel
+	//with as many workers as the memory budget allows, the cores left are used inside each image
+	int nbJob = (int) mExtractionJobs.size();
+	int nbWorker = 1;
+	int nbWorkerThread = mNbThread;
+	if (mCpuExtractionEnabled)
+	{
+		SiftExtractorCPU estimator(mFirstOctave);
+		int width  = 0;
+		int height = 0;
+		size_t imageMemory = 0;
+		if (getImageDimension(mExtractionJobs[0], width, height))
+			imageMemory = 4*(size_t) width*height + estimator.getMemoryUsage(width, height);
+
+		nbWorker = std::min(mNbThread, nbJob);
+		if (imageMemory > 0)
+			nbWorker = std::min(nbWorker, std::max((int) (mExtractionMemory/imageMemory), 1));
+		nbWorkerThread = (mNbThread + nbWorker - 1) / nbWorker;
+
+		for (int i=0; i<nbWorker; ++i)
+			mExtractors.push_back(new SiftExtractorCPU(mFirstOctave, nbWorkerThread));
 	}
 	else
+		mExtractors.push_back(mExtractor);
+
+	int nbDecoder = (mCpuExtractionEnabled ? std::max(1, mNbThread/4) : std::max(1, mNbThread-2));
+	mNextExtractionJob   = 0;
+	mNextExtractedImage  = 0;
+	mNbExtractedImage    = 0;
+	mExtractedFeatureSum = 0;
+	mBytesPerFeature     = bytesPerFeature;
+	mExtractionBudget.reset(mExtractionMemory);
+	mDecodedImages.reset(2*nbDecoder);
+	mExtractedFeatures.reset(2*nbDecoder);
+
+	std::vector<Thread*> decoders;
+	for (int i=0; i<nbDecoder; ++i)
 	{
-		extracted = false;
+		Thread* decoder = new ImageDecoderThread(this);
+		if (decoder->start())
+			decoders.push_back(decoder);
+		else
+			delete decoder;
 	}
+	mDecodersStarted = !decoders.empty();
+	KeyWriterThread writer(this);
+	mKeyWriterStarted = writer.start();
+
+	//this thread is the first worker
+	std::vector<Thread*> workers;
+	for (int i=1; i<nbWorker; ++i)
+	{
+		Thread* worker = new ExtractionWorkerThread(this, mExtractors[i]);
+		if (worker->start())
+			workers.push_back(worker);
+		else
+			delete worker;
+	}
+	if (mCpuExtractionEnabled)
+	{
+		clearScreen();
+		std::cout << "[CPU extraction: "<<workers.size()+1<<" images in parallel, "<<nbWorkerThread<<" threads per image, "<<getScaleSpaceKernelName(getScaleSpaceKernel())<<"]";
+	}
+	extractImages(mExtractors[0]);
+
+	for (unsigned int i=0; i<workers.size(); ++i)
+	{
+		workers[i]->join();
+		delete workers[i];
+	}
+	for (unsigned int i=0; i<decoders.size(); ++i)
+	{
+		decoders[i]->join();
+		delete decoders[i];
+	}
+	mExtractedFeatures.close();
+	if (mKeyWriterStarted)
+		writer.join();
+
+	for (unsigned int i=0; i<mExtractors.size(); ++i)
+		if (mExtractors[i] != mExtractor)
+			delete mExtractors[i];
+	mExtractors.clear();
+	featuresum += mExtractedFeatureSum;
+}
+
+void BundlerMatcher::extractImages(SiftExtractor* extractor)
+{
+	while (true)
+	{
+		//one decoded image is pushed per extraction job
+		{
+			ScopedLock lock(mExtractionMutex);
+			if (mNextExtractedImage >= (int) mExtractionJobs.size())
+				return;
+			mNextExtractedImage++;
+		}
+
+		//Fall back to decoding in this thread when no decoder could be started
+		DecodedImage* image = NULL;
+		if (mDecodersStarted)
+			mDecodedImages.pop(image);
+		else
+		{
+			image = new DecodedImage;
+			decodeNextImage(*image);
+		}
+
+		FeatureInfo* info = new FeatureInfo(0, 0);
+		int nbFeature = extractSiftFeature(*extractor, *image, *info);
+		int fileIndex = image->fileIndex;
+		mExtractionBudget.release(image->memory);
+		delete image;
+
+		//features are stored by file index: the completion order does not matter
+		ExtractedFeature feature(fileIndex, info);
+		if (mKeyWriterStarted)
+			mExtractedFeatures.push(feature);
+
+		ScopedLock lock(mExtractionMutex);
+		if (!mKeyWriterStarted)
+			writeKeyFile(feature);
+
+		mNbExtractedImage++;
+		mExtractedFeatureSum += std::max(nbFeature, 0); //-1: image can not be decoded
+		int percent = (int)((mNbExtractedImage*100.0f) / (1.0f*mExtractionJobs.size()));
+		unsigned int totalRAM = (unsigned int) ((mExtractedFeatureSum*mBytesPerFeature*mFilenames.size())/((mFilenames.size()-mExtractionJobs.size()+mNbExtractedImage)*1073741824.0));
+		clearScreen();
+		std::cout << "[Saving Sift Key files: ("<<totalRAM<< "GB) "<< percent << "%] - ("<<mNbExtractedImage<<"/"<<mExtractionJobs.size()<<") #" << nbFeature <<" features";
+	}
+}
+
+int BundlerMatcher::extractSiftFeature(SiftExtractor& extractor, const DecodedImage& image, FeatureInfo& info)
+{
+	int nbFeatureFound = -1;
+	bool extracted = image.loaded;
+
+	info.width  = image.width;
+	info.height = image.height;
+
+	for (unsigned int t=0; t<image.tiles.size(); ++t)
+	{
+		//Large images are given to the extractor tile by tile which does not choke the Graphics RAM
+		const ImageTile& tile = image.tiles[t];
+
+		SiftKeyDescriptors descriptors;
+		SiftKeyPoints keys;
+		int num = extractor.extract(tile.width, tile.height, &tile.pixels[0], keys, descriptors);
+		if (num >= 0)
+		{
+			if(num>0)
+			{
+				if(nbFeatureFound == -1) nbFeatureFound = num;
+				else nbFeatureFound += num;
 
-	ilDeleteImages(1, &imgId); 
+				for(int i=0;i<keys.size();i++)
+				{
+					keys[i].x+=tile.x;
+					keys[i].y+=tile.y;
+				}
+
+				if (mCompactDescriptorsEnabled)
+				{
+					size_t offset = info.compactDescriptors.size();
+					info.compactDescriptors.resize(offset + descriptors.size());
+					for (size_t k=0; k<descriptors.size(); ++k)
+						info.compactDescriptors[offset+k] = quantizeDescriptor(descriptors[k]);
+				}
+				else
+					info.descriptors.insert(info.descriptors.end(),descriptors.begin(),descriptors.end());
+				info.points.insert(info.points.end(),keys.begin(),keys.end());
+			}
+		}
+		else
+		{
+			extracted = false;
+		}
+	}
 
 	if (!extracted)
 	{
-		std::cout << "Error while reading : " <<filename <<std::endl;
+		std::cout << "Error while reading : " <<mInputPath << mFilenames[image.fileIndex] <<std::endl;
 	}
 
 	return nbFeatureFound;
 }
 
-void BundlerMatcher::matchSiftFeature(int fileIndexA, int fileIndexB)
+void BundlerMatcher::matchSiftFeature(int fileIndexA, int fileIndexB, SiftMatcher& matcher, std::deque<MatchInfo>& matchInfos)
 {
-	SiftKeyPoints pointsA           = mFeatureInfos[fileIndexA].points;
-	SiftKeyDescriptors descriptorsA = mFeatureInfos[fileIndexA].descriptors;
+	//Features are read in place, matches are written directly in the new MatchInfo (or verification job)
+	const FeatureInfo& featureA = *mFeatureStore.acquire(fileIndexA);
+	const FeatureInfo& featureB = *mFeatureStore.acquire(fileIndexB);
 
-	SiftKeyPoints pointsB           = mFeatureInfos[fileIndexB].points;
-	SiftKeyDescriptors descriptorsB = mFeatureInfos[fileIndexB].descriptors;
+	int nbFeatureA = (int) featureA.points.size();
+	int nbFeatureB = (int) featureB.points.size();
 
-	//If there are too many points all points dont get processed, break up the
-	//matching process
-	int max_size = std::max((int) pointsA.size(),(int) pointsB.size());
+	VerificationJob* job = NULL;
+	if (mVerificationEnabled)
+	{
+		job = new VerificationJob;
+		job->indexA   = fileIndexA;
+		job->indexB   = fileIndexB;
+		job->featureA = &featureA;
+		job->featureB = &featureB;
+	}
+	else
+	{
+		std::vector<Match> empty;
+		matchInfos.push_back(MatchInfo(fileIndexA, fileIndexB, empty));
+	}
+	std::vector<Match>& matches = (job ? job->matches : matchInfos.back().matches);
 
-	int iter_matches = (max_size/MATCH_BUFFER) + 1;
+	if (nbFeatureA > 0 && nbFeatureB > 0)
+	{
+		if (mApproximateMatchingEnabled)
+		{
+			//the k-d forest of each image is built once and cached with its features
+			const KdForest& forestA = getForest(fileIndexA, featureA);
+			const KdForest& forestB = getForest(fileIndexB, featureB);
+			SiftMatcherANN& approximateMatcher = static_cast<SiftMatcherANN&>(matcher);
+			approximateMatcher.match(forestA, forestB, matches);
+			if (job)
+				job->ratios = matcher.getRatios(); //before matchExact replaces them
+
+			bool checkRecall;
+			{
+				ScopedLock lock(mProgressMutex);
+				checkRecall = (mNbRecallTicket++ % ANN_RECALL_PERIOD) == 0;
+			}
+			if (checkRecall)
+			{
+				std::vector<Match> exactMatches;
+				approximateMatcher.matchExact(forestA.getDescriptors(), nbFeatureA, forestB.getDescriptors(), nbFeatureB, exactMatches);
 
-	max_size = std::min(max_size,MATCH_BUFFER);
+				//both lists are sorted by index in A
+				std::vector<Match> recalled;
+				std::set_intersection(matches.begin(), matches.end(), exactMatches.begin(), exactMatches.end(), std::back_inserter(recalled));
 
-	//Save Match in RAM
-	std::vector<Match> matches;
-	int asize = (int)pointsA.size();
-	int bsize = (int)pointsB.size();
+				ScopedLock lock(mProgressMutex);
+				mNbRecallPair++;
+				mNbExactMatch    += (long) exactMatches.size();
+				mNbRecalledMatch += (long) recalled.size();
+			}
+		}
+		else
+		{
+			if (mCompactDescriptorsEnabled)
+				matcher.match(&featureA.compactDescriptors[0], nbFeatureA, &featureB.compactDescriptors[0], nbFeatureB, matches);
+			else
+				matcher.match(&featureA.descriptors[0], nbFeatureA, &featureB.descriptors[0], nbFeatureB, matches);
+			if (job)
+				job->ratios = matcher.getRatios();
+		}
+	}
 
-	for(int i = 0 ; i < iter_matches; i++)
+	//key-point positions are needed: the features are released once the pair is verified
+	if (job)
 	{
-		for(int j = 0 ; j < iter_matches; j++)
+		if (mVerifiersStarted)
+			mVerificationJobs.push(job);
+		else
 		{
-			int astart = asize*i/iter_matches;
-			int aend = asize*(i+1)/iter_matches;
-			int bstart = bsize*j/iter_matches;
-			int bend = bsize*(j+1)/iter_matches;
-			
-			int alen = aend - astart;
-			int blen = bend - bstart;
+			ScopedLock lock(mVerificationMutex);
+			verifyPair(0, job);
+		}
+		return;
+	}
 
-			mMatcher->SetDescriptors(0, alen , &descriptorsA[0+astart*128]);
-			mMatcher->SetDescriptors(1, blen , &descriptorsB[0+bstart*128]);
-	
-			int (*matchBuffer)[2] = new int[max_size][2];
+	mFeatureStore.release(fileIndexA);
+	mFeatureStore.release(fileIndexB);
+}
 
-			//This stage can be farmed off to a remote GPU
-			mMatcher->SetMaxSift(max_size);
-			int nbMatch = mMatcher->GetSiftMatch(max_size, matchBuffer, mDistanceThreshold, mRatioThreshold);
+const KdForest& BundlerMatcher::getForest(int fileIndex, const FeatureInfo& info)
+{
+	{
+		ScopedLock lock(mForestMutex);
+		if (info.forest)
+			return *info.forest;
+	}
 
-			
-			for (int i=0; i<nbMatch; ++i)
-				matches.push_back(Match(matchBuffer[i][0]+astart, matchBuffer[i][1]+bstart));
+	//built without holding the lock: if two workers build the same forest the first one is kept
+	KdForest* forest = new KdForest;
+	if (mCompactDescriptorsEnabled)
+		forest->build(&info.compactDescriptors[0], (int) info.points.size(), ANN_TREE);
+	else
+		forest->build(&info.descriptors[0], (int) info.points.size(), ANN_TREE);
 
-			delete[] matchBuffer;
+	{
+		ScopedLock lock(mForestMutex);
+		if (!info.forest)
+		{
+			info.forest = forest;
+			forest = NULL;
 		}
 	}
+	delete forest;
 
-	mMatchInfos.push_back(MatchInfo(fileIndexA, fileIndexB, matches));
+	mFeatureStore.updateMemorySize(fileIndex);
+	return *info.forest;
 }
 
-int BundlerMatcher::readAsciiKeyFile(int fileIndex)
+bool BundlerMatcher::getImageDimension(int fileIndex, int& width, int& height)
 {
-	std::stringstream keyfilepath;
-	keyfilepath << mInputPath << mFilenames[fileIndex].substr(0, mFilenames[fileIndex].size()-4) << ".key";
-
 	std::stringstream filepath;
 	filepath << mInputPath << mFilenames[fileIndex];
 
-	std::string tmp = filepath.str();
-	char* filename = &tmp[0];
+	return readImageDimension(filepath.str(), width, height);
+}
 
-	unsigned int num = 0; 
-	unsigned int descCount = 0;
+bool BundlerMatcher::loadFeatures(int fileIndex, FeatureInfo& info)
+{
+	if (keyBinaryExists(mFilenames[fileIndex]))
+		return readBinaryKeyFile(fileIndex, info) >= 0;
+	else
+		return readAsciiKeyFile(fileIndex, info) >= 0;
+}
 
-	if(ilLoadImage(filename))
-	{
-		int w = ilGetInteger(IL_IMAGE_WIDTH);
-		int h = ilGetInteger(IL_IMAGE_HEIGHT);
+int BundlerMatcher::readAsciiKeyFile(int fileIndex, FeatureInfo& info)
+{
+	std::stringstream keyfilepath;
+	keyfilepath << mInputPath << mFilenames[fileIndex].substr(0, mFilenames[fileIndex].size()-4) << ".key";
 
-		std::ifstream input(keyfilepath.str().c_str());
-		if (input.is_open())
-		{
-			
-			input >> num;
-			input >> descCount;
+	//the whole file is parsed in place from a memory mapping
+	MappedFile input;
+	if (!input.open(keyfilepath.str()))
+		return 0;
 
-			if(descCount!=128)
-			{
-				std::cout << "Error while reading key file, descriptor count invalid" << std::endl;
-				return -1;
-			}
+	int num = parseAsciiKeyFile(input.getData(), input.getSize(), info, mCompactDescriptorsEnabled);
+	if (num < 0)
+	{
+		std::cout << "Error while reading key file : " << keyfilepath.str() << std::endl;
+		info.points.clear();
+		info.descriptors.clear();
+		info.compactDescriptors.clear();
+	}
 
-			SiftKeyDescriptors descriptors(128*num);
-			SiftKeyPoints keys(num);
+	return num;
+}
 
-			FeatureInfo info(w, h, keys, descriptors);
+int BundlerMatcher::readBinaryKeyFile(int fileIndex, FeatureInfo& info)
+{
+	std::stringstream filepath;
+	filepath << mInputPath << mFilenames[fileIndex].substr(0, mFilenames[fileIndex].size()-4) << ".key.bin";
 
-			float* pd = &info.descriptors[0];
+	if (mFeatureDatabaseEnabled)
+		return readSiftFile(mFeatureDatabase, mFilenames[fileIndex], info, mCompactDescriptorsEnabled);
 
-			for (unsigned int i=0; i<num; ++i)
-			{
-				//in y, x, scale, orientation order
-				input >> std::setprecision(2) >> info.points[i].y ;
-				input >> std::setprecision(2) >> info.points[i].x ;
-				input >> std::setprecision(3) >> info.points[i].s ;
-				input >> std::setprecision(3) >> info.points[i].o ;
-				
-				unsigned int feature;
-
-				for (int k=0; k<128; ++k, ++pd)
-				{
-					input >> feature;
-					*pd = (((float)feature)/512.0f)-0.5f;		
-				}
-			}
+	return readSiftFile(filepath.str(), info, mCompactDescriptorsEnabled);
+}
 
-			mFeatureInfos.push_back(info);
+int BundlerMatcher::readFeatureCount(int fileIndex)
+{
+	//only the header is read: the memory mapping does not page the descriptors in
+	const std::string& imagefile = mFilenames[fileIndex];
+	if (keyBinaryExists(imagefile))
+	{
+		SiftFile::Reader reader;
+		bool valid;
+		if (mFeatureDatabaseEnabled)
+			valid = mFeatureDatabase.read(imagefile, reader, false);
+		else
+		{
+			std::stringstream filepath;
+			filepath << mInputPath << imagefile.substr(0, imagefile.size()-4) << ".key.bin";
+			valid = reader.open(filepath.str(), false);
 		}
-
-		input.close();
+		if (valid)
+			return (int) reader.getFeatureCount();
 	}
 
-	return num;
+	//Lowe .key file: "nbFeature 128" on the first line
+	std::stringstream filepath;
+	filepath << mInputPath << imagefile.substr(0, imagefile.size()-4) << ".key";
+	std::ifstream input(filepath.str().c_str());
+	int nbFeature = -1;
+	if (!(input >> nbFeature))
+		return -1;
+
+	return nbFeature;
 }
 
-void BundlerMatcher::saveAsciiKeyFile(int fileIndex)
+void BundlerMatcher::saveAsciiKeyFile(int fileIndex, const FeatureInfo& info)
 {	
 	std::stringstream filepath;
 	filepath << mInputPath << mFilenames[fileIndex].substr(0, mFilenames[fileIndex].size()-4) << ".key";
 
+	//Whole file formatted in memory then written at once (no flush per line)
+	std::vector<char> buffer;
+	formatAsciiKeyFile(info, buffer);
+
 	std::ofstream output(filepath.str().c_str());
 	if (output.is_open())
-	{
-		output.flags(std::ios::fixed);
-
-		const FeatureInfo& info = mFeatureInfos[fileIndex];
-		
-		unsigned int nbFeature = (unsigned int) info.points.size();
-		const float* pd = &info.descriptors[0];
-		
-		output << nbFeature << " 128" <<std::endl;
-
-		for (unsigned int i=0; i<nbFeature; ++i)
-		{
-			//in y, x, scale, orientation order
-			output << std::setprecision(2) << info.points[i].y << " " << std::setprecision(2) << info.points[i].x << " " << std::setprecision(3) << info.points[i].s << " " << std::setprecision(3) <<  info.points[i].o << std::endl;
-			for (int k=0; k<128; ++k, ++pd)
-			{
-				output << ((unsigned int)floor(0.5+512.0f*(*pd)))<< " ";
-
-				if ((k+1)%20 == 0) 
-					output << std::endl;
-			}
-			output << std::endl;
-		}
-	}
+		output.write(&buffer[0], buffer.size());
 	output.close();
 }
 
-void BundlerMatcher::saveBinaryKeyFile(int fileIndex)
+void BundlerMatcher::saveBinaryKeyFile(int fileIndex, const FeatureInfo& featureInfo)
 {
 	std::stringstream filepath;
 	filepath << mInputPath << mFilenames[fileIndex].substr(0, mFilenames[fileIndex].size()-4) << ".key.bin";
 
-	std::ofstream output;
-	output.open(filepath.str().c_str(), std::ios::out | std::ios::binary);
-	if (output.is_open())
+	if (mFeatureDatabaseEnabled)
 	{
-		int nbFeature = (int)mFeatureInfos[fileIndex].points.size();
-		output.write((char*)&nbFeature, sizeof(nbFeature));
-
-		FeatureInfo featureInfo = mFeatureInfos[fileIndex];
-		for (int i=0; i<nbFeature; ++i)
-		{			
-			float x           = featureInfo.points[i].x;
-			float y           = featureInfo.points[i].y;
-			float scale       = featureInfo.points[i].s;
-			float orientation = featureInfo.points[i].o;
-			float* descriptor = &featureInfo.descriptors[i*128];
-			output.write((char*)&x, sizeof(x));
-			output.write((char*)&y, sizeof(y));
-			output.write((char*)&scale, sizeof(scale));
-			output.write((char*)&orientation, sizeof(orientation));
-			output.write((char*)descriptor, sizeof(float)*128);	
-		}
+		if (!mFeatureDatabase.isReadOnly())
+			writeSiftFile(mFeatureDatabase, mFilenames[fileIndex], featureInfo);
 	}
-	output.close();
+	else
+		writeSiftFile(filepath.str(), featureInfo);
 }
 
 void BundlerMatcher::clearScreen()
@@ -549,6 +1450,15 @@ void BundlerMatcher::clearScreen()
 
 void BundlerMatcher::saveMatches(const std::string& filename)
 {
+	//Bundler only reads the text format: convert the streamed binary file
+	if (mMatchStreamingEnabled)
+	{
+		SiftFile::MatchReader reader;
+		if (!reader.open(mMatchStreamFilename) || !SiftFile::writeMatchText(reader, filename))
+			std::cout << "Error : can not convert file : " << mMatchStreamFilename << std::endl;
+		return;
+	}
+
 	std::ofstream output;
 	output.open(filename.c_str());
 	for (unsigned int i=0; i<mMatchInfos.size(); ++i)
@@ -589,6 +1499,17 @@ void BundlerMatcher::saveMatrix()
 		matrix[indexA*nbFile+indexB] = nbMatch;
 	}
 
+	//streamed matches: counts are in the binary file index
+	SiftFile::MatchReader reader;
+	if (mMatchStreamingEnabled && reader.open(mMatchStreamFilename))
+	{
+		for (unsigned int i=0; i<reader.getPairCount(); ++i)
+		{
+			const SiftFile::MatchFileEntry& entry = reader.getPair(i);
+			matrix[entry.indexA*nbFile+entry.indexB] = entry.nbMatch;
+		}
+	}
+
 	for (int i=0; i<nbFile; ++i)
 	{
 		for (int j=0; j<nbFile; ++j)	
@@ -605,7 +1526,7 @@ void BundlerMatcher::saveVector()
 {
 	std::ofstream output;
 	output.open("vector.txt");
-	for (unsigned int i=0; i<mFeatureInfos.size(); ++i)
-		output << mFeatureInfos[i].points.size() << std::endl;
+	for (int i=0; i<mFeatureStore.getImageCount(); ++i)
+		output << mFeatureStore.getFeatureCount(i) << std::endl;
 	output.close();
 }
\ No newline at end of file
@@ -0,0 +1,204 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include "FeatureStore.h"
+
+#include <iostream>
+
+FeatureStore::FeatureStore()
+{
+	mCacheSize  = 0;
+	mMemoryUsed = 0;
+	mLoader     = NULL;
+}
+
+FeatureStore::~FeatureStore()
+{
+	clear();
+}
+
+void FeatureStore::clear()
+{
+	for (unsigned int i=0; i<mEntries.size(); ++i)
+		delete mEntries[i].info;
+	mEntries.clear();
+	mLRU.clear();
+	mMemoryUsed = 0;
+}
+
+void FeatureStore::reset(int nbImage, size_t cacheSize, FeatureLoader* loader)
+{
+	ScopedLock lock(mMutex);
+
+	clear();
+	mEntries.resize(nbImage);
+	mCacheSize = cacheSize;
+	mLoader    = loader;
+}
+
+void FeatureStore::insert(int fileIndex, FeatureInfo* info)
+{
+	ScopedLock lock(mMutex);
+
+	Entry& entry = mEntries[fileIndex];
+	if (entry.info)
+	{
+		if (entry.inCache)
+			mLRU.erase(entry.position);
+		entry.inCache = false;
+		mMemoryUsed -= entry.size;
+		delete entry.info;
+	}
+
+	entry.info      = info;
+	entry.width     = info->width;
+	entry.height    = info->height;
+	entry.nbFeature = (int) info->points.size();
+	entry.size      = info->getMemorySize();
+	mMemoryUsed    += entry.size;
+
+	if (entry.refCount == 0)
+	{
+		mLRU.push_front(fileIndex);
+		entry.position = mLRU.begin();
+		entry.inCache  = true;
+	}
+
+	evict();
+}
+
+const FeatureInfo* FeatureStore::acquire(int fileIndex)
+{
+	mMutex.lock();
+
+	Entry& entry = mEntries[fileIndex];
+	while (entry.loading)
+		mLoaded.wait(mMutex);
+
+	if (!entry.info)
+	{
+		//page in without holding the lock, other threads waiting for this image sleep on mLoaded
+		entry.loading = true;
+		FeatureInfo* info = new FeatureInfo(entry.width, entry.height);
+		mMutex.unlock();
+
+		if (!mLoader || !mLoader->loadFeatures(fileIndex, *info))
+			std::cout << "Error : can not reload features of image " << fileIndex << std::endl;
+		info->width  = entry.width;
+		info->height = entry.height;
+
+		mMutex.lock();
+		entry.info      = info;
+		entry.loading   = false;
+		entry.nbFeature = (int) info->points.size();
+		entry.size      = info->getMemorySize();
+		mMemoryUsed    += entry.size;
+		mLoaded.notifyAll();
+	}
+	else if (entry.inCache)
+	{
+		mLRU.erase(entry.position);
+		entry.inCache = false;
+	}
+
+	entry.refCount++;
+	FeatureInfo* info = entry.info;
+
+	evict();
+	mMutex.unlock();
+
+	return info;
+}
+
+void FeatureStore::release(int fileIndex)
+{
+	ScopedLock lock(mMutex);
+
+	Entry& entry = mEntries[fileIndex];
+	entry.refCount--;
+	if (entry.refCount == 0 && entry.info)
+	{
+		mLRU.push_front(fileIndex);
+		entry.position = mLRU.begin();
+		entry.inCache  = true;
+		evict();
+	}
+}
+
+void FeatureStore::updateMemorySize(int fileIndex)
+{
+	ScopedLock lock(mMutex);
+
+	Entry& entry = mEntries[fileIndex];
+	if (!entry.info)
+		return;
+
+	mMemoryUsed -= entry.size;
+	entry.size   = entry.info->getMemorySize();
+	mMemoryUsed += entry.size;
+	evict();
+}
+
+int FeatureStore::getFeatureCount(int fileIndex)
+{
+	ScopedLock lock(mMutex);
+
+	return mEntries[fileIndex].nbFeature;
+}
+
+size_t FeatureStore::getAverageImageSize()
+{
+	ScopedLock lock(mMutex);
+
+	//images never read (other shards) are not counted
+	size_t total = 0;
+	size_t nbImage = 0;
+	for (unsigned int i=0; i<mEntries.size(); ++i)
+	{
+		if (mEntries[i].size == 0)
+			continue;
+		total += mEntries[i].size;
+		nbImage++;
+	}
+
+	return nbImage == 0 ? 0 : total / nbImage;
+}
+
+void FeatureStore::evict()
+{
+	//only unused entries can be evicted: the cache can temporarily exceed its size
+	//when all loaded images are in use
+	if (mCacheSize == 0)
+		return;
+
+	while (mMemoryUsed > mCacheSize && !mLRU.empty())
+	{
+		int fileIndex = mLRU.back();
+		mLRU.pop_back();
+
+		Entry& entry = mEntries[fileIndex];
+		entry.inCache = false;
+		mMemoryUsed  -= entry.size;
+		delete entry.info;
+		entry.info = NULL;
+	}
+}
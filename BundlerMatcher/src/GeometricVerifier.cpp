@@ -0,0 +1,510 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include "GeometricVerifier.h"
+
+#include <algorithm>
+#include <math.h>
+
+//RANSAC iterations when the inlier ratio is unknown (Bundler default) and stop confidence
+#define VERIFY_MAX_ITERATION 2048
+#define VERIFY_CONFIDENCE    0.999
+//matches of a minimal sample
+#define VERIFY_SAMPLE_SIZE   7
+
+#define VERIFY_PI 3.14159265358979323846
+
+static bool compareRatio(const std::pair<float, int>& a, const std::pair<float, int>& b)
+{
+	if (a.first != b.first)
+		return a.first < b.first;
+	return a.second < b.second;
+}
+
+static bool compareSimilarity(const std::pair<float, int>& a, const std::pair<float, int>& b)
+{
+	if (a.first != b.first)
+		return a.first > b.first;
+	return a.second < b.second;
+}
+
+//Hartley normalization: centroid at the origin and mean distance of sqrt(2), T maps pixels to normalized coordinates
+static void normalizePoints(const std::vector<double>& points, std::vector<double>& normalized, double* T)
+{
+	int nbPoint = (int) points.size()/2;
+	double cx = 0.0;
+	double cy = 0.0;
+	for (int i=0; i<nbPoint; ++i)
+	{
+		cx += points[2*i];
+		cy += points[2*i+1];
+	}
+	cx /= nbPoint;
+	cy /= nbPoint;
+
+	double meanDistance = 0.0;
+	for (int i=0; i<nbPoint; ++i)
+	{
+		double dx = points[2*i]-cx;
+		double dy = points[2*i+1]-cy;
+		meanDistance += sqrt(dx*dx + dy*dy);
+	}
+	meanDistance /= nbPoint;
+	double scale = (meanDistance > 0.0 ? sqrt(2.0)/meanDistance : 1.0);
+
+	normalized.resize(points.size());
+	for (int i=0; i<nbPoint; ++i)
+	{
+		normalized[2*i]   = (points[2*i]-cx)*scale;
+		normalized[2*i+1] = (points[2*i+1]-cy)*scale;
+	}
+
+	T[0] = scale; T[1] = 0.0;   T[2] = -scale*cx;
+	T[3] = 0.0;   T[4] = scale; T[5] = -scale*cy;
+	T[6] = 0.0;   T[7] = 0.0;   T[8] = 1.0;
+}
+
+//cyclic Jacobi eigen decomposition of a symmetric n x n matrix (row major, destroyed)
+//eigenvectors are the columns of vectors
+static void jacobiEigen(double* a, int n, double* values, double* vectors)
+{
+	for (int i=0; i<n*n; ++i)
+		vectors[i] = 0.0;
+	for (int i=0; i<n; ++i)
+		vectors[i*n+i] = 1.0;
+
+	for (int sweep=0; sweep<50; ++sweep)
+	{
+		double offDiagonal = 0.0;
+		double total = 0.0;
+		for (int p=0; p<n; ++p)
+			for (int q=0; q<n; ++q)
+			{
+				total += a[p*n+q]*a[p*n+q];
+				if (p != q)
+					offDiagonal += a[p*n+q]*a[p*n+q];
+			}
+		if (offDiagonal <= 1e-24*total)
+			break;
+
+		for (int p=0; p<n-1; ++p)
+			for (int q=p+1; q<n; ++q)
+			{
+				double apq = a[p*n+q];
+				if (apq == 0.0)
+					continue;
+
+				double theta = (a[q*n+q]-a[p*n+p]) / (2.0*apq);
+				double t = (theta >= 0.0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta*theta + 1.0));
+				double c = 1.0 / sqrt(t*t + 1.0);
+				double s = t*c;
+
+				for (int k=0; k<n; ++k)
+				{
+					double akp = a[k*n+p];
+					double akq = a[k*n+q];
+					a[k*n+p] = c*akp - s*akq;
+					a[k*n+q] = s*akp + c*akq;
+				}
+				for (int k=0; k<n; ++k)
+				{
+					double apk = a[p*n+k];
+					double aqk = a[q*n+k];
+					a[p*n+k] = c*apk - s*aqk;
+					a[q*n+k] = s*apk + c*aqk;
+				}
+				for (int k=0; k<n; ++k)
+				{
+					double vkp = vectors[k*n+p];
+					double vkq = vectors[k*n+q];
+					vectors[k*n+p] = c*vkp - s*vkq;
+					vectors[k*n+q] = s*vkp + c*vkq;
+				}
+			}
+	}
+
+	for (int i=0; i<n; ++i)
+		values[i] = a[i*n+i];
+}
+
+//eigenvectors of the two smallest eigenvalues of a symmetric 9x9 matrix (destroyed)
+static void smallestEigenVectors(double* ata, double* first, double* second)
+{
+	double values[9];
+	double vectors[81];
+	jacobiEigen(ata, 9, values, vectors);
+
+	int order[9];
+	for (int i=0; i<9; ++i)
+		order[i] = i;
+	for (int i=0; i<2; ++i)
+		for (int j=i+1; j<9; ++j)
+			if (values[order[j]] < values[order[i]])
+				std::swap(order[i], order[j]);
+
+	for (int i=0; i<9; ++i)
+	{
+		first[i]  = vectors[i*9+order[0]];
+		second[i] = vectors[i*9+order[1]];
+	}
+}
+
+//epipolar constraint xb^T F xa = 0 as a row of 9 coefficients, accumulated in ata
+static void addConstraint(const double* a, const double* b, double* ata)
+{
+	double row[9] = {b[0]*a[0], b[0]*a[1], b[0], b[1]*a[0], b[1]*a[1], b[1], a[0], a[1], 1.0};
+	for (int i=0; i<9; ++i)
+		for (int j=0; j<9; ++j)
+			ata[i*9+j] += row[i]*row[j];
+}
+
+static double determinant3(const double* m)
+{
+	return m[0]*(m[4]*m[8]-m[5]*m[7]) - m[1]*(m[3]*m[8]-m[5]*m[6]) + m[2]*(m[3]*m[7]-m[4]*m[6]);
+}
+
+//real roots of c3*x^3 + c2*x^2 + c1*x + c0
+static int solveCubic(double c3, double c2, double c1, double c0, double* roots)
+{
+	if (fabs(c3) <= 1e-12*(fabs(c2)+fabs(c1)+fabs(c0)))
+	{
+		if (fabs(c2) <= 1e-12*(fabs(c1)+fabs(c0)))
+		{
+			if (c1 == 0.0)
+				return 0;
+			roots[0] = -c0/c1;
+			return 1;
+		}
+		double discriminant = c1*c1 - 4.0*c2*c0;
+		if (discriminant < 0.0)
+			return 0;
+		roots[0] = (-c1 + sqrt(discriminant)) / (2.0*c2);
+		roots[1] = (-c1 - sqrt(discriminant)) / (2.0*c2);
+		return 2;
+	}
+
+	double a = c2/c3;
+	double b = c1/c3;
+	double c = c0/c3;
+	double q = (a*a - 3.0*b) / 9.0;
+	double r = (2.0*a*a*a - 9.0*a*b + 27.0*c) / 54.0;
+
+	if (r*r < q*q*q)
+	{
+		double theta = acos(r / sqrt(q*q*q));
+		double sq = -2.0*sqrt(q);
+		roots[0] = sq*cos(theta/3.0) - a/3.0;
+		roots[1] = sq*cos((theta + 2.0*VERIFY_PI)/3.0) - a/3.0;
+		roots[2] = sq*cos((theta - 2.0*VERIFY_PI)/3.0) - a/3.0;
+		return 3;
+	}
+
+	double A = -(r >= 0.0 ? 1.0 : -1.0) * pow(fabs(r) + sqrt(r*r - q*q*q), 1.0/3.0);
+	double B = (A != 0.0 ? q/A : 0.0);
+	roots[0] = A + B - a/3.0;
+	return 1;
+}
+
+//fundamental matrices through 7 normalized correspondences (1 or 3 solutions)
+static int computeFundamental7(const double* pointsA, const double* pointsB, const int* sample, double* solutions)
+{
+	double ata[81] = {0};
+	for (int i=0; i<VERIFY_SAMPLE_SIZE; ++i)
+		addConstraint(pointsA + 2*sample[i], pointsB + 2*sample[i], ata);
+
+	//F = x*F1 + (1-x)*F2 in the 2D null space, det(F) = 0 is a cubic in x
+	double F1[9], F2[9];
+	smallestEigenVectors(ata, F1, F2);
+
+	double determinants[4];
+	const double x[4] = {0.0, 1.0, -1.0, 2.0};
+	for (int i=0; i<4; ++i)
+	{
+		double F[9];
+		for (int k=0; k<9; ++k)
+			F[k] = x[i]*F1[k] + (1.0-x[i])*F2[k];
+		determinants[i] = determinant3(F);
+	}
+
+	double c0 = determinants[0];
+	double c2 = (determinants[1] + determinants[2])/2.0 - c0;
+	double c3 = (determinants[3] - 4.0*c2 - c0 - (determinants[1] - determinants[2])) / 6.0;
+	double c1 = (determinants[1] - determinants[2])/2.0 - c3;
+
+	double roots[3];
+	int nbRoot = solveCubic(c3, c2, c1, c0, roots);
+	for (int i=0; i<nbRoot; ++i)
+		for (int k=0; k<9; ++k)
+			solutions[i*9+k] = roots[i]*F1[k] + (1.0-roots[i])*F2[k];
+
+	return nbRoot;
+}
+
+//least squares fundamental matrix of normalized correspondences, rank 2 enforced
+static bool computeFundamental8(const std::vector<double>& pointsA, const std::vector<double>& pointsB,
+	const std::vector<unsigned char>& inliers, double* F)
+{
+	double ata[81] = {0};
+	int nbInlier = 0;
+	for (unsigned int i=0; i<inliers.size(); ++i)
+	{
+		if (!inliers[i])
+			continue;
+		addConstraint(&pointsA[2*i], &pointsB[2*i], ata);
+		nbInlier++;
+	}
+	if (nbInlier < 8)
+		return false;
+
+	double second[9];
+	smallestEigenVectors(ata, F, second);
+
+	//closest rank 2 matrix: F - F*v*v^T with v the smallest right singular vector
+	double ftf[9];
+	for (int i=0; i<3; ++i)
+		for (int j=0; j<3; ++j)
+			ftf[i*3+j] = F[i]*F[j] + F[3+i]*F[3+j] + F[6+i]*F[6+j];
+	double values[3], vectors[9];
+	jacobiEigen(ftf, 3, values, vectors);
+	int smallest = 0;
+	for (int i=1; i<3; ++i)
+		if (values[i] < values[smallest])
+			smallest = i;
+
+	double v[3] = {vectors[smallest], vectors[3+smallest], vectors[6+smallest]};
+	for (int i=0; i<3; ++i)
+	{
+		double fv = F[i*3]*v[0] + F[i*3+1]*v[1] + F[i*3+2]*v[2];
+		for (int j=0; j<3; ++j)
+			F[i*3+j] -= fv*v[j];
+	}
+
+	return true;
+}
+
+//pixel fundamental matrix from a normalized one: TB^T * F * TA
+static void denormalize(const double* F, const double* TA, const double* TB, double* result)
+{
+	double FTA[9];
+	for (int i=0; i<3; ++i)
+		for (int j=0; j<3; ++j)
+			FTA[i*3+j] = F[i*3]*TA[j] + F[i*3+1]*TA[3+j] + F[i*3+2]*TA[6+j];
+	for (int i=0; i<3; ++i)
+		for (int j=0; j<3; ++j)
+			result[i*3+j] = TB[i]*FTA[j] + TB[3+i]*FTA[3+j] + TB[6+i]*FTA[6+j];
+}
+
+GeometricVerifier::GeometricVerifier(float threshold, int minInlier)
+{
+	mThreshold = threshold;
+	mMinInlier = std::max(minInlier, 8);
+	mSeed      = 1;
+}
+
+void GeometricVerifier::sortByRatio(const std::vector<float>& ratios)
+{
+	//ratio test score of the matcher: PROSAC draws samples from the most distinctive matches first
+	std::vector<std::pair<float, int> > scores(ratios.size());
+	for (unsigned int i=0; i<ratios.size(); ++i)
+		scores[i] = std::make_pair(ratios[i], (int) i);
+	std::sort(scores.begin(), scores.end(), compareRatio);
+
+	mOrder.resize(ratios.size());
+	for (unsigned int i=0; i<ratios.size(); ++i)
+		mOrder[i] = scores[i].second;
+}
+
+void GeometricVerifier::sortBySimilarity(const FeatureInfo& featureA, const FeatureInfo& featureB, const std::vector<Match>& matches)
+{
+	//descriptor dot product when the matcher has no ratio (SiftMatchGPU): most similar matches first
+	std::vector<std::pair<float, int> > similarities(matches.size());
+	for (unsigned int i=0; i<matches.size(); ++i)
+	{
+		int offsetA = matches[i].first*128;
+		int offsetB = matches[i].second*128;
+		float similarity = 0.0f;
+		for (int k=0; k<128; ++k)
+			similarity += featureA.getDescriptor(offsetA+k) * featureB.getDescriptor(offsetB+k);
+		similarities[i] = std::make_pair(similarity, (int) i);
+	}
+	std::sort(similarities.begin(), similarities.end(), compareSimilarity);
+
+	mOrder.resize(matches.size());
+	for (unsigned int i=0; i<matches.size(); ++i)
+		mOrder[i] = similarities[i].second;
+}
+
+void GeometricVerifier::drawSample(int nbCandidate, bool includeLast, int* sample)
+{
+	int nbDrawn = 0;
+	if (includeLast)
+		sample[nbDrawn++] = nbCandidate-1;
+
+	int range = (includeLast ? nbCandidate-1 : nbCandidate);
+	while (nbDrawn < VERIFY_SAMPLE_SIZE)
+	{
+		mSeed = mSeed*1103515245 + 12345;
+		int index = (int) ((mSeed >> 8) % (unsigned int) range);
+
+		bool drawn = false;
+		for (int i=0; i<nbDrawn && !drawn; ++i)
+			drawn = (sample[i] == index);
+		if (!drawn)
+			sample[nbDrawn++] = index;
+	}
+}
+
+int GeometricVerifier::findInliers(const double* F, std::vector<unsigned char>& inliers) const
+{
+	//Sampson distance: first order approximation of the reprojection error
+	double threshold = (double) mThreshold*mThreshold;
+	int nbPoint = (int) mPointsA.size()/2;
+	int nbInlier = 0;
+	inliers.resize(nbPoint);
+	for (int i=0; i<nbPoint; ++i)
+	{
+		double xa = mPointsA[2*i], ya = mPointsA[2*i+1];
+		double xb = mPointsB[2*i], yb = mPointsB[2*i+1];
+
+		double fa0 = F[0]*xa + F[1]*ya + F[2];
+		double fa1 = F[3]*xa + F[4]*ya + F[5];
+		double fa2 = F[6]*xa + F[7]*ya + F[8];
+		double fb0 = F[0]*xb + F[3]*yb + F[6];
+		double fb1 = F[1]*xb + F[4]*yb + F[7];
+		double error = xb*fa0 + yb*fa1 + fa2;
+		double gradient = fa0*fa0 + fa1*fa1 + fb0*fb0 + fb1*fb1;
+
+		inliers[i] = (gradient > 0.0 && error*error <= threshold*gradient);
+		nbInlier += inliers[i];
+	}
+
+	return nbInlier;
+}
+
+int GeometricVerifier::verify(const FeatureInfo& featureA, const FeatureInfo& featureB, std::vector<Match>& matches, const std::vector<float>& ratios)
+{
+	int nbMatch = (int) matches.size();
+	if (nbMatch < mMinInlier)
+	{
+		matches.clear();
+		return 0;
+	}
+
+	if (ratios.size() == matches.size())
+		sortByRatio(ratios);
+	else
+		sortBySimilarity(featureA, featureB, matches);
+	mPointsA.resize(2*nbMatch);
+	mPointsB.resize(2*nbMatch);
+	for (int i=0; i<nbMatch; ++i)
+	{
+		const SiftGPU::SiftKeypoint& keyA = featureA.points[matches[mOrder[i]].first];
+		const SiftGPU::SiftKeypoint& keyB = featureB.points[matches[mOrder[i]].second];
+		mPointsA[2*i] = keyA.x; mPointsA[2*i+1] = keyA.y;
+		mPointsB[2*i] = keyB.x; mPointsB[2*i+1] = keyB.y;
+	}
+
+	double TA[9], TB[9];
+	normalizePoints(mPointsA, mNormalizedA, TA);
+	normalizePoints(mPointsB, mNormalizedB, TB);
+
+	//PROSAC: samples are drawn from the n best ranked matches, n grows with the iterations
+	//(Chum and Matas, Matching with PROSAC - progressive sample consensus, CVPR 2005)
+	mSeed = 1;
+	int nbBestInlier = 0;
+	double Tn = VERIFY_MAX_ITERATION;
+	for (int i=0; i<VERIFY_SAMPLE_SIZE; ++i)
+		Tn *= (double) (VERIFY_SAMPLE_SIZE-i) / (nbMatch-i);
+	int TnPrime = 1;
+	int n = VERIFY_SAMPLE_SIZE;
+	int nbIteration = VERIFY_MAX_ITERATION;
+
+	for (int t=1; t<=nbIteration; ++t)
+	{
+		if (t == TnPrime && n < nbMatch)
+		{
+			double TnNext = Tn*(n+1) / (n+1-VERIFY_SAMPLE_SIZE);
+			TnPrime += (int) ceil(TnNext - Tn);
+			Tn = TnNext;
+			n++;
+		}
+
+		int sample[VERIFY_SAMPLE_SIZE];
+		drawSample(n, TnPrime >= t, sample);
+
+		double solutions[27];
+		int nbSolution = computeFundamental7(&mNormalizedA[0], &mNormalizedB[0], sample, solutions);
+		for (int i=0; i<nbSolution; ++i)
+		{
+			double F[9];
+			denormalize(solutions + i*9, TA, TB, F);
+			int nbInlier = findInliers(F, mInliers);
+			if (nbInlier > nbBestInlier)
+			{
+				nbBestInlier = nbInlier;
+				mBestInliers.swap(mInliers);
+
+				//early termination: iterations needed to draw an all-inlier sample with the given confidence
+				double ratio = (double) nbBestInlier / nbMatch;
+				double outlierSample = 1.0 - pow(ratio, VERIFY_SAMPLE_SIZE);
+				if (outlierSample <= 0.0)
+					nbIteration = t;
+				else
+					nbIteration = std::min(nbIteration, (int) ceil(log(1.0-VERIFY_CONFIDENCE) / log(outlierSample)));
+			}
+		}
+	}
+
+	//least squares refit on the inliers
+	double Fn[9];
+	if (nbBestInlier >= 8 && computeFundamental8(mNormalizedA, mNormalizedB, mBestInliers, Fn))
+	{
+		double F[9];
+		denormalize(Fn, TA, TB, F);
+		int nbInlier = findInliers(F, mInliers);
+		if (nbInlier >= nbBestInlier)
+		{
+			nbBestInlier = nbInlier;
+			mBestInliers.swap(mInliers);
+		}
+	}
+
+	if (nbBestInlier < mMinInlier)
+	{
+		matches.clear();
+		return 0;
+	}
+
+	//inliers in the original match order
+	std::vector<unsigned char> keep(nbMatch, 0);
+	for (int i=0; i<nbMatch; ++i)
+		keep[mOrder[i]] = mBestInliers[i];
+
+	std::vector<Match> inlierMatches;
+	inlierMatches.reserve(nbBestInlier);
+	for (int i=0; i<nbMatch; ++i)
+		if (keep[i])
+			inlierMatches.push_back(matches[i]);
+	matches.swap(inlierMatches);
+
+	return (int) matches.size();
+}
@@ -0,0 +1,173 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include "ImageDecoder.h"
+#include "Threading.h"
+#include "JpegUtils.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include <IL/il.h>
+
+static Mutex sDevILMutex;
+
+static bool isJpeg(const std::string& filename)
+{
+	std::string extension = filename.substr(filename.find_last_of('.')+1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+	return extension == "jpg" || extension == "jpeg";
+}
+
+static bool decodeLuminance(const std::string& filename, int& width, int& height, std::vector<unsigned char>& pixels)
+{
+	if (isJpeg(filename))
+	{
+		//decode in color and use the same luminance weights as DevIL IL_LUMINANCE (Rec.709, truncated)
+		//libjpeg JCS_GRAYSCALE would use the Rec.601 weights and change the extracted features
+		Jpeg::Image img;
+		if (Jpeg::load(filename, img) && (img.nbComponent == 1 || img.nbComponent == 3))
+		{
+			width  = img.width;
+			height = img.height;
+			if (img.nbComponent == 1)
+			{
+				pixels.assign(img.buffer, img.buffer + img.getBufferSize());
+			}
+			else
+			{
+				size_t nbPixel = (size_t) width*height;
+				pixels.resize(nbPixel);
+				const unsigned char* rgb = img.buffer;
+				for (size_t i=0; i<nbPixel; ++i, rgb+=3)
+					pixels[i] = (unsigned char) ((212*rgb[0] + 715*rgb[1] + 72*rgb[2]) / 1000);
+			}
+			delete[] img.buffer;
+			return true;
+		}
+		delete[] img.buffer;
+		//fall back on DevIL
+	}
+
+	ScopedLock lock(sDevILMutex);
+
+	std::string tmp = filename;
+	char* path = &tmp[0];
+	bool loaded = false;
+
+	unsigned int imgId = 0;
+	ilGenImages(1, &imgId);
+	ilBindImage(imgId);
+
+	if (ilLoadImage(path))
+	{
+		width  = ilGetInteger(IL_IMAGE_WIDTH);
+		height = ilGetInteger(IL_IMAGE_HEIGHT);
+		pixels.resize((size_t) width*height);
+		ilCopyPixels(0, 0, 0, width, height, 1, IL_LUMINANCE, IL_UNSIGNED_BYTE, &pixels[0]);
+		loaded = true;
+	}
+
+	ilDeleteImages(1, &imgId);
+
+	return loaded;
+}
+
+bool decodeImageTiles(const std::string& filename, int tileNum, float tilePercent, DecodedImage& image)
+{
+	std::vector<unsigned char> pixels;
+	int w = 0;
+	int h = 0;
+
+	image.loaded = decodeLuminance(filename, w, h, pixels);
+	image.width  = w;
+	image.height = h;
+
+	if (!image.loaded || w <= 0 || h <= 0)
+		return false;
+
+	int wtile = std::max(w/tileNum, 1);
+	int htile = std::max(h/tileNum, 1);
+
+	for(int woff = 0; woff < w; woff+=wtile)
+	{
+		for(int hoff = 0; hoff < h; hoff+=htile)
+		{
+			//If the image is too large copy subset of images to CPU RAM and call RunSIFT
+			//in a loop which does not choke the Graphics RAM
+			ImageTile tile;
+			tile.x      = woff;
+			tile.y      = hoff;
+			tile.width  = std::min((int)(w-woff),(int)(wtile*tilePercent));
+			tile.height = std::min((int)(h-hoff),(int)(htile*tilePercent));
+			if (tile.width <= 0 || tile.height <= 0)
+				continue;
+			image.tiles.push_back(tile);
+
+			ImageTile& current = image.tiles.back();
+			if (current.width == w && current.height == h)
+			{
+				current.pixels.swap(pixels);
+			}
+			else
+			{
+				current.pixels.resize((size_t) current.width*current.height);
+				for (int y=0; y<current.height; ++y)
+					memcpy(&current.pixels[(size_t) y*current.width], &pixels[(size_t) (hoff+y)*w+woff], current.width);
+			}
+		}
+	}
+
+	return true;
+}
+
+bool readImageDimension(const std::string& filename, int& width, int& height)
+{
+	//jpeg header is enough, other formats need a full DevIL load
+	if (isJpeg(filename) && Jpeg::getDimension(filename, width, height))
+		return true;
+
+	ScopedLock lock(sDevILMutex);
+
+	std::string tmp = filename;
+	char* path = &tmp[0];
+	bool loaded = false;
+
+	width  = 0;
+	height = 0;
+
+	unsigned int imgId = 0;
+	ilGenImages(1, &imgId);
+	ilBindImage(imgId);
+
+	if (ilLoadImage(path))
+	{
+		width  = ilGetInteger(IL_IMAGE_WIDTH);
+		height = ilGetInteger(IL_IMAGE_HEIGHT);
+		loaded = true;
+	}
+
+	ilDeleteImages(1, &imgId);
+
+	return loaded;
+}
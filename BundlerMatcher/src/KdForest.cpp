@@ -0,0 +1,257 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include "KdForest.h"
+#include "FeatureInfo.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits.h>
+
+#include <emmintrin.h>
+
+//descriptors per leaf
+#define KD_LEAF_SIZE 4
+//descriptors sampled to compute the variance of a node
+#define KD_VARIANCE_SAMPLE 128
+//the split dimension is picked randomly among the dimensions of highest variance
+#define KD_RANDOM_DIMENSION 5
+
+static inline int squaredDistance(const unsigned char* a, const unsigned char* b)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sum = _mm_setzero_si128();
+
+	for (int k=0; k<128; k+=16)
+	{
+		__m128i va = _mm_loadu_si128((const __m128i*) (a+k));
+		__m128i vb = _mm_loadu_si128((const __m128i*) (b+k));
+		__m128i difference = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va)); //|a-b|
+		__m128i low  = _mm_unpacklo_epi8(difference, zero);
+		__m128i high = _mm_unpackhi_epi8(difference, zero);
+		sum = _mm_add_epi32(sum, _mm_madd_epi16(low, low));
+		sum = _mm_add_epi32(sum, _mm_madd_epi16(high, high));
+	}
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+	return _mm_cvtsi128_si32(sum);
+}
+
+//descriptor indices whose value on one dimension is below a threshold
+class BelowSplit
+{
+	public:
+		BelowSplit(const unsigned char* descriptors, int dimension, int split) : mDescriptors(descriptors), mDimension(dimension), mSplit(split) {}
+
+		bool operator()(int index) const
+		{
+			return mDescriptors[(size_t) index*128+mDimension] < mSplit;
+		}
+
+	protected:
+		const unsigned char* mDescriptors;
+		int                  mDimension;
+		int                  mSplit;
+};
+
+KdForest::KdForest()
+{
+	mDescriptors  = NULL;
+	mNbDescriptor = 0;
+	mSeed         = 1;
+}
+
+void KdForest::build(const float* descriptors, int nbDescriptor, int nbTree)
+{
+	mQuantizedDescriptors.resize((size_t) nbDescriptor*128);
+	for (size_t i=0; i<mQuantizedDescriptors.size(); ++i)
+		mQuantizedDescriptors[i] = quantizeDescriptor(descriptors[i]);
+
+	build(mQuantizedDescriptors.empty() ? NULL : &mQuantizedDescriptors[0], nbDescriptor, nbTree);
+}
+
+void KdForest::build(const unsigned char* descriptors, int nbDescriptor, int nbTree)
+{
+	mDescriptors  = descriptors;
+	mNbDescriptor = nbDescriptor;
+	mSeed         = 1;
+	mNodes.clear();
+	mRoots.clear();
+	mIndices.clear();
+
+	if (nbDescriptor <= 0)
+		return;
+
+	mIndices.resize((size_t) nbDescriptor*nbTree);
+	for (int i=0; i<nbTree; ++i)
+	{
+		int begin = nbDescriptor*i;
+		for (int j=0; j<nbDescriptor; ++j)
+			mIndices[begin+j] = j;
+
+		Node root = {-1, 0, 0, 0};
+		mRoots.push_back((int) mNodes.size());
+		mNodes.push_back(root);
+		buildNode(mRoots.back(), begin, begin+nbDescriptor);
+	}
+}
+
+size_t KdForest::getMemorySize() const
+{
+	return mQuantizedDescriptors.capacity() + mNodes.capacity()*sizeof(Node) + (mRoots.capacity()+mIndices.capacity())*sizeof(int);
+}
+
+int KdForest::chooseDimension(int begin, int end, int& split)
+{
+	//mean and variance of each dimension on a sample of the node
+	int step = std::max((end-begin)/KD_VARIANCE_SAMPLE, 1);
+	int nbSample = 0;
+	double sums[128]    = {0};
+	double squares[128] = {0};
+	for (int i=begin; i<end; i+=step)
+	{
+		const unsigned char* descriptor = getDescriptor(mIndices[i]);
+		for (int k=0; k<128; ++k)
+		{
+			sums[k]    += descriptor[k];
+			squares[k] += descriptor[k]*descriptor[k];
+		}
+		nbSample++;
+	}
+
+	std::pair<double, int> variances[128];
+	for (int k=0; k<128; ++k)
+	{
+		double mean = sums[k] / nbSample;
+		variances[k] = std::make_pair(squares[k]/nbSample - mean*mean, k);
+	}
+	std::partial_sort(variances, variances+KD_RANDOM_DIMENSION, variances+128, std::greater<std::pair<double, int> >());
+
+	mSeed = mSeed*1103515245 + 12345;
+	int dimension = variances[(mSeed >> 8) % KD_RANDOM_DIMENSION].second;
+	split = (int) (sums[dimension]/nbSample + 0.5);
+
+	return dimension;
+}
+
+void KdForest::buildNode(int nodeIndex, int begin, int end)
+{
+	if (end-begin <= KD_LEAF_SIZE)
+	{
+		Node leaf = {-1, 0, begin, end};
+		mNodes[nodeIndex] = leaf;
+		return;
+	}
+
+	int split;
+	int dimension = chooseDimension(begin, end, split);
+
+	//descriptors below the mean go to the first child, a constant sampled dimension splits in the middle
+	int* indices = &mIndices[0];
+	int middle = (int) (std::partition(indices+begin, indices+end, BelowSplit(mDescriptors, dimension, split)) - indices);
+	if (middle == begin || middle == end)
+		middle = (begin+end)/2;
+
+	int firstChild = (int) mNodes.size();
+	Node node = {dimension, split, firstChild, 0};
+	mNodes[nodeIndex] = node;
+
+	Node child = {-1, 0, 0, 0};
+	mNodes.push_back(child);
+	mNodes.push_back(child);
+	buildNode(firstChild,   begin,  middle);
+	buildNode(firstChild+1, middle, end);
+}
+
+void KdForest::findNearest(const unsigned char* query, int nbCheck, int& best, int& second, SearchBuffer& buffer) const
+{
+	best   = -1;
+	second = -1;
+	int bestDistance   = INT_MAX;
+	int secondDistance = INT_MAX;
+	int nbChecked      = 0;
+
+	//a new stamp marks every descriptor as not checked (the stamps are cleared when it wraps)
+	std::vector<unsigned int>& visited = buffer.mVisited;
+	if (visited.size() != (size_t) mNbDescriptor || ++buffer.mStamp == 0)
+	{
+		visited.assign(mNbDescriptor, 0);
+		buffer.mStamp = 1;
+	}
+	unsigned int stamp = buffer.mStamp;
+
+	std::vector<Branch>& branches = buffer.mBranches;
+	branches.clear();
+	for (unsigned int i=0; i<mRoots.size(); ++i)
+		branches.push_back(Branch(mRoots[i], 0));
+
+	while (!branches.empty() && nbChecked < nbCheck)
+	{
+		std::pop_heap(branches.begin(), branches.end());
+		Branch branch = branches.back();
+		branches.pop_back();
+
+		//no descriptor of this branch can be closer than the second best one
+		if (branch.distance >= secondDistance)
+			continue;
+
+		//descend to the nearest leaf, the other side of each split is queued
+		int nodeIndex = branch.node;
+		while (mNodes[nodeIndex].dimension >= 0)
+		{
+			const Node& node = mNodes[nodeIndex];
+			int difference = query[node.dimension] - node.split;
+			int nearChild  = (difference < 0 ? node.first : node.first+1);
+			int farChild   = (difference < 0 ? node.first+1 : node.first);
+
+			branches.push_back(Branch(farChild, branch.distance + difference*difference));
+			std::push_heap(branches.begin(), branches.end());
+			nodeIndex = nearChild;
+		}
+
+		//descriptors are in each tree: the ones already checked are skipped
+		const Node& leaf = mNodes[nodeIndex];
+		for (int i=leaf.first; i<leaf.last; ++i)
+		{
+			int index = mIndices[i];
+			if (visited[index] == stamp)
+				continue;
+			visited[index] = stamp;
+
+			int distance = squaredDistance(query, getDescriptor(index));
+			nbChecked++;
+			if (distance < bestDistance)
+			{
+				second         = best;
+				secondDistance = bestDistance;
+				best           = index;
+				bestDistance   = distance;
+			}
+			else if (distance < secondDistance)
+			{
+				second         = index;
+				secondDistance = distance;
+			}
+		}
+	}
+}
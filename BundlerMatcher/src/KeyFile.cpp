@@ -0,0 +1,353 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include "KeyFile.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <algorithm>
+
+//largest text needed by one key-point (4 floats + 128 descriptors), huge values excepted
+#define KEY_ASCII_SIZE 1024
+
+//smallest text needed by one key-point: 132 one-digit values, each preceded by a separator
+#define KEY_ASCII_MIN_SIZE 264
+
+static inline char* formatUnsigned(char* out, unsigned int value)
+{
+	char digits[10];
+	int nbDigit = 0;
+	do
+	{
+		digits[nbDigit++] = (char) ('0' + value%10);
+		value /= 10;
+	}
+	while (value);
+
+	while (nbDigit)
+		*out++ = digits[--nbDigit];
+
+	return out;
+}
+
+//Same text as std::fixed << std::setprecision(decimals) for decimals 2 or 3
+static char* formatFixed(char* out, float value, int decimals)
+{
+	unsigned int scale = (decimals == 2 ? 100 : 1000);
+
+	//exact: a float mantissa (24 bits) times 1000 fits in a double
+	double scaled   = fabs((double) value)*scale;
+	double integral = floor(scaled);
+	double fraction = scaled - integral;
+
+	//let the CRT handle exact ties (rounding differs between CRTs), signed zeros, huge values and NaN
+	if (!(scaled < 4.0e9) || fraction == 0.5 || value == 0.0f)
+		return out + sprintf(out, "%.*f", decimals, value);
+
+	unsigned int fixed = (unsigned int) integral + (fraction > 0.5 ? 1 : 0);
+
+	if (value < 0)
+		*out++ = '-';
+	out = formatUnsigned(out, fixed/scale);
+	*out++ = '.';
+
+	unsigned int decimal = fixed%scale;
+	for (unsigned int digit = scale/10; digit > 0; digit /= 10)
+	{
+		*out++ = (char) ('0' + decimal/digit);
+		decimal %= digit;
+	}
+
+	return out;
+}
+
+void formatAsciiKeyFile(const FeatureInfo& info, std::vector<char>& buffer)
+{
+	unsigned int nbFeature = (unsigned int) info.points.size();
+	unsigned int index = 0;
+
+	buffer.resize((nbFeature+1)*KEY_ASCII_SIZE);
+	char* out = &buffer[0];
+
+	out = formatUnsigned(out, nbFeature);
+	memcpy(out, " 128\n", 5);
+	out += 5;
+
+	for (unsigned int i=0; i<nbFeature; ++i)
+	{
+		//sprintf fallback of huge coordinates may need more than KEY_ASCII_SIZE
+		size_t used = out - &buffer[0];
+		if (buffer.size() - used < 2*KEY_ASCII_SIZE)
+		{
+			buffer.resize(buffer.size() + (nbFeature-i+1)*KEY_ASCII_SIZE);
+			out = &buffer[0] + used;
+		}
+
+		//in y, x, scale, orientation order
+		const SiftGPU::SiftKeypoint& point = info.points[i];
+		out = formatFixed(out, point.y, 2);
+		*out++ = ' ';
+		out = formatFixed(out, point.x, 2);
+		*out++ = ' ';
+		out = formatFixed(out, point.s, 3);
+		*out++ = ' ';
+		out = formatFixed(out, point.o, 3);
+		*out++ = '\n';
+
+		for (int k=0; k<128; ++k, ++index)
+		{
+			out = formatUnsigned(out, info.getQuantizedDescriptor(index));
+			*out++ = ' ';
+
+			if ((k+1)%20 == 0)
+				*out++ = '\n';
+		}
+		*out++ = '\n';
+	}
+
+	buffer.resize(out - &buffer[0]);
+}
+
+static void fillSiftFile(const FeatureInfo& info, SiftFile::Writer& writer)
+{
+	unsigned int nbFeature = (unsigned int) info.points.size();
+	bool compact = !info.compactDescriptors.empty();
+
+	float* x           = writer.getX();
+	float* y           = writer.getY();
+	float* scale       = writer.getScale();
+	float* orientation = writer.getOrientation();
+
+	for (unsigned int i=0; i<nbFeature; ++i)
+	{
+		x[i]           = info.points[i].x;
+		y[i]           = info.points[i].y;
+		scale[i]       = info.points[i].s;
+		orientation[i] = info.points[i].o;
+
+		if (compact)
+			memcpy(writer.getUcharDescriptor(i), &info.compactDescriptors[i*128], 128);
+		else
+			memcpy(writer.getFloatDescriptor(i), &info.descriptors[i*128], 128*sizeof(float));
+	}
+}
+
+static int readSiftFile(const SiftFile::Reader& reader, FeatureInfo& info, bool compactDescriptors)
+{
+	unsigned int nbFeature = reader.getFeatureCount();
+	const float* x           = reader.getX();
+	const float* y           = reader.getY();
+	const float* scale       = reader.getScale();
+	const float* orientation = reader.getOrientation();
+
+	info.width  = reader.getWidth();
+	info.height = reader.getHeight();
+	info.points.resize(nbFeature);
+	if (compactDescriptors)
+		info.compactDescriptors.resize(128*nbFeature);
+	else
+		info.descriptors.resize(128*nbFeature);
+
+	for (unsigned int i=0; i<nbFeature; ++i)
+	{
+		info.points[i].x = x[i];
+		info.points[i].y = y[i];
+		info.points[i].s = scale[i];
+		info.points[i].o = orientation[i];
+
+		if (compactDescriptors)
+			reader.getQuantizedDescriptor(i, &info.compactDescriptors[i*128]);
+		else
+			reader.getDescriptor(i, &info.descriptors[i*128]);
+	}
+
+	return (int) nbFeature;
+}
+
+static inline SiftFile::DescriptorType getDescriptorType(const FeatureInfo& info)
+{
+	return info.compactDescriptors.empty() ? SiftFile::DESCRIPTOR_FLOAT : SiftFile::DESCRIPTOR_UCHAR;
+}
+
+bool writeSiftFile(const std::string& filename, const FeatureInfo& info)
+{
+	SiftFile::Writer writer((unsigned int) info.points.size(), getDescriptorType(info), info.width, info.height);
+	fillSiftFile(info, writer);
+
+	return writer.save(filename);
+}
+
+bool writeSiftFile(SiftFile::Database& database, const std::string& name, const FeatureInfo& info)
+{
+	SiftFile::Writer writer((unsigned int) info.points.size(), getDescriptorType(info), info.width, info.height);
+	fillSiftFile(info, writer);
+
+	return database.append(name, writer);
+}
+
+int readSiftFile(const std::string& filename, FeatureInfo& info, bool compactDescriptors)
+{
+	SiftFile::Reader reader;
+	if (!reader.open(filename))
+		return -1;
+
+	return readSiftFile(reader, info, compactDescriptors);
+}
+
+int readSiftFile(const SiftFile::Database& database, const std::string& name, FeatureInfo& info, bool compactDescriptors)
+{
+	SiftFile::Reader reader;
+	if (!database.read(name, reader))
+		return -1;
+
+	return readSiftFile(reader, info, compactDescriptors);
+}
+
+static inline bool isSpace(char c)
+{
+	return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static inline bool isDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline void skipSpaces(const char*& cursor, const char* end)
+{
+	while (cursor < end && isSpace(*cursor))
+		++cursor;
+}
+
+static bool parseUnsigned(const char*& cursor, const char* end, unsigned int& value)
+{
+	skipSpaces(cursor, end);
+	if (cursor == end || !isDigit(*cursor))
+		return false;
+
+	value = 0;
+	while (cursor < end && isDigit(*cursor))
+		value = value*10 + (*cursor++ - '0');
+
+	return true;
+}
+
+static bool parseFloat(const char*& cursor, const char* end, float& value)
+{
+	skipSpaces(cursor, end);
+	const char* begin = cursor;
+
+	//fast path: [-]digits[.digits] with at most 18 significant digits, exact division by a power of 10
+	static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18};
+	bool negative = (cursor < end && *cursor == '-');
+	if (negative)
+		++cursor;
+
+	unsigned long long mantissa = 0;
+	int nbDigit = 0;
+	int nbDecimal = 0;
+	while (cursor < end && isDigit(*cursor))
+	{
+		mantissa = mantissa*10 + (*cursor++ - '0');
+		++nbDigit;
+	}
+	if (cursor < end && *cursor == '.')
+	{
+		++cursor;
+		while (cursor < end && isDigit(*cursor))
+		{
+			mantissa = mantissa*10 + (*cursor++ - '0');
+			++nbDigit;
+			++nbDecimal;
+		}
+	}
+
+	if (nbDigit > 0 && nbDigit <= 18 && (cursor == end || isSpace(*cursor)))
+	{
+		double result = (double) mantissa / powers[nbDecimal];
+		value = (float) (negative ? -result : result);
+		return true;
+	}
+
+	//exponents, long numbers, inf/nan: strtod on a null-terminated copy of the token
+	cursor = begin;
+	while (cursor < end && !isSpace(*cursor))
+		++cursor;
+
+	char token[64];
+	size_t length = std::min((size_t) (cursor - begin), sizeof(token)-1);
+	memcpy(token, begin, length);
+	token[length] = 0;
+
+	char* parsed = NULL;
+	value = (float) strtod(token, &parsed);
+
+	return length > 0 && parsed == token + length;
+}
+
+int parseAsciiKeyFile(const char* data, size_t size, FeatureInfo& info, bool compactDescriptors)
+{
+	const char* cursor = data;
+	const char* end    = data + size;
+
+	unsigned int num = 0;
+	unsigned int descCount = 0;
+	if (!parseUnsigned(cursor, end, num) || !parseUnsigned(cursor, end, descCount) || descCount != 128)
+		return -1;
+
+	//a count the remaining text can not hold would overflow the buffers
+	if (num > (size_t) (end - cursor) / KEY_ASCII_MIN_SIZE || num > INT_MAX)
+		return -1;
+
+	info.points.resize(num);
+	if (compactDescriptors)
+		info.compactDescriptors.resize((size_t) num*128);
+	else
+		info.descriptors.resize((size_t) num*128);
+
+	size_t index = 0;
+	for (unsigned int i=0; i<num; ++i)
+	{
+		//in y, x, scale, orientation order
+		SiftGPU::SiftKeypoint& point = info.points[i];
+		if (!parseFloat(cursor, end, point.y) || !parseFloat(cursor, end, point.x) ||
+			!parseFloat(cursor, end, point.s) || !parseFloat(cursor, end, point.o))
+			return -1;
+
+		unsigned int feature;
+		for (int k=0; k<128; ++k, ++index)
+		{
+			if (!parseUnsigned(cursor, end, feature))
+				return -1;
+
+			if (compactDescriptors)
+				info.compactDescriptors[index] = (unsigned char) std::min(feature, 255u);
+			else
+				info.descriptors[index] = ((float)feature)/512.0f;
+		}
+	}
+
+	return (int) num;
+}
@@ -0,0 +1,288 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include "NearestNeighbourKernel.h"
+
+#include <immintrin.h>
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
+//AVX2 intrinsics need Visual Studio 2012, AVX-512 intrinsics Visual Studio 2017
+//gcc compiles each kernel for its instruction set only (the rest of the project stays SSE2)
+#if defined(_MSC_VER)
+	#define KERNEL_AVX2_ENABLED   (_MSC_VER >= 1700)
+	#define KERNEL_AVX512_ENABLED (_MSC_VER >= 1911)
+	#define TARGET_AVX2
+	#define TARGET_AVX512
+#else
+	#define KERNEL_AVX2_ENABLED   1
+	#define KERNEL_AVX512_ENABLED 1
+	#define TARGET_AVX2   __attribute__((target("avx2")))
+	#define TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512bw")))
+#endif
+
+static inline int dotProductWide(const unsigned char* query, const short* train)
+{
+	int dot = 0;
+	for (int k=0; k<128; ++k)
+		dot += query[k]*train[k];
+
+	return dot;
+}
+
+#if !KERNEL_AVX2_ENABLED || !KERNEL_AVX512_ENABLED
+
+//portable version used when a kernel is not available with this compiler
+static void updateNearestWide(const unsigned char* queries, int begin, int end, const short* train, int blockBegin, int blockEnd,
+	NearestState* rows, NearestState* columns)
+{
+	for (int i=begin; i<end; ++i)
+	{
+		const unsigned char* query = queries + (size_t) i*128;
+		for (int j=blockBegin; j<blockEnd; ++j)
+		{
+			int dot = dotProductWide(query, train + (size_t) j*128);
+			rows[i-begin].update(dot, j);
+			columns[j].update(dot, i);
+		}
+	}
+}
+
+#endif
+
+void widenDescriptors(const unsigned char* descriptors, int nbDescriptor, short* output)
+{
+	for (size_t i=0; i<(size_t) nbDescriptor*128; ++i)
+		output[i] = descriptors[i];
+}
+
+NearestNeighbourKernel getNearestNeighbourKernel()
+{
+	bool avx2   = false;
+	bool avx512 = false;
+
+#if defined(_MSC_VER)
+	#if KERNEL_AVX2_ENABLED
+		//the operating system must save the ymm (and zmm) registers: xgetbv
+		int info[4];
+		__cpuid(info, 0);
+		int nbLeaf = info[0];
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1<<27)) != 0;
+		if (nbLeaf >= 7 && osxsave)
+		{
+			unsigned long long xcr0 = _xgetbv(0);
+			__cpuidex(info, 7, 0);
+			avx2   = (info[1] & (1<<5)) != 0 && (xcr0 & 0x6) == 0x6;
+			avx512 = avx2 && (info[1] & (1<<16)) != 0 && (info[1] & (1<<30)) != 0 && (xcr0 & 0xe6) == 0xe6;
+		}
+	#endif
+#else
+	__builtin_cpu_init();
+	avx2   = __builtin_cpu_supports("avx2") != 0;
+	avx512 = __builtin_cpu_supports("avx512f") != 0 && __builtin_cpu_supports("avx512bw") != 0;
+#endif
+
+	if (avx512 && KERNEL_AVX512_ENABLED)
+		return KERNEL_AVX512;
+	if (avx2 && KERNEL_AVX2_ENABLED)
+		return KERNEL_AVX2;
+	return KERNEL_SSE2;
+}
+
+const char* getKernelName(NearestNeighbourKernel kernel)
+{
+	switch (kernel)
+	{
+		case KERNEL_AVX512: return "AVX-512";
+		case KERNEL_AVX2:   return "AVX2";
+		default:            return "SSE2";
+	}
+}
+
+//
+// S S E 2
+//
+
+void updateNearestSSE2(const unsigned char* queries, int begin, int end, const unsigned char* train, int blockBegin, int blockEnd,
+	NearestState* rows, NearestState* columns)
+{
+	for (int i=begin; i<end; ++i)
+	{
+		const unsigned char* query = queries + (size_t) i*128;
+		NearestState& row = rows[i-begin];
+		for (int j=blockBegin; j<blockEnd; ++j)
+		{
+			int dot = dotProduct(query, train + (size_t) j*128);
+			row.update(dot, j);
+			columns[j].update(dot, i);
+		}
+	}
+}
+
+//update the row and the 4 columns of dots (most dot products do not beat any second best one)
+static inline void updateNearest4(__m128i dots, int i, int j, NearestState& row, NearestState* columns)
+{
+	__m128i seconds = _mm_set_epi32(columns[j+3].secondDot, columns[j+2].secondDot, columns[j+1].secondDot, columns[j].secondDot);
+	__m128i better  = _mm_or_si128(_mm_cmpgt_epi32(dots, _mm_set1_epi32(row.secondDot)), _mm_cmpgt_epi32(dots, seconds));
+	if (_mm_movemask_epi8(better) == 0)
+		return;
+
+	int values[4];
+	_mm_storeu_si128((__m128i*) values, dots);
+	for (int k=0; k<4; ++k)
+	{
+		row.update(values[k], j+k);
+		columns[j+k].update(values[k], i);
+	}
+}
+
+//
+// A V X 2
+//
+
+#if KERNEL_AVX2_ENABLED
+
+//4 dot products of 32-bit lanes (8 per accumulator) reduced to one register
+TARGET_AVX2
+static inline __m128i reduceDotProducts(__m256i acc0, __m256i acc1, __m256i acc2, __m256i acc3)
+{
+	__m256i sum = _mm256_hadd_epi32(_mm256_hadd_epi32(acc0, acc1), _mm256_hadd_epi32(acc2, acc3));
+	return _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+}
+
+TARGET_AVX2
+void updateNearestAVX2(const unsigned char* queries, int begin, int end, const short* train, int blockBegin, int blockEnd,
+	NearestState* rows, NearestState* columns)
+{
+	for (int i=begin; i<end; ++i)
+	{
+		//the query stays in 8 registers (16 bits per value)
+		const unsigned char* query = queries + (size_t) i*128;
+		__m256i q[8];
+		for (int k=0; k<8; ++k)
+			q[k] = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (query + k*16)));
+
+		NearestState& row = rows[i-begin];
+
+		//4 train descriptors per iteration
+		int j = blockBegin;
+		for (; j+4<=blockEnd; j+=4)
+		{
+			const short* t = train + (size_t) j*128;
+			__m256i acc0 = _mm256_setzero_si256();
+			__m256i acc1 = _mm256_setzero_si256();
+			__m256i acc2 = _mm256_setzero_si256();
+			__m256i acc3 = _mm256_setzero_si256();
+			for (int k=0; k<8; ++k)
+			{
+				acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(q[k], _mm256_loadu_si256((const __m256i*) (t + k*16))));
+				acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(q[k], _mm256_loadu_si256((const __m256i*) (t + 128 + k*16))));
+				acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(q[k], _mm256_loadu_si256((const __m256i*) (t + 256 + k*16))));
+				acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(q[k], _mm256_loadu_si256((const __m256i*) (t + 384 + k*16))));
+			}
+			updateNearest4(reduceDotProducts(acc0, acc1, acc2, acc3), i, j, row, columns);
+		}
+		for (; j<blockEnd; ++j)
+		{
+			int dot = dotProductWide(query, train + (size_t) j*128);
+			row.update(dot, j);
+			columns[j].update(dot, i);
+		}
+	}
+}
+
+#else
+
+void updateNearestAVX2(const unsigned char* queries, int begin, int end, const short* train, int blockBegin, int blockEnd,
+	NearestState* rows, NearestState* columns)
+{
+	updateNearestWide(queries, begin, end, train, blockBegin, blockEnd, rows, columns);
+}
+
+#endif
+
+//
+// A V X - 5 1 2
+//
+
+#if KERNEL_AVX512_ENABLED
+
+TARGET_AVX512
+static inline __m256i foldDotProducts(__m512i acc)
+{
+	return _mm256_add_epi32(_mm512_castsi512_si256(acc), _mm512_extracti64x4_epi64(acc, 1));
+}
+
+TARGET_AVX512
+void updateNearestAVX512(const unsigned char* queries, int begin, int end, const short* train, int blockBegin, int blockEnd,
+	NearestState* rows, NearestState* columns)
+{
+	for (int i=begin; i<end; ++i)
+	{
+		//the query stays in 4 registers (16 bits per value)
+		const unsigned char* query = queries + (size_t) i*128;
+		__m512i q[4];
+		for (int k=0; k<4; ++k)
+			q[k] = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*) (query + k*32)));
+
+		NearestState& row = rows[i-begin];
+
+		//4 train descriptors per iteration
+		int j = blockBegin;
+		for (; j+4<=blockEnd; j+=4)
+		{
+			const short* t = train + (size_t) j*128;
+			__m512i acc0 = _mm512_setzero_si512();
+			__m512i acc1 = _mm512_setzero_si512();
+			__m512i acc2 = _mm512_setzero_si512();
+			__m512i acc3 = _mm512_setzero_si512();
+			for (int k=0; k<4; ++k)
+			{
+				acc0 = _mm512_add_epi32(acc0, _mm512_madd_epi16(q[k], _mm512_loadu_si512((const void*) (t + k*32))));
+				acc1 = _mm512_add_epi32(acc1, _mm512_madd_epi16(q[k], _mm512_loadu_si512((const void*) (t + 128 + k*32))));
+				acc2 = _mm512_add_epi32(acc2, _mm512_madd_epi16(q[k], _mm512_loadu_si512((const void*) (t + 256 + k*32))));
+				acc3 = _mm512_add_epi32(acc3, _mm512_madd_epi16(q[k], _mm512_loadu_si512((const void*) (t + 384 + k*32))));
+			}
+			__m256i sum = _mm256_hadd_epi32(_mm256_hadd_epi32(foldDotProducts(acc0), foldDotProducts(acc1)),
+				_mm256_hadd_epi32(foldDotProducts(acc2), foldDotProducts(acc3)));
+			updateNearest4(_mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1)), i, j, row, columns);
+		}
+		for (; j<blockEnd; ++j)
+		{
+			int dot = dotProductWide(query, train + (size_t) j*128);
+			row.update(dot, j);
+			columns[j].update(dot, i);
+		}
+	}
+}
+
+#else
+
+void updateNearestAVX512(const unsigned char* queries, int begin, int end, const short* train, int blockBegin, int blockEnd,
+	NearestState* rows, NearestState* columns)
+{
+	updateNearestWide(queries, begin, end, train, blockBegin, blockEnd, rows, columns);
+}
+
+#endif
@@ -0,0 +1,173 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include "PairScheduler.h"
+
+#include <algorithm>
+
+PairScheduler::PairScheduler(int nbWorker)
+{
+	mNbWorker = (nbWorker > 0 ? nbWorker : 1);
+	mPairs    = NULL;
+	mWorker   = NULL;
+
+	for (int i=0; i<mNbWorker; ++i)
+		mRanges.push_back(new WorkRange);
+}
+
+PairScheduler::~PairScheduler()
+{
+	for (unsigned int i=0; i<mRanges.size(); ++i)
+		delete mRanges[i];
+}
+
+void PairScheduler::run(const Pairs& pairs, PairWorker& worker)
+{
+	mPairs  = &pairs;
+	mWorker = &worker;
+
+	//initial static partition, load balancing is done by stealing
+	int nbPair = (int) pairs.size();
+	for (int i=0; i<mNbWorker; ++i)
+	{
+		mRanges[i]->begin = (int) ((long long) nbPair*i/mNbWorker);
+		mRanges[i]->end   = (int) ((long long) nbPair*(i+1)/mNbWorker);
+	}
+
+	if (mNbWorker == 1)
+	{
+		work(0);
+	}
+	else
+	{
+		std::vector<WorkerThread*> threads;
+		for (int i=0; i<mNbWorker; ++i)
+		{
+			WorkerThread* thread = new WorkerThread(this, i);
+			threads.push_back(thread);
+			thread->start();
+		}
+
+		//a worker which failed to start has its range stolen by the others
+		for (unsigned int i=0; i<threads.size(); ++i)
+		{
+			threads[i]->join();
+			delete threads[i];
+		}
+
+		//in case no thread could be started at all
+		work(0);
+	}
+
+	mPairs  = NULL;
+	mWorker = NULL;
+}
+
+void PairScheduler::work(int workerIndex)
+{
+	int pairIndex;
+	while (popPair(workerIndex, pairIndex) || (stealPairs(workerIndex) && popPair(workerIndex, pairIndex)))
+		mWorker->processPair(workerIndex, (*mPairs)[pairIndex]);
+}
+
+bool PairScheduler::popPair(int workerIndex, int& pairIndex)
+{
+	WorkRange* range = mRanges[workerIndex];
+	ScopedLock lock(range->mutex);
+
+	if (range->begin >= range->end)
+		return false;
+
+	pairIndex = range->begin++;
+	return true;
+}
+
+bool PairScheduler::stealPairs(int workerIndex)
+{
+	while (true)
+	{
+		//find the victim with the largest remaining range
+		int victim = -1;
+		int victimSize = 0;
+		for (int i=1; i<mNbWorker; ++i)
+		{
+			int index = (workerIndex+i) % mNbWorker;
+			WorkRange* range = mRanges[index];
+			ScopedLock lock(range->mutex);
+			int size = range->end - range->begin;
+			if (size > victimSize)
+			{
+				victim = index;
+				victimSize = size;
+			}
+		}
+
+		if (victim == -1)
+			return false;
+
+		//take the second half of its range (the first half stays with the victim)
+		int begin, end;
+		{
+			WorkRange* range = mRanges[victim];
+			ScopedLock lock(range->mutex);
+			int size = range->end - range->begin;
+			if (size <= 0)
+				continue; //emptied meanwhile, look for another victim
+
+			end   = range->end;
+			begin = range->end - (size+1)/2;
+			range->end = begin;
+		}
+
+		WorkRange* own = mRanges[workerIndex];
+		ScopedLock lock(own->mutex);
+		own->begin = begin;
+		own->end   = end;
+		return true;
+	}
+}
+
+
+class BlockOrder
+{
+	public:
+		BlockOrder(int blockSize) : mBlockSize(blockSize) {}
+
+		bool operator()(const Match& a, const Match& b) const
+		{
+			unsigned int blockA1 = a.first/mBlockSize, blockA2 = a.second/mBlockSize;
+			unsigned int blockB1 = b.first/mBlockSize, blockB2 = b.second/mBlockSize;
+
+			if (blockA1 != blockB1) return blockA1 < blockB1;
+			if (blockA2 != blockB2) return blockA2 < blockB2;
+			if (a.first != b.first) return a.first < b.first;
+			return a.second < b.second;
+		}
+
+	protected:
+		unsigned int mBlockSize;
+};
+
+void sortPairsByBlock(Pairs& pairs, int blockSize)
+{
+	std::sort(pairs.begin(), pairs.end(), BlockOrder(std::max(blockSize, 1)));
+}
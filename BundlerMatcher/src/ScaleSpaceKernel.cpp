@@ -0,0 +1,319 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include "ScaleSpaceKernel.h"
+#include "NearestNeighbourKernel.h"
+
+#include <algorithm>
+#include <math.h>
+#include <immintrin.h>
+
+//AVX2 intrinsics need Visual Studio 2012
+//gcc compiles the AVX2 kernels for their instruction set only (the rest of the project stays SSE2)
+#if defined(_MSC_VER)
+	#define SCALE_SPACE_AVX2_ENABLED (_MSC_VER >= 1700)
+	#define TARGET_AVX2
+#else
+	#define SCALE_SPACE_AVX2_ENABLED 1
+	#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+ScaleSpaceKernel getScaleSpaceKernel()
+{
+	//same detection as the matching kernels (AVX-512 runs the AVX2 kernels)
+	if (SCALE_SPACE_AVX2_ENABLED && getNearestNeighbourKernel() != KERNEL_SSE2)
+		return SCALE_SPACE_AVX2;
+	return SCALE_SPACE_SSE2;
+}
+
+const char* getScaleSpaceKernelName(ScaleSpaceKernel kernel)
+{
+	switch (kernel)
+	{
+		case SCALE_SPACE_AVX2: return "AVX2";
+		default:               return "SSE2";
+	}
+}
+
+void createGaussianKernel(float sigma, std::vector<float>& coefficients)
+{
+	int radius = std::max((int) ceil(4.0f*sigma), 1);
+	coefficients.resize(radius+1);
+
+	float sum = 0.0f;
+	for (int k=0; k<=radius; ++k)
+	{
+		coefficients[k] = exp(-0.5f*k*k/(sigma*sigma));
+		sum += (k == 0 ? coefficients[k] : 2.0f*coefficients[k]);
+	}
+	for (int k=0; k<=radius; ++k)
+		coefficients[k] /= sum;
+}
+
+//scalar versions of the kernels, used for the last pixels of a row (same operation order)
+static inline float convolvePixel(const float* center, const float* coefficients, int radius)
+{
+	float sum = coefficients[0]*center[0];
+	for (int k=1; k<=radius; ++k)
+		sum += coefficients[k]*(center[-k] + center[k]);
+
+	return sum;
+}
+
+static inline float convolveColumn(const float* const* above, const float* const* below, int x, const float* coefficients, int radius)
+{
+	float sum = coefficients[0]*above[0][x];
+	for (int k=1; k<=radius; ++k)
+		sum += coefficients[k]*(above[k][x] + below[k][x]);
+
+	return sum;
+}
+
+static inline void padRow(const float* input, int width, int radius, float* padded)
+{
+	std::fill(padded, padded+radius, input[0]);
+	std::copy(input, input+width, padded+radius);
+	std::fill(padded+radius+width, padded+2*radius+width, input[width-1]);
+}
+
+//rows y-k and y+k for k = 0..radius (clamped to the image)
+static inline void getNeighbourRows(const float* input, int width, int height, int y, int radius, const float** above, const float** below)
+{
+	for (int k=0; k<=radius; ++k)
+	{
+		above[k] = input + (size_t) std::max(y-k, 0)*width;
+		below[k] = input + (size_t) std::min(y+k, height-1)*width;
+	}
+}
+
+//
+// S S E 2
+//
+
+void convolveRowsSSE2(const float* input, float* output, int width, int begin, int end, const float* coefficients, int radius, float* padded)
+{
+	for (int y=begin; y<end; ++y)
+	{
+		padRow(input + (size_t) y*width, width, radius, padded);
+		float* row = output + (size_t) y*width;
+
+		int x = 0;
+		for (; x+8<=width; x+=8)
+		{
+			const float* center = padded + x + radius;
+			__m128 c = _mm_set1_ps(coefficients[0]);
+			__m128 sum0 = _mm_mul_ps(c, _mm_loadu_ps(center));
+			__m128 sum1 = _mm_mul_ps(c, _mm_loadu_ps(center+4));
+			for (int k=1; k<=radius; ++k)
+			{
+				c = _mm_set1_ps(coefficients[k]);
+				sum0 = _mm_add_ps(sum0, _mm_mul_ps(c, _mm_add_ps(_mm_loadu_ps(center-k),   _mm_loadu_ps(center+k))));
+				sum1 = _mm_add_ps(sum1, _mm_mul_ps(c, _mm_add_ps(_mm_loadu_ps(center+4-k), _mm_loadu_ps(center+4+k))));
+			}
+			_mm_storeu_ps(row+x,   sum0);
+			_mm_storeu_ps(row+x+4, sum1);
+		}
+		for (; x<width; ++x)
+			row[x] = convolvePixel(padded + x + radius, coefficients, radius);
+	}
+}
+
+void convolveColumnsSSE2(const float* input, float* output, int width, int height, int begin, int end, const float* coefficients, int radius)
+{
+	std::vector<const float*> above(radius+1);
+	std::vector<const float*> below(radius+1);
+
+	for (int y=begin; y<end; ++y)
+	{
+		getNeighbourRows(input, width, height, y, radius, &above[0], &below[0]);
+		float* row = output + (size_t) y*width;
+
+		int x = 0;
+		for (; x+8<=width; x+=8)
+		{
+			__m128 c = _mm_set1_ps(coefficients[0]);
+			__m128 sum0 = _mm_mul_ps(c, _mm_loadu_ps(above[0]+x));
+			__m128 sum1 = _mm_mul_ps(c, _mm_loadu_ps(above[0]+x+4));
+			for (int k=1; k<=radius; ++k)
+			{
+				c = _mm_set1_ps(coefficients[k]);
+				sum0 = _mm_add_ps(sum0, _mm_mul_ps(c, _mm_add_ps(_mm_loadu_ps(above[k]+x),   _mm_loadu_ps(below[k]+x))));
+				sum1 = _mm_add_ps(sum1, _mm_mul_ps(c, _mm_add_ps(_mm_loadu_ps(above[k]+x+4), _mm_loadu_ps(below[k]+x+4))));
+			}
+			_mm_storeu_ps(row+x,   sum0);
+			_mm_storeu_ps(row+x+4, sum1);
+		}
+		for (; x<width; ++x)
+			row[x] = convolveColumn(&above[0], &below[0], x, coefficients, radius);
+	}
+}
+
+void subtractSSE2(const float* a, const float* b, float* output, size_t begin, size_t end)
+{
+	size_t i = begin;
+	for (; i+4<=end; i+=4)
+		_mm_storeu_ps(output+i, _mm_sub_ps(_mm_loadu_ps(b+i), _mm_loadu_ps(a+i)));
+	for (; i<end; ++i)
+		output[i] = b[i] - a[i];
+}
+
+void downsampleSSE2(const float* input, int width, float* output, int begin, int end)
+{
+	int outputWidth = width/2;
+	for (int y=begin; y<end; ++y)
+	{
+		const float* source = input + (size_t) 2*y*width;
+		float* row = output + (size_t) y*outputWidth;
+
+		int x = 0;
+		for (; x+4<=outputWidth; x+=4)
+		{
+			__m128 a = _mm_loadu_ps(source + 2*x);
+			__m128 b = _mm_loadu_ps(source + 2*x + 4);
+			_mm_storeu_ps(row+x, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		}
+		for (; x<outputWidth; ++x)
+			row[x] = source[2*x];
+	}
+}
+
+//
+// A V X 2
+//
+
+#if SCALE_SPACE_AVX2_ENABLED
+
+TARGET_AVX2
+void convolveRowsAVX2(const float* input, float* output, int width, int begin, int end, const float* coefficients, int radius, float* padded)
+{
+	for (int y=begin; y<end; ++y)
+	{
+		padRow(input + (size_t) y*width, width, radius, padded);
+		float* row = output + (size_t) y*width;
+
+		int x = 0;
+		for (; x+16<=width; x+=16)
+		{
+			const float* center = padded + x + radius;
+			__m256 c = _mm256_set1_ps(coefficients[0]);
+			__m256 sum0 = _mm256_mul_ps(c, _mm256_loadu_ps(center));
+			__m256 sum1 = _mm256_mul_ps(c, _mm256_loadu_ps(center+8));
+			for (int k=1; k<=radius; ++k)
+			{
+				c = _mm256_set1_ps(coefficients[k]);
+				sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(c, _mm256_add_ps(_mm256_loadu_ps(center-k),   _mm256_loadu_ps(center+k))));
+				sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(c, _mm256_add_ps(_mm256_loadu_ps(center+8-k), _mm256_loadu_ps(center+8+k))));
+			}
+			_mm256_storeu_ps(row+x,   sum0);
+			_mm256_storeu_ps(row+x+8, sum1);
+		}
+		for (; x<width; ++x)
+			row[x] = convolvePixel(padded + x + radius, coefficients, radius);
+	}
+}
+
+TARGET_AVX2
+void convolveColumnsAVX2(const float* input, float* output, int width, int height, int begin, int end, const float* coefficients, int radius)
+{
+	std::vector<const float*> above(radius+1);
+	std::vector<const float*> below(radius+1);
+
+	for (int y=begin; y<end; ++y)
+	{
+		getNeighbourRows(input, width, height, y, radius, &above[0], &below[0]);
+		float* row = output + (size_t) y*width;
+
+		int x = 0;
+		for (; x+16<=width; x+=16)
+		{
+			__m256 c = _mm256_set1_ps(coefficients[0]);
+			__m256 sum0 = _mm256_mul_ps(c, _mm256_loadu_ps(above[0]+x));
+			__m256 sum1 = _mm256_mul_ps(c, _mm256_loadu_ps(above[0]+x+8));
+			for (int k=1; k<=radius; ++k)
+			{
+				c = _mm256_set1_ps(coefficients[k]);
+				sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(c, _mm256_add_ps(_mm256_loadu_ps(above[k]+x),   _mm256_loadu_ps(below[k]+x))));
+				sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(c, _mm256_add_ps(_mm256_loadu_ps(above[k]+x+8), _mm256_loadu_ps(below[k]+x+8))));
+			}
+			_mm256_storeu_ps(row+x,   sum0);
+			_mm256_storeu_ps(row+x+8, sum1);
+		}
+		for (; x<width; ++x)
+			row[x] = convolveColumn(&above[0], &below[0], x, coefficients, radius);
+	}
+}
+
+TARGET_AVX2
+void subtractAVX2(const float* a, const float* b, float* output, size_t begin, size_t end)
+{
+	size_t i = begin;
+	for (; i+8<=end; i+=8)
+		_mm256_storeu_ps(output+i, _mm256_sub_ps(_mm256_loadu_ps(b+i), _mm256_loadu_ps(a+i)));
+	for (; i<end; ++i)
+		output[i] = b[i] - a[i];
+}
+
+TARGET_AVX2
+void downsampleAVX2(const float* input, int width, float* output, int begin, int end)
+{
+	int outputWidth = width/2;
+	for (int y=begin; y<end; ++y)
+	{
+		const float* source = input + (size_t) 2*y*width;
+		float* row = output + (size_t) y*outputWidth;
+
+		int x = 0;
+		for (; x+8<=outputWidth; x+=8)
+		{
+			//even floats of each 128 bit lane, then lanes reordered
+			__m256 even = _mm256_shuffle_ps(_mm256_loadu_ps(source + 2*x), _mm256_loadu_ps(source + 2*x + 8), _MM_SHUFFLE(2, 0, 2, 0));
+			_mm256_storeu_ps(row+x, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(even), _MM_SHUFFLE(3, 1, 2, 0))));
+		}
+		for (; x<outputWidth; ++x)
+			row[x] = source[2*x];
+	}
+}
+
+#else
+
+//Visual Studio 2010: the AVX2 kernels are never selected by getScaleSpaceKernel
+void convolveRowsAVX2(const float* input, float* output, int width, int begin, int end, const float* coefficients, int radius, float* padded)
+{
+	convolveRowsSSE2(input, output, width, begin, end, coefficients, radius, padded);
+}
+
+void convolveColumnsAVX2(const float* input, float* output, int width, int height, int begin, int end, const float* coefficients, int radius)
+{
+	convolveColumnsSSE2(input, output, width, height, begin, end, coefficients, radius);
+}
+
+void subtractAVX2(const float* a, const float* b, float* output, size_t begin, size_t end)
+{
+	subtractSSE2(a, b, output, begin, end);
+}
+
+void downsampleAVX2(const float* input, int width, float* output, int begin, int end)
+{
+	downsampleSSE2(input, width, output, begin, end);
+}
+
+#endif
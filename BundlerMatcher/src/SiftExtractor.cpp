@@ -0,0 +1,675 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include "SiftExtractor.h"
+#include "Threading.h"
+#include "ScaleSpaceKernel.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+#define GL_UNSIGNED_BYTE 0x1401
+
+#include <IL/il.h>
+
+//Scale space parameters (Lowe 2004, SiftGPU defaults)
+#define SIFT_LEVELS_PER_OCTAVE 3
+#define SIFT_SIGMA0            1.6f
+#define SIFT_INITIAL_SIGMA     0.5f  //blur of the input image
+#define SIFT_DOG_THRESHOLD     (0.02f/SIFT_LEVELS_PER_OCTAVE)
+#define SIFT_EDGE_THRESHOLD    10.0f
+#define SIFT_MIN_OCTAVE_SIZE   16
+#define SIFT_BORDER            5     //extrema are not searched closer to the border
+
+//Orientation and descriptor
+#define SIFT_ORIENTATION_BINS  36
+#define SIFT_ORIENTATION_PEAK  0.8f  //secondary orientations above 80% of the main one
+#define SIFT_MAX_ORIENTATION   2
+#define SIFT_DESCRIPTOR_WIDTH  4     //4x4 spatial bins
+#define SIFT_DESCRIPTOR_BINS   8     //8 orientations per spatial bin
+#define SIFT_DESCRIPTOR_CLAMP  0.2f
+
+#define SIFT_PI 3.14159265358979323846f
+
+SiftExtractor::~SiftExtractor()
+{}
+
+//
+// G P U     E X T R A C T O R
+//
+
+SiftExtractorGPU::SiftExtractorGPU(int firstOctave)
+{
+	char fo[10];
+	sprintf(fo, "%d", firstOctave);
+	char* args[] = {"-fo", fo};
+
+	mSift = new SiftGPU;
+	mSift->ParseParam(2, args);
+	mSift->SetVerbose(-2);
+
+	mIsInitialized = (mSift->CreateContextGL() == SiftGPU::SIFTGPU_FULL_SUPPORTED);
+	if (mIsInitialized)
+		mSift->AllocatePyramid(12800, 12800);
+}
+
+SiftExtractorGPU::~SiftExtractorGPU()
+{
+	delete mSift;
+	mSift = NULL;
+}
+
+int SiftExtractorGPU::extract(int width, int height, const unsigned char* pixels, SiftKeyPoints& keys, SiftKeyDescriptors& descriptors)
+{
+	if (!mSift->RunSIFT(width, height, pixels, IL_LUMINANCE, GL_UNSIGNED_BYTE))
+		return -1;
+
+	int num = mSift->GetFeatureNum();
+	keys.resize(num);
+	descriptors.resize(128*num);
+	if (num > 0)
+		mSift->GetFeatureVector(&keys[0], &descriptors[0]);
+
+	return num;
+}
+
+size_t SiftExtractorGPU::getMemoryUsage(int, int) const
+{
+	//the pyramid lives in the Graphics RAM
+	return 0;
+}
+
+//
+// C P U     E X T R A C T O R
+//
+
+struct ConvolutionJob
+{
+	ScaleSpaceKernel          kernel;
+	const SiftImage*          input;
+	SiftImage*                output;
+	const std::vector<float>* coefficients;
+};
+
+static void convolveRows(void* context, int, int begin, int end)
+{
+	const ConvolutionJob& job = *(const ConvolutionJob*) context;
+	int radius = (int) job.coefficients->size()-1;
+	std::vector<float> padded(job.input->width + 2*radius);
+
+	if (job.kernel == SCALE_SPACE_AVX2)
+		convolveRowsAVX2(&job.input->pixels[0], &job.output->pixels[0], job.input->width, begin, end, &(*job.coefficients)[0], radius, &padded[0]);
+	else
+		convolveRowsSSE2(&job.input->pixels[0], &job.output->pixels[0], job.input->width, begin, end, &(*job.coefficients)[0], radius, &padded[0]);
+}
+
+static void convolveColumns(void* context, int, int begin, int end)
+{
+	const ConvolutionJob& job = *(const ConvolutionJob*) context;
+	int radius = (int) job.coefficients->size()-1;
+
+	if (job.kernel == SCALE_SPACE_AVX2)
+		convolveColumnsAVX2(&job.input->pixels[0], &job.output->pixels[0], job.input->width, job.input->height, begin, end, &(*job.coefficients)[0], radius);
+	else
+		convolveColumnsSSE2(&job.input->pixels[0], &job.output->pixels[0], job.input->width, job.input->height, begin, end, &(*job.coefficients)[0], radius);
+}
+
+//separable Gaussian blur, temp receives the horizontal pass
+static void gaussianBlur(ScaleSpaceKernel kernel, const SiftImage& input, SiftImage& output, SiftImage& temp, float sigma, ThreadPool& pool)
+{
+	std::vector<float> coefficients;
+	createGaussianKernel(sigma, coefficients);
+	temp.resize(input.width, input.height);
+	output.resize(input.width, input.height);
+
+	ConvolutionJob rows = {kernel, &input, &temp, &coefficients};
+	pool.run(convolveRows, &rows, input.height);
+	ConvolutionJob columns = {kernel, &temp, &output, &coefficients};
+	pool.run(convolveColumns, &columns, input.height);
+}
+
+struct DifferenceJob
+{
+	ScaleSpaceKernel kernel;
+	const SiftImage* a;
+	const SiftImage* b;
+	SiftImage*       output;
+};
+
+//output = b - a
+static void subtractRows(void* context, int, int begin, int end)
+{
+	const DifferenceJob& job = *(const DifferenceJob*) context;
+	size_t first = (size_t) begin*job.a->width;
+	size_t last  = (size_t) end*job.a->width;
+
+	if (job.kernel == SCALE_SPACE_AVX2)
+		subtractAVX2(&job.a->pixels[0], &job.b->pixels[0], &job.output->pixels[0], first, last);
+	else
+		subtractSSE2(&job.a->pixels[0], &job.b->pixels[0], &job.output->pixels[0], first, last);
+}
+
+struct DownsampleJob
+{
+	ScaleSpaceKernel kernel;
+	const SiftImage* input;
+	SiftImage*       output;
+};
+
+static void downsampleRows(void* context, int, int begin, int end)
+{
+	const DownsampleJob& job = *(const DownsampleJob*) context;
+
+	if (job.kernel == SCALE_SPACE_AVX2)
+		downsampleAVX2(&job.input->pixels[0], job.input->width, &job.output->pixels[0], begin, end);
+	else
+		downsampleSSE2(&job.input->pixels[0], job.input->width, &job.output->pixels[0], begin, end);
+}
+
+struct DetectionJob
+{
+	const std::vector<SiftImage>*             dogs;
+	int                                       level;
+	std::vector<std::vector<SiftCandidate> >* outputs; //one per thread
+};
+
+static bool isExtremum(const std::vector<SiftImage>& dogs, int level, int x, int y)
+{
+	float value = dogs[level].getRow(y)[x];
+	bool isMaximum = value > 0.0f;
+	for (int l=level-1; l<=level+1; ++l)
+		for (int dy=-1; dy<=1; ++dy)
+		{
+			const float* row = dogs[l].getRow(y+dy);
+			for (int dx=-1; dx<=1; ++dx)
+			{
+				if (l == level && dx == 0 && dy == 0)
+					continue;
+				float neighbour = row[x+dx];
+				if (isMaximum ? neighbour >= value : neighbour <= value)
+					return false;
+			}
+		}
+
+	return true;
+}
+
+//sub-pixel position by fitting a quadratic to the DoG (at most 5 moves of one pixel),
+//rejected when it does not converge, when the contrast is low or the extremum lies on an edge
+static bool refineCandidate(const std::vector<SiftImage>& dogs, int level, int x, int y, SiftCandidate& candidate)
+{
+	int width  = dogs[level].width;
+	int height = dogs[level].height;
+
+	float value = 0.0f;
+	float offset[3] = {0.0f, 0.0f, 0.0f};
+	float gradient[3] = {0.0f, 0.0f, 0.0f};
+	float dxx = 0.0f, dyy = 0.0f, dxy = 0.0f;
+	bool converged = false;
+	for (int iteration=0; iteration<5; ++iteration)
+	{
+		const float* previous[3] = {dogs[level-1].getRow(y-1), dogs[level-1].getRow(y), dogs[level-1].getRow(y+1)};
+		const float* current[3]  = {dogs[level].getRow(y-1),   dogs[level].getRow(y),   dogs[level].getRow(y+1)};
+		const float* next[3]     = {dogs[level+1].getRow(y-1), dogs[level+1].getRow(y), dogs[level+1].getRow(y+1)};
+
+		value = current[1][x];
+		gradient[0] = 0.5f*(current[1][x+1] - current[1][x-1]);
+		gradient[1] = 0.5f*(current[2][x] - current[0][x]);
+		gradient[2] = 0.5f*(next[1][x] - previous[1][x]);
+
+		dxx = current[1][x+1] + current[1][x-1] - 2.0f*value;
+		dyy = current[2][x] + current[0][x] - 2.0f*value;
+		float dss = next[1][x] + previous[1][x] - 2.0f*value;
+		dxy = 0.25f*(current[2][x+1] - current[2][x-1] - current[0][x+1] + current[0][x-1]);
+		float dxs = 0.25f*(next[1][x+1] - next[1][x-1] - previous[1][x+1] + previous[1][x-1]);
+		float dys = 0.25f*(next[2][x] - next[0][x] - previous[2][x] + previous[0][x]);
+
+		//Hessian * offset = -gradient (Cramer's rule)
+		float H[9] = {dxx, dxy, dxs, dxy, dyy, dys, dxs, dys, dss};
+		float det = H[0]*(H[4]*H[8]-H[5]*H[7]) - H[1]*(H[3]*H[8]-H[5]*H[6]) + H[2]*(H[3]*H[7]-H[4]*H[6]);
+		if (det == 0.0f)
+			return false;
+		for (int i=0; i<3; ++i)
+		{
+			float M[9];
+			std::copy(H, H+9, M);
+			for (int j=0; j<3; ++j)
+				M[j*3+i] = -gradient[j];
+			offset[i] = (M[0]*(M[4]*M[8]-M[5]*M[7]) - M[1]*(M[3]*M[8]-M[5]*M[6]) + M[2]*(M[3]*M[7]-M[4]*M[6])) / det;
+		}
+
+		int moveX = (offset[0] > 0.6f && x < width-SIFT_BORDER-1) ? 1 : (offset[0] < -0.6f && x > SIFT_BORDER) ? -1 : 0;
+		int moveY = (offset[1] > 0.6f && y < height-SIFT_BORDER-1) ? 1 : (offset[1] < -0.6f && y > SIFT_BORDER) ? -1 : 0;
+		if (moveX == 0 && moveY == 0)
+		{
+			converged = true;
+			break;
+		}
+		x += moveX;
+		y += moveY;
+	}
+	if (!converged)
+		return false;
+
+	if (fabs(offset[0]) > 1.5f || fabs(offset[1]) > 1.5f || fabs(offset[2]) > 1.5f)
+		return false;
+
+	float contrast = value + 0.5f*(gradient[0]*offset[0] + gradient[1]*offset[1] + gradient[2]*offset[2]);
+	if (fabs(contrast) < SIFT_DOG_THRESHOLD)
+		return false;
+
+	//ratio of the principal curvatures
+	float trace = dxx + dyy;
+	float det   = dxx*dyy - dxy*dxy;
+	if (det <= 0.0f || trace*trace*SIFT_EDGE_THRESHOLD >= (SIFT_EDGE_THRESHOLD+1.0f)*(SIFT_EDGE_THRESHOLD+1.0f)*det)
+		return false;
+
+	float scaleLevel = level + offset[2];
+	candidate.x     = x + offset[0];
+	candidate.y     = y + offset[1];
+	candidate.sigma = SIFT_SIGMA0 * pow(2.0f, scaleLevel/SIFT_LEVELS_PER_OCTAVE);
+	candidate.level = std::min(std::max((int) floor(scaleLevel + 0.5f), 0), SIFT_LEVELS_PER_OCTAVE+2);
+
+	return true;
+}
+
+static void detectRows(void* context, int threadIndex, int begin, int end)
+{
+	const DetectionJob& job = *(const DetectionJob*) context;
+	const std::vector<SiftImage>& dogs = *job.dogs;
+	std::vector<SiftCandidate>& output = (*job.outputs)[threadIndex];
+	int width  = dogs[job.level].width;
+	int height = dogs[job.level].height;
+
+	begin = std::max(begin, SIFT_BORDER);
+	end   = std::min(end, height-SIFT_BORDER);
+	for (int y=begin; y<end; ++y)
+	{
+		const float* row = dogs[job.level].getRow(y);
+		for (int x=SIFT_BORDER; x<width-SIFT_BORDER; ++x)
+		{
+			//most pixels are rejected by the contrast before the 26 comparisons
+			if (fabs(row[x]) < 0.8f*SIFT_DOG_THRESHOLD || !isExtremum(dogs, job.level, x, y))
+				continue;
+
+			SiftCandidate candidate;
+			if (refineCandidate(dogs, job.level, x, y, candidate))
+				output.push_back(candidate);
+		}
+	}
+}
+
+static inline void getGradient(const SiftImage& image, int x, int y, float& magnitude, float& angle)
+{
+	const float* row = image.getRow(y);
+	float gx = row[x+1] - row[x-1];
+	float gy = image.getRow(y+1)[x] - image.getRow(y-1)[x];
+	magnitude = sqrt(gx*gx + gy*gy);
+	angle = atan2(gy, gx);
+	if (angle < 0.0f)
+		angle += 2.0f*SIFT_PI;
+}
+
+//dominant gradient orientations around a candidate (histogram peaks above 80% of the maximum)
+static int computeOrientations(const SiftImage& image, const SiftCandidate& candidate, float* angles)
+{
+	float sigma  = 1.5f*candidate.sigma;
+	int   radius = (int) floor(3.0f*sigma + 0.5f);
+	int   cx = (int) floor(candidate.x + 0.5f);
+	int   cy = (int) floor(candidate.y + 0.5f);
+
+	float histogram[SIFT_ORIENTATION_BINS] = {0};
+	for (int y=std::max(cy-radius, 1); y<=std::min(cy+radius, image.height-2); ++y)
+		for (int x=std::max(cx-radius, 1); x<=std::min(cx+radius, image.width-2); ++x)
+		{
+			float dx = x - candidate.x;
+			float dy = y - candidate.y;
+			float r2 = dx*dx + dy*dy;
+			if (r2 > radius*radius + 0.5f)
+				continue;
+
+			float magnitude, angle;
+			getGradient(image, x, y, magnitude, angle);
+			int bin = (int) floor(SIFT_ORIENTATION_BINS*angle/(2.0f*SIFT_PI) + 0.5f) % SIFT_ORIENTATION_BINS;
+			histogram[bin] += magnitude * exp(-r2/(2.0f*sigma*sigma));
+		}
+
+	//circular box smoothing
+	for (int iteration=0; iteration<6; ++iteration)
+	{
+		float first    = histogram[0];
+		float previous = histogram[SIFT_ORIENTATION_BINS-1];
+		for (int i=0; i<SIFT_ORIENTATION_BINS; ++i)
+		{
+			float next = (i+1 < SIFT_ORIENTATION_BINS ? histogram[i+1] : first);
+			float current = histogram[i];
+			histogram[i] = (previous + current + next) / 3.0f;
+			previous = current;
+		}
+	}
+
+	float maximum = *std::max_element(histogram, histogram+SIFT_ORIENTATION_BINS);
+	std::vector<std::pair<float, float> > peaks;
+	for (int i=0; i<SIFT_ORIENTATION_BINS; ++i)
+	{
+		float left  = histogram[(i+SIFT_ORIENTATION_BINS-1) % SIFT_ORIENTATION_BINS];
+		float right = histogram[(i+1) % SIFT_ORIENTATION_BINS];
+		float value = histogram[i];
+		if (value <= left || value <= right || value < SIFT_ORIENTATION_PEAK*maximum)
+			continue;
+
+		//parabolic interpolation of the peak
+		float offset = 0.5f*(left - right) / (left - 2.0f*value + right);
+		float angle  = 2.0f*SIFT_PI*(i + offset)/SIFT_ORIENTATION_BINS;
+		if (angle < 0.0f)
+			angle += 2.0f*SIFT_PI;
+		peaks.push_back(std::make_pair(-value, angle));
+	}
+	std::sort(peaks.begin(), peaks.end());
+
+	int nbAngle = std::min((int) peaks.size(), SIFT_MAX_ORIENTATION);
+	for (int i=0; i<nbAngle; ++i)
+		angles[i] = peaks[i].second;
+
+	return nbAngle;
+}
+
+//4x4 histograms of 8 gradient orientations in the key-point frame, trilinear interpolation
+static void computeDescriptor(const SiftImage& image, const SiftCandidate& candidate, float angle, float* descriptor)
+{
+	const int   nbBin   = SIFT_DESCRIPTOR_WIDTH*SIFT_DESCRIPTOR_WIDTH*SIFT_DESCRIPTOR_BINS;
+	const float binSize = 3.0f*candidate.sigma;
+	const float halfWidth = 0.5f*SIFT_DESCRIPTOR_WIDTH;
+	int radius = (int) floor(sqrt(2.0f)*binSize*(SIFT_DESCRIPTOR_WIDTH+1)*0.5f + 0.5f);
+	int cx = (int) floor(candidate.x + 0.5f);
+	int cy = (int) floor(candidate.y + 0.5f);
+	float c = cos(angle);
+	float s = sin(angle);
+
+	std::fill(descriptor, descriptor+nbBin, 0.0f);
+	for (int y=std::max(cy-radius, 1); y<=std::min(cy+radius, image.height-2); ++y)
+		for (int x=std::max(cx-radius, 1); x<=std::min(cx+radius, image.width-2); ++x)
+		{
+			//position in bins, rotated in the key-point frame
+			float dx = x - candidate.x;
+			float dy = y - candidate.y;
+			float nx = ( c*dx + s*dy) / binSize;
+			float ny = (-s*dx + c*dy) / binSize;
+			float bx = nx + halfWidth - 0.5f;
+			float by = ny + halfWidth - 0.5f;
+			if (bx <= -1.0f || bx >= SIFT_DESCRIPTOR_WIDTH || by <= -1.0f || by >= SIFT_DESCRIPTOR_WIDTH)
+				continue;
+
+			float magnitude, gradientAngle;
+			getGradient(image, x, y, magnitude, gradientAngle);
+			float theta = gradientAngle - angle;
+			if (theta < 0.0f)
+				theta += 2.0f*SIFT_PI;
+			float bt = SIFT_DESCRIPTOR_BINS*theta/(2.0f*SIFT_PI);
+
+			float weight = magnitude * exp(-(nx*nx + ny*ny)/(2.0f*halfWidth*halfWidth));
+			int x0 = (int) floor(bx);
+			int y0 = (int) floor(by);
+			int t0 = (int) floor(bt);
+			float fx = bx - x0;
+			float fy = by - y0;
+			float ft = bt - t0;
+
+			for (int iy=0; iy<2; ++iy)
+			{
+				int yb = y0+iy;
+				if (yb < 0 || yb >= SIFT_DESCRIPTOR_WIDTH)
+					continue;
+				float wy = (iy ? fy : 1.0f-fy);
+				for (int ix=0; ix<2; ++ix)
+				{
+					int xb = x0+ix;
+					if (xb < 0 || xb >= SIFT_DESCRIPTOR_WIDTH)
+						continue;
+					float wxy = wy * (ix ? fx : 1.0f-fx);
+					float* bins = descriptor + (yb*SIFT_DESCRIPTOR_WIDTH + xb)*SIFT_DESCRIPTOR_BINS;
+					bins[t0 % SIFT_DESCRIPTOR_BINS]     += weight*wxy*(1.0f-ft);
+					bins[(t0+1) % SIFT_DESCRIPTOR_BINS] += weight*wxy*ft;
+				}
+			}
+		}
+
+	//normalized, clamped to reduce the influence of large gradients and normalized again
+	for (int pass=0; pass<2; ++pass)
+	{
+		float norm = 0.0f;
+		for (int i=0; i<nbBin; ++i)
+			norm += descriptor[i]*descriptor[i];
+		norm = sqrt(norm);
+		if (norm <= 0.0f)
+			return;
+		for (int i=0; i<nbBin; ++i)
+			descriptor[i] = (pass == 0 ? std::min(descriptor[i]/norm, SIFT_DESCRIPTOR_CLAMP) : descriptor[i]/norm);
+	}
+}
+
+struct DescriptorJob
+{
+	const std::vector<SiftCandidate>* candidates;
+	const std::vector<SiftImage>*     gaussians;
+	float                             scale;  //octave pixel size in input pixels
+	float                             offset; //input position of the octave pixel 0
+	std::vector<SiftKeyPoints>*       keys;   //one per thread
+	std::vector<SiftKeyDescriptors>*  descriptors;
+};
+
+static void describeCandidates(void* context, int threadIndex, int begin, int end)
+{
+	const DescriptorJob& job = *(const DescriptorJob*) context;
+	SiftKeyPoints& keys = (*job.keys)[threadIndex];
+	SiftKeyDescriptors& descriptors = (*job.descriptors)[threadIndex];
+
+	for (int i=begin; i<end; ++i)
+	{
+		const SiftCandidate& candidate = (*job.candidates)[i];
+		const SiftImage& image = (*job.gaussians)[candidate.level];
+
+		float angles[SIFT_MAX_ORIENTATION];
+		int nbAngle = computeOrientations(image, candidate, angles);
+		for (int a=0; a<nbAngle; ++a)
+		{
+			//SiftGPU conventions: pixel centers at +0.5, orientation in ]-pi, pi]
+			SiftGPU::SiftKeypoint key;
+			key.x = candidate.x*job.scale + job.offset + 0.5f;
+			key.y = candidate.y*job.scale + job.offset + 0.5f;
+			key.s = candidate.sigma*job.scale;
+			key.o = (angles[a] > SIFT_PI ? angles[a] - 2.0f*SIFT_PI : angles[a]);
+			keys.push_back(key);
+
+			size_t offset = descriptors.size();
+			descriptors.resize(offset + 128);
+			computeDescriptor(image, candidate, angles[a], &descriptors[offset]);
+		}
+	}
+}
+
+SiftExtractorCPU::SiftExtractorCPU(int firstOctave, int nbThread)
+: mPool(nbThread)
+{
+	mFirstOctave = firstOctave;
+	mNbThread    = mPool.getThreadCount();
+	mKernel      = getScaleSpaceKernel();
+}
+
+SiftExtractorCPU::~SiftExtractorCPU()
+{}
+
+int SiftExtractorCPU::extract(int width, int height, const unsigned char* pixels, SiftKeyPoints& keys, SiftKeyDescriptors& descriptors)
+{
+	keys.clear();
+	descriptors.clear();
+	if (width <= 0 || height <= 0 || !pixels)
+		return -1;
+
+	createScaleSpace(width, height, pixels);
+
+	float scale  = pow(2.0f, (float) mFirstOctave);
+	float offset = mBaseOffset;
+	while (hasOctave())
+	{
+		buildOctave();
+
+		std::vector<SiftCandidate> candidates;
+		findCandidates(candidates);
+		computeDescriptors(candidates, scale, offset, keys, descriptors);
+
+		nextOctave();
+		scale *= 2.0f;
+	}
+
+	mGaussians.clear();
+	mDoGs.clear();
+	mBlurred = SiftImage();
+
+	return (int) keys.size();
+}
+
+size_t SiftExtractorCPU::getMemoryUsage(int width, int height) const
+{
+	//Gaussian levels, differences of Gaussian and the convolution buffer of the first octave
+	double pixels = (double) width*height*pow(4.0, (double) -mFirstOctave);
+	return (size_t) (pixels*sizeof(float)*(2*SIFT_LEVELS_PER_OCTAVE+6));
+}
+
+void SiftExtractorCPU::createScaleSpace(int width, int height, const unsigned char* pixels)
+{
+	mGaussians.resize(SIFT_LEVELS_PER_OCTAVE+3);
+	mDoGs.resize(SIFT_LEVELS_PER_OCTAVE+2);
+	createBase(width, height, pixels);
+
+	//the input image is assumed to have a blur of 0.5 pixel
+	float initialSigma = SIFT_INITIAL_SIGMA * (mFirstOctave < 0 ? (float) (1 << -mFirstOctave) : 1.0f);
+	gaussianBlur(mKernel, mGaussians[0], mBlurred, mGaussians[1], sqrt(SIFT_SIGMA0*SIFT_SIGMA0 - initialSigma*initialSigma), mPool);
+	std::swap(mGaussians[0], mBlurred);
+}
+
+bool SiftExtractorCPU::hasOctave() const
+{
+	return std::min(mGaussians[0].width, mGaussians[0].height) >= SIFT_MIN_OCTAVE_SIZE;
+}
+
+void SiftExtractorCPU::createBase(int width, int height, const unsigned char* pixels)
+{
+	SiftImage& base = mGaussians[0];
+	base.resize(width, height);
+	mBaseOffset = 0.0f;
+	for (size_t i=0; i<base.pixels.size(); ++i)
+		base.pixels[i] = pixels[i] / 255.0f;
+
+	//first octave < 0: bilinear upsampling, > 0: 2x2 box downsampling
+	for (int octave=mFirstOctave; octave<0; ++octave)
+	{
+		mBlurred.resize(2*base.width, 2*base.height);
+		for (int y=0; y<mBlurred.height; ++y)
+		{
+			const float* row0 = base.getRow(y/2);
+			const float* row1 = base.getRow(std::min(y/2 + (y&1), base.height-1));
+			float* output = mBlurred.getRow(y);
+			for (int x=0; x<mBlurred.width; ++x)
+			{
+				int x0 = x/2;
+				int x1 = std::min(x0 + (x&1), base.width-1);
+				output[x] = 0.25f*(row0[x0] + row0[x1] + row1[x0] + row1[x1]);
+			}
+		}
+		std::swap(base, mBlurred);
+	}
+	for (int octave=0; octave<mFirstOctave && base.width >= 2 && base.height >= 2; ++octave)
+	{
+		mBaseOffset += 0.5f*(1 << octave);
+		mBlurred.resize(base.width/2, base.height/2);
+		for (int y=0; y<mBlurred.height; ++y)
+		{
+			const float* row0 = base.getRow(2*y);
+			const float* row1 = base.getRow(2*y+1);
+			float* output = mBlurred.getRow(y);
+			for (int x=0; x<mBlurred.width; ++x)
+				output[x] = 0.25f*(row0[2*x] + row0[2*x+1] + row1[2*x] + row1[2*x+1]);
+		}
+		std::swap(base, mBlurred);
+	}
+}
+
+void SiftExtractorCPU::buildOctave()
+{
+	//level i has a blur of sigma0*2^(i/levels), each level is blurred from the previous one
+	float k = pow(2.0f, 1.0f/SIFT_LEVELS_PER_OCTAVE);
+	for (int i=1; i<SIFT_LEVELS_PER_OCTAVE+3; ++i)
+	{
+		float previous = SIFT_SIGMA0*pow(k, (float) (i-1));
+		float current  = previous*k;
+		gaussianBlur(mKernel, mGaussians[i-1], mGaussians[i], mBlurred, sqrt(current*current - previous*previous), mPool);
+	}
+
+	for (int i=0; i<SIFT_LEVELS_PER_OCTAVE+2; ++i)
+	{
+		mDoGs[i].resize(mGaussians[i].width, mGaussians[i].height);
+		DifferenceJob job = {mKernel, &mGaussians[i], &mGaussians[i+1], &mDoGs[i]};
+		mPool.run(subtractRows, &job, mGaussians[i].height);
+	}
+}
+
+void SiftExtractorCPU::nextOctave()
+{
+	//level S has twice the blur of the level 0: subsampled, it is the base of the next octave
+	const SiftImage& last = mGaussians[SIFT_LEVELS_PER_OCTAVE];
+	mBlurred.resize(last.width/2, last.height/2);
+	DownsampleJob job = {mKernel, &last, &mBlurred};
+	mPool.run(downsampleRows, &job, mBlurred.height);
+	std::swap(mGaussians[0], mBlurred);
+}
+
+void SiftExtractorCPU::findCandidates(std::vector<SiftCandidate>& candidates)
+{
+	//rows are split between threads, results are concatenated in row order
+	std::vector<std::vector<SiftCandidate> > outputs(mNbThread);
+	for (int level=1; level<=SIFT_LEVELS_PER_OCTAVE; ++level)
+	{
+		DetectionJob job = {&mDoGs, level, &outputs};
+		mPool.run(detectRows, &job, mDoGs[level].height);
+		for (int i=0; i<mNbThread; ++i)
+		{
+			candidates.insert(candidates.end(), outputs[i].begin(), outputs[i].end());
+			outputs[i].clear();
+		}
+	}
+}
+
+void SiftExtractorCPU::computeDescriptors(const std::vector<SiftCandidate>& candidates, float scale, float offset, SiftKeyPoints& keys, SiftKeyDescriptors& descriptors)
+{
+	std::vector<SiftKeyPoints> threadKeys(mNbThread);
+	std::vector<SiftKeyDescriptors> threadDescriptors(mNbThread);
+	DescriptorJob job = {&candidates, &mGaussians, scale, offset, &threadKeys, &threadDescriptors};
+	mPool.run(describeCandidates, &job, (int) candidates.size());
+
+	for (int i=0; i<mNbThread; ++i)
+	{
+		keys.insert(keys.end(), threadKeys[i].begin(), threadKeys[i].end());
+		descriptors.insert(descriptors.end(), threadDescriptors[i].begin(), threadDescriptors[i].end());
+	}
+}
@@ -0,0 +1,357 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include "SiftMatcher.h"
+#include "Threading.h"
+#include "NearestNeighbourKernel.h"
+
+#include <algorithm>
+#include <math.h>
+
+SiftMatcher::SiftMatcher(float distanceThreshold, float ratioThreshold)
+{
+	mDistanceThreshold = distanceThreshold;
+	mRatioThreshold    = ratioThreshold;
+}
+
+SiftMatcher::~SiftMatcher()
+{}
+
+//
+// G P U     M A T C H E R
+//
+
+SiftMatcherGPU::SiftMatcherGPU(float distanceThreshold, float ratioThreshold, int nbThread)
+: SiftMatcher(distanceThreshold, ratioThreshold)
+{
+	mMatcher = new SiftMatchGPU(8192);
+	mIsInitialized = (mMatcher->VerifyContextGL() != 0);
+	mMatchBuffer = new int[MATCH_BUFFER][2];
+	mLargePairMatcher = new SiftMatcherCPU(distanceThreshold, ratioThreshold, nbThread);
+}
+
+SiftMatcherGPU::~SiftMatcherGPU()
+{
+	delete mMatcher;
+	mMatcher = NULL;
+	delete[] mMatchBuffer;
+	mMatchBuffer = NULL;
+	delete mLargePairMatcher;
+	mLargePairMatcher = NULL;
+}
+
+int SiftMatcherGPU::match(const float* descriptorsA, int nbA, const float* descriptorsB, int nbB, std::vector<Match>& matches)
+{
+	if (std::max(nbA, nbB) > MATCH_BUFFER)
+	{
+		int nbMatch = mLargePairMatcher->match(descriptorsA, nbA, descriptorsB, nbB, matches);
+		mRatios = mLargePairMatcher->getRatios();
+		return nbMatch;
+	}
+	mRatios.clear();
+	return matchGPU(descriptorsA, nbA, descriptorsB, nbB, matches);
+}
+
+int SiftMatcherGPU::match(const unsigned char* descriptorsA, int nbA, const unsigned char* descriptorsB, int nbB, std::vector<Match>& matches)
+{
+	if (std::max(nbA, nbB) > MATCH_BUFFER)
+	{
+		int nbMatch = mLargePairMatcher->match(descriptorsA, nbA, descriptorsB, nbB, matches);
+		mRatios = mLargePairMatcher->getRatios();
+		return nbMatch;
+	}
+	mRatios.clear();
+	return matchGPU(descriptorsA, nbA, descriptorsB, nbB, matches);
+}
+
+template <typename T>
+int SiftMatcherGPU::matchGPU(const T* descriptorsA, int nbA, const T* descriptorsB, int nbB, std::vector<Match>& matches)
+{
+	//both sets fit in the GPU buffers: one upload each, mutual and ratio tests over all key-points
+	int maxSize = std::max(nbA, nbB);
+	mMatcher->SetDescriptors(0, nbA, descriptorsA);
+	mMatcher->SetDescriptors(1, nbB, descriptorsB);
+
+	//This stage can be farmed off to a remote GPU
+	mMatcher->SetMaxSift(maxSize);
+	int nbMatch = mMatcher->GetSiftMatch(maxSize, mMatchBuffer, mDistanceThreshold, mRatioThreshold);
+
+	for (int k=0; k<nbMatch; ++k)
+		matches.push_back(Match(mMatchBuffer[k][0], mMatchBuffer[k][1]));
+
+	return nbMatch;
+}
+
+//
+// C P U     M A T C H E R
+//
+
+static void quantizeDescriptors(const float* descriptors, int nbDescriptor, std::vector<unsigned char>& output)
+{
+	output.resize(nbDescriptor*128);
+	for (int i=0; i<nbDescriptor*128; ++i)
+	{
+		int value = (int) floor(0.5+512.0f*descriptors[i]);
+		output[i] = (unsigned char) std::min(std::max(value, 0), 255);
+	}
+}
+
+//rows begin..end-1 of the dot product matrix, train descriptors are processed by tiles
+static void updateNearestRange(NearestNeighbourKernel kernel, const unsigned char* queries, int begin, int end,
+	const unsigned char* train, const short* trainWide, int nbTrain, NearestState* rows, NearestState* columns)
+{
+	for (int blockBegin=0; blockBegin<nbTrain; blockBegin+=KERNEL_TRAIN_BLOCK)
+	{
+		int blockEnd = std::min(blockBegin+KERNEL_TRAIN_BLOCK, nbTrain);
+		if (kernel == KERNEL_AVX512)
+			updateNearestAVX512(queries, begin, end, trainWide, blockBegin, blockEnd, rows, columns);
+		else if (kernel == KERNEL_AVX2)
+			updateNearestAVX2(queries, begin, end, trainWide, blockBegin, blockEnd, rows, columns);
+		else
+			updateNearestSSE2(queries, begin, end, train, blockBegin, blockEnd, rows, columns);
+	}
+}
+
+struct NearestNeighbourJob
+{
+	NearestNeighbourKernel kernel;
+	const unsigned char*   queries;
+	const unsigned char*   train;
+	const short*           trainWide;
+	int                    nbTrain;
+	NearestState*          rows;
+	std::vector<std::vector<NearestState> >* columns; //one per thread
+};
+
+static void updateNearestJob(void* context, int threadIndex, int begin, int end)
+{
+	const NearestNeighbourJob& job = *(const NearestNeighbourJob*) context;
+	updateNearestRange(job.kernel, job.queries, begin, end, job.train, job.trainWide, job.nbTrain, job.rows + begin, &(*job.columns)[threadIndex][0]);
+}
+
+SiftMatcherCPU::SiftMatcherCPU(float distanceThreshold, float ratioThreshold, int nbThread)
+: SiftMatcher(distanceThreshold, ratioThreshold), mPool(nbThread)
+{
+	mNbThread = mPool.getThreadCount();
+	mKernel   = getNearestNeighbourKernel();
+}
+
+SiftMatcherCPU::~SiftMatcherCPU()
+{}
+
+void SiftMatcherCPU::findMutualNearest(const unsigned char* descriptorsA, int nbA, const unsigned char* descriptorsB, int nbB)
+{
+	mRows.assign(nbA, NearestState());
+
+	//AVX kernels read train descriptors widened to 16 bits once per pair
+	const short* trainWide = NULL;
+	if (mKernel != KERNEL_SSE2)
+	{
+		mTrainWide.resize((size_t) nbB*128);
+		widenDescriptors(descriptorsB, nbB, &mTrainWide[0]);
+		trainWide = &mTrainWide[0];
+	}
+
+	int nbThread = std::min(mNbThread, nbA);
+	if (nbThread <= 1)
+	{
+		mColumns.assign(nbB, NearestState());
+		updateNearestRange(mKernel, descriptorsA, 0, nbA, descriptorsB, trainWide, nbB, &mRows[0], &mColumns[0]);
+		return;
+	}
+
+	//rows are split between the threads of the pool, each thread has its own column states
+	mThreadColumns.resize(nbThread);
+	for (int i=0; i<nbThread; ++i)
+		mThreadColumns[i].assign(nbB, NearestState());
+	NearestNeighbourJob job = {mKernel, descriptorsA, descriptorsB, trainWide, nbB, &mRows[0], &mThreadColumns};
+	mPool.run(updateNearestJob, &job, nbA);
+
+	//merged in row order: same result as a single thread
+	mColumns.swap(mThreadColumns[0]);
+	for (int i=1; i<nbThread; ++i)
+		for (int j=0; j<nbB; ++j)
+			mColumns[j].merge(mThreadColumns[i][j]);
+}
+
+int SiftMatcherCPU::match(const float* descriptorsA, int nbA, const float* descriptorsB, int nbB, std::vector<Match>& matches)
+{
+	mRatios.clear();
+	if (nbA <= 0 || nbB <= 0)
+		return 0;
+
+	quantizeDescriptors(descriptorsA, nbA, mDescriptorsA);
+	quantizeDescriptors(descriptorsB, nbB, mDescriptorsB);
+
+	return match(&mDescriptorsA[0], nbA, &mDescriptorsB[0], nbB, matches);
+}
+
+int SiftMatcherCPU::match(const unsigned char* descriptorsA, int nbA, const unsigned char* descriptorsB, int nbB, std::vector<Match>& matches)
+{
+	mRatios.clear();
+	if (nbA <= 0 || nbB <= 0)
+		return 0;
+
+	//both directions from one pass over the dot product matrix
+	findMutualNearest(descriptorsA, nbA, descriptorsB, nbB);
+
+	//keep mutual best matches only
+	int nbMatch = 0;
+	for (int i=0; i<nbA; ++i)
+	{
+		if (!mRows[i].accept(mDistanceThreshold, mRatioThreshold))
+			continue;
+
+		int j = mRows[i].bestIndex;
+		if (mColumns[j].bestIndex == i && mColumns[j].accept(mDistanceThreshold, mRatioThreshold))
+		{
+			matches.push_back(Match(i, j));
+			mRatios.push_back(std::max(mRows[i].getRatio(), mColumns[j].getRatio()));
+			nbMatch++;
+		}
+	}
+
+	return nbMatch;
+}
+
+//
+// A P P R O X I M A T E    C P U     M A T C H E R
+//
+
+static void findApproximateNearestRange(const KdForest& queries, int begin, int end, const KdForest& train, int nbCheck,
+	float distanceThreshold, float ratioThreshold, int* nearest, float* ratios)
+{
+	KdForest::SearchBuffer buffer;
+	for (int i=begin; i<end; ++i)
+	{
+		const unsigned char* query = queries.getDescriptor(i);
+		int bestIndex, secondIndex;
+		train.findNearest(query, nbCheck, bestIndex, secondIndex, buffer);
+
+		int bestDot   = (bestIndex >= 0 ? dotProduct(query, train.getDescriptor(bestIndex)) : 0);
+		int secondDot = (secondIndex >= 0 ? dotProduct(query, train.getDescriptor(secondIndex)) : 0);
+		if (bestIndex != -1 && acceptMatch(bestDot, secondDot, distanceThreshold, ratioThreshold))
+		{
+			nearest[i] = bestIndex;
+			ratios[i]  = getMatchRatio(bestDot, secondDot);
+		}
+		else
+			nearest[i] = -1;
+	}
+}
+
+struct ApproximateNeighbourJob
+{
+	const KdForest* queries;
+	const KdForest* train;
+	int             nbCheck;
+	float           distanceThreshold;
+	float           ratioThreshold;
+	int*            nearest;
+	float*          ratios;
+};
+
+static void findApproximateNearestJob(void* context, int, int begin, int end)
+{
+	const ApproximateNeighbourJob& job = *(const ApproximateNeighbourJob*) context;
+	findApproximateNearestRange(*job.queries, begin, end, *job.train, job.nbCheck, job.distanceThreshold, job.ratioThreshold, job.nearest, job.ratios);
+}
+
+SiftMatcherANN::SiftMatcherANN(float distanceThreshold, float ratioThreshold, int nbCheck, int nbThread)
+: SiftMatcherCPU(distanceThreshold, ratioThreshold, nbThread)
+{
+	mNbCheck = std::max(nbCheck, 1);
+}
+
+SiftMatcherANN::~SiftMatcherANN()
+{}
+
+void SiftMatcherANN::findApproximateNearest(const KdForest& queries, const KdForest& train, std::vector<int>& nearest, std::vector<float>& ratios)
+{
+	int nbQuery = queries.getDescriptorCount();
+	nearest.resize(nbQuery);
+	ratios.resize(nbQuery);
+
+	if (nbQuery <= 0)
+		return;
+
+	ApproximateNeighbourJob job = {&queries, &train, mNbCheck, mDistanceThreshold, mRatioThreshold, &nearest[0], &ratios[0]};
+	mPool.run(findApproximateNearestJob, &job, nbQuery);
+}
+
+int SiftMatcherANN::match(const KdForest& forestA, const KdForest& forestB, std::vector<Match>& matches)
+{
+	int nbA = forestA.getDescriptorCount();
+	int nbB = forestB.getDescriptorCount();
+	mRatios.clear();
+	if (nbA <= 0 || nbB <= 0)
+		return 0;
+
+	findApproximateNearest(forestA, forestB, mNearestA, mNearestRatiosA);
+	findApproximateNearest(forestB, forestA, mNearestB, mNearestRatiosB);
+
+	//keep mutual best matches only
+	int nbMatch = 0;
+	for (int i=0; i<nbA; ++i)
+	{
+		int j = mNearestA[i];
+		if (j >= 0 && mNearestB[j] == i)
+		{
+			matches.push_back(Match(i, j));
+			mRatios.push_back(std::max(mNearestRatiosA[i], mNearestRatiosB[j]));
+			nbMatch++;
+		}
+	}
+
+	return nbMatch;
+}
+
+int SiftMatcherANN::match(const float* descriptorsA, int nbA, const float* descriptorsB, int nbB, std::vector<Match>& matches)
+{
+	mRatios.clear();
+	if (nbA <= 0 || nbB <= 0)
+		return 0;
+
+	KdForest forestA, forestB;
+	forestA.build(descriptorsA, nbA, ANN_TREE);
+	forestB.build(descriptorsB, nbB, ANN_TREE);
+
+	return match(forestA, forestB, matches);
+}
+
+int SiftMatcherANN::match(const unsigned char* descriptorsA, int nbA, const unsigned char* descriptorsB, int nbB, std::vector<Match>& matches)
+{
+	mRatios.clear();
+	if (nbA <= 0 || nbB <= 0)
+		return 0;
+
+	KdForest forestA, forestB;
+	forestA.build(descriptorsA, nbA, ANN_TREE);
+	forestB.build(descriptorsB, nbB, ANN_TREE);
+
+	return match(forestA, forestB, matches);
+}
+
+int SiftMatcherANN::matchExact(const unsigned char* descriptorsA, int nbA, const unsigned char* descriptorsB, int nbB, std::vector<Match>& matches)
+{
+	return SiftMatcherCPU::match(descriptorsA, nbA, descriptorsB, nbB, matches);
+}
@@ -0,0 +1,315 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include "Threading.h"
+
+#ifdef _WIN32
+	#ifndef _WIN32_WINNT
+		#define _WIN32_WINNT 0x0600 //condition variables need Vista
+	#endif
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else
+	#include <pthread.h>
+	#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+Mutex::Mutex()
+{
+	CRITICAL_SECTION* section = new CRITICAL_SECTION;
+	InitializeCriticalSection(section);
+	mHandle = section;
+}
+
+Mutex::~Mutex()
+{
+	CRITICAL_SECTION* section = (CRITICAL_SECTION*) mHandle;
+	DeleteCriticalSection(section);
+	delete section;
+}
+
+void Mutex::lock()
+{
+	EnterCriticalSection((CRITICAL_SECTION*) mHandle);
+}
+
+void Mutex::unlock()
+{
+	LeaveCriticalSection((CRITICAL_SECTION*) mHandle);
+}
+
+Condition::Condition()
+{
+	CONDITION_VARIABLE* condition = new CONDITION_VARIABLE;
+	InitializeConditionVariable(condition);
+	mHandle = condition;
+}
+
+Condition::~Condition()
+{
+	delete (CONDITION_VARIABLE*) mHandle;
+}
+
+void Condition::wait(Mutex& mutex)
+{
+	SleepConditionVariableCS((CONDITION_VARIABLE*) mHandle, (CRITICAL_SECTION*) mutex.mHandle, INFINITE);
+}
+
+void Condition::notifyOne()
+{
+	WakeConditionVariable((CONDITION_VARIABLE*) mHandle);
+}
+
+void Condition::notifyAll()
+{
+	WakeAllConditionVariable((CONDITION_VARIABLE*) mHandle);
+}
+
+static DWORD WINAPI threadEntry(LPVOID param)
+{
+	Thread::execute((Thread*) param);
+	return 0;
+}
+
+bool Thread::start()
+{
+	mHandle = CreateThread(NULL, 0, threadEntry, this, 0, NULL);
+	return mHandle != NULL;
+}
+
+void Thread::join()
+{
+	if (mHandle)
+	{
+		WaitForSingleObject((HANDLE) mHandle, INFINITE);
+		CloseHandle((HANDLE) mHandle);
+		mHandle = NULL;
+	}
+}
+
+int getProcessorCount()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int) info.dwNumberOfProcessors;
+}
+
+#else
+
+Mutex::Mutex()
+{
+	pthread_mutex_t* mutex = new pthread_mutex_t;
+	pthread_mutex_init(mutex, NULL);
+	mHandle = mutex;
+}
+
+Mutex::~Mutex()
+{
+	pthread_mutex_t* mutex = (pthread_mutex_t*) mHandle;
+	pthread_mutex_destroy(mutex);
+	delete mutex;
+}
+
+void Mutex::lock()
+{
+	pthread_mutex_lock((pthread_mutex_t*) mHandle);
+}
+
+void Mutex::unlock()
+{
+	pthread_mutex_unlock((pthread_mutex_t*) mHandle);
+}
+
+Condition::Condition()
+{
+	pthread_cond_t* condition = new pthread_cond_t;
+	pthread_cond_init(condition, NULL);
+	mHandle = condition;
+}
+
+Condition::~Condition()
+{
+	pthread_cond_t* condition = (pthread_cond_t*) mHandle;
+	pthread_cond_destroy(condition);
+	delete condition;
+}
+
+void Condition::wait(Mutex& mutex)
+{
+	pthread_cond_wait((pthread_cond_t*) mHandle, (pthread_mutex_t*) mutex.mHandle);
+}
+
+void Condition::notifyOne()
+{
+	pthread_cond_signal((pthread_cond_t*) mHandle);
+}
+
+void Condition::notifyAll()
+{
+	pthread_cond_broadcast((pthread_cond_t*) mHandle);
+}
+
+static void* threadEntry(void* param)
+{
+	Thread::execute((Thread*) param);
+	return NULL;
+}
+
+bool Thread::start()
+{
+	pthread_t* thread = new pthread_t;
+	if (pthread_create(thread, NULL, threadEntry, this) != 0)
+	{
+		delete thread;
+		return false;
+	}
+	mHandle = thread;
+	return true;
+}
+
+void Thread::join()
+{
+	if (mHandle)
+	{
+		pthread_t* thread = (pthread_t*) mHandle;
+		pthread_join(*thread, NULL);
+		delete thread;
+		mHandle = NULL;
+	}
+}
+
+int getProcessorCount()
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int) count : 1;
+}
+
+#endif
+
+Thread::Thread()
+{
+	mHandle = NULL;
+}
+
+Thread::~Thread()
+{
+	join();
+}
+
+void Thread::execute(Thread* thread)
+{
+	thread->run();
+}
+
+ThreadPool::ThreadPool(int nbThread)
+: mFunction(NULL), mContext(NULL), mCount(0), mNbRange(0), mNbPending(0), mJobIndex(0), mStopping(false)
+{
+	for (int i=1; i<nbThread; ++i)
+	{
+		WorkerThread* thread = new WorkerThread(this, (int) mThreads.size()+1);
+		if (!thread->start())
+		{
+			delete thread;
+			break;
+		}
+		mThreads.push_back(thread);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		ScopedLock lock(mMutex);
+		mStopping = true;
+		mJobReady.notifyAll();
+	}
+	for (unsigned int i=0; i<mThreads.size(); ++i)
+	{
+		mThreads[i]->join();
+		delete mThreads[i];
+	}
+}
+
+void ThreadPool::runRange(int threadIndex)
+{
+	int begin = (int) ((long long) mCount*threadIndex/mNbRange);
+	int end   = (int) ((long long) mCount*(threadIndex+1)/mNbRange);
+	mFunction(mContext, threadIndex, begin, end);
+}
+
+void ThreadPool::run(RangeFunction function, void* context, int count)
+{
+	if (count <= 0)
+		return;
+
+	int nbRange = std::min(getThreadCount(), count);
+	if (nbRange == 1)
+	{
+		function(context, 0, 0, count);
+		return;
+	}
+
+	{
+		ScopedLock lock(mMutex);
+		mFunction  = function;
+		mContext   = context;
+		mCount     = count;
+		mNbRange   = nbRange;
+		mNbPending = nbRange-1;
+		mJobIndex++;
+		mJobReady.notifyAll();
+	}
+
+	runRange(0);
+
+	ScopedLock lock(mMutex);
+	while (mNbPending > 0)
+		mJobDone.wait(mMutex);
+}
+
+void ThreadPool::work(int threadIndex)
+{
+	int jobIndex = 0;
+	while (true)
+	{
+		{
+			ScopedLock lock(mMutex);
+			while (!mStopping && mJobIndex == jobIndex)
+				mJobReady.wait(mMutex);
+			if (mStopping)
+				return;
+			jobIndex = mJobIndex;
+			if (threadIndex >= mNbRange)
+				continue;
+		}
+
+		runRange(threadIndex);
+
+		ScopedLock lock(mMutex);
+		if (--mNbPending == 0)
+			mJobDone.notifyOne();
+	}
+}
@@ -0,0 +1,371 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include "VocabularyTree.h"
+
+#include <algorithm>
+#include <math.h>
+
+//k-means iterations per tree node (stops earlier when assignments are stable)
+#define KMEANS_ITERATION 10
+
+static inline float squaredDistance(const unsigned char* descriptor, const float* center)
+{
+	float distance = 0.0f;
+	for (int k=0; k<128; ++k)
+	{
+		float d = descriptor[k] - center[k];
+		distance += d*d;
+	}
+
+	return distance;
+}
+
+static inline int findNearestCenter(const unsigned char* descriptor, const float* centers, int nbCenter)
+{
+	int   bestIndex    = 0;
+	float bestDistance = squaredDistance(descriptor, centers);
+	for (int i=1; i<nbCenter; ++i)
+	{
+		float distance = squaredDistance(descriptor, centers + i*128);
+		if (distance < bestDistance)
+		{
+			bestDistance = distance;
+			bestIndex    = i;
+		}
+	}
+
+	return bestIndex;
+}
+
+//assign descriptors[indices[begin..end[] to their nearest center, return the number of changed assignments
+static int assignRange(const unsigned char* descriptors, const int* indices, int begin, int end,
+	const float* centers, int nbCenter, int* assignment)
+{
+	int nbChanged = 0;
+	for (int i=begin; i<end; ++i)
+	{
+		int nearest = findNearestCenter(descriptors + (size_t) indices[i]*128, centers, nbCenter);
+		if (nearest != assignment[i])
+		{
+			assignment[i] = nearest;
+			nbChanged++;
+		}
+	}
+
+	return nbChanged;
+}
+
+struct ClusterAssignJob
+{
+	const unsigned char* descriptors;
+	const int*           indices;
+	const float*         centers;
+	int                  nbCenter;
+	int*                 assignment;
+	int*                 changed; //one count per thread
+};
+
+static void assignClustersJob(void* context, int threadIndex, int begin, int end)
+{
+	const ClusterAssignJob& job = *(const ClusterAssignJob*) context;
+	job.changed[threadIndex] = assignRange(job.descriptors, job.indices, begin, end, job.centers, job.nbCenter, job.assignment);
+}
+
+struct QuantizeJob
+{
+	const VocabularyTree* tree;
+	const unsigned char*  descriptors;
+	int*                  words;
+};
+
+static void quantizeJob(void* context, int, int begin, int end)
+{
+	const QuantizeJob& job = *(const QuantizeJob*) context;
+	for (int i=begin; i<end; ++i)
+		job.words[i] = job.tree->quantize(job.descriptors + (size_t) i*128);
+}
+
+//
+// V O C A B U L A R Y    T R E E
+//
+
+VocabularyTree::VocabularyTree(int nbThread)
+: mPool(nbThread)
+{
+	mBranching = 0;
+	mDepth     = 0;
+	mNbWord    = 0;
+	mSeed      = 1;
+}
+
+void VocabularyTree::train(const unsigned char* descriptors, int nbDescriptor, int branching, int depth)
+{
+	mNodes.clear();
+	mCenters.clear();
+	mBranching = std::max(branching, 2);
+	mDepth     = std::max(depth, 1);
+	mNbWord    = 0;
+	mSeed      = 1;
+
+	Node root = {0, 0, -1};
+	mNodes.push_back(root);
+	mCenters.resize(128, 0.0f);
+
+	std::vector<int> indices(nbDescriptor);
+	for (int i=0; i<nbDescriptor; ++i)
+		indices[i] = i;
+
+	trainNode(0, descriptors, indices, 0);
+}
+
+int VocabularyTree::addLeaf(int nodeIndex)
+{
+	mNodes[nodeIndex].word = mNbWord++;
+	return mNodes[nodeIndex].word;
+}
+
+int VocabularyTree::assignClusters(const unsigned char* descriptors, const std::vector<int>& indices,
+	const std::vector<float>& centers, int nbCenter, std::vector<int>& assignment)
+{
+	//small nodes are not worth waking the threads
+	int nbIndex = (int) indices.size();
+	if (mPool.getThreadCount() <= 1 || nbIndex < 2048)
+		return assignRange(descriptors, &indices[0], 0, nbIndex, &centers[0], nbCenter, &assignment[0]);
+
+	mChanged.assign(mPool.getThreadCount(), 0);
+	ClusterAssignJob job = {descriptors, &indices[0], &centers[0], nbCenter, &assignment[0], &mChanged[0]};
+	mPool.run(assignClustersJob, &job, nbIndex);
+
+	int nbChanged = 0;
+	for (unsigned int i=0; i<mChanged.size(); ++i)
+		nbChanged += mChanged[i];
+
+	return nbChanged;
+}
+
+void VocabularyTree::trainNode(int nodeIndex, const unsigned char* descriptors, std::vector<int>& indices, int level)
+{
+	int nbIndex = (int) indices.size();
+	if (level >= mDepth || nbIndex < 2*mBranching)
+	{
+		addLeaf(nodeIndex);
+		return;
+	}
+
+	//initial centers: distinct samples picked by a partial Fisher-Yates shuffle (fixed seed: same tree on each run)
+	int nbCenter = mBranching;
+	std::vector<float> centers(nbCenter*128);
+	for (int i=0; i<nbCenter; ++i)
+	{
+		mSeed = mSeed*1103515245 + 12345;
+		int j = i + (int) ((mSeed >> 8) % (unsigned int) (nbIndex-i));
+		std::swap(indices[i], indices[j]);
+
+		const unsigned char* descriptor = descriptors + (size_t) indices[i]*128;
+		for (int k=0; k<128; ++k)
+			centers[i*128+k] = descriptor[k];
+	}
+
+	//Lloyd iterations, the last step is always an assignment so that children match the centers
+	std::vector<int> assignment(nbIndex, -1);
+	std::vector<double> sums(nbCenter*128);
+	std::vector<int> counts(nbCenter);
+	for (int iteration=0; ; ++iteration)
+	{
+		int nbChanged = assignClusters(descriptors, indices, centers, nbCenter, assignment);
+		if (nbChanged == 0 || iteration == KMEANS_ITERATION)
+			break;
+
+		std::fill(sums.begin(), sums.end(), 0.0);
+		std::fill(counts.begin(), counts.end(), 0);
+		for (int i=0; i<nbIndex; ++i)
+		{
+			const unsigned char* descriptor = descriptors + (size_t) indices[i]*128;
+			double* sum = &sums[assignment[i]*128];
+			for (int k=0; k<128; ++k)
+				sum[k] += descriptor[k];
+			counts[assignment[i]]++;
+		}
+
+		//empty clusters keep their previous center
+		for (int i=0; i<nbCenter; ++i)
+			if (counts[i] > 0)
+				for (int k=0; k<128; ++k)
+					centers[i*128+k] = (float) (sums[i*128+k] / counts[i]);
+	}
+
+	int firstChild = (int) mNodes.size();
+	mNodes[nodeIndex].firstChild = firstChild;
+	mNodes[nodeIndex].nbChild    = nbCenter;
+	for (int i=0; i<nbCenter; ++i)
+	{
+		Node child = {0, 0, -1};
+		mNodes.push_back(child);
+	}
+	mCenters.insert(mCenters.end(), centers.begin(), centers.end());
+
+	std::vector<std::vector<int> > partitions(nbCenter);
+	for (int i=0; i<nbIndex; ++i)
+		partitions[assignment[i]].push_back(indices[i]);
+	std::vector<int>().swap(indices);
+	std::vector<int>().swap(assignment);
+
+	for (int i=0; i<nbCenter; ++i)
+	{
+		trainNode(firstChild+i, descriptors, partitions[i], level+1);
+		std::vector<int>().swap(partitions[i]);
+	}
+}
+
+int VocabularyTree::quantize(const unsigned char* descriptor) const
+{
+	if (mNodes.empty())
+		return -1;
+
+	int nodeIndex = 0;
+	while (mNodes[nodeIndex].nbChild > 0)
+	{
+		const Node& node = mNodes[nodeIndex];
+		nodeIndex = node.firstChild + findNearestCenter(descriptor, &mCenters[(size_t) node.firstChild*128], node.nbChild);
+	}
+
+	return mNodes[nodeIndex].word;
+}
+
+void VocabularyTree::quantize(const unsigned char* descriptors, int nbDescriptor, std::vector<int>& words) const
+{
+	words.resize(nbDescriptor);
+	if (nbDescriptor <= 0)
+		return;
+
+	if (mPool.getThreadCount() <= 1 || nbDescriptor < 2048)
+	{
+		for (int i=0; i<nbDescriptor; ++i)
+			words[i] = quantize(descriptors + (size_t) i*128);
+		return;
+	}
+
+	QuantizeJob job = {this, descriptors, &words[0]};
+	mPool.run(quantizeJob, &job, nbDescriptor);
+}
+
+//
+// R E T R I E V A L    I N D E X
+//
+
+static bool compareScore(const std::pair<int, float>& a, const std::pair<int, float>& b)
+{
+	if (a.second != b.second)
+		return a.second > b.second;
+	return a.first < b.first;
+}
+
+void RetrievalIndex::reset(int nbWord, int nbImage)
+{
+	mImageWords.assign(nbImage, std::vector<Entry>());
+	mInvertedFile.assign(nbWord, std::vector<Entry>());
+}
+
+void RetrievalIndex::addImage(int imageIndex, const std::vector<int>& words)
+{
+	std::vector<int> sorted(words);
+	std::sort(sorted.begin(), sorted.end());
+
+	std::vector<Entry>& imageWords = mImageWords[imageIndex];
+	imageWords.clear();
+	for (unsigned int i=0; i<sorted.size(); ++i)
+	{
+		if (sorted[i] < 0)
+			continue;
+		if (!imageWords.empty() && imageWords.back().first == sorted[i])
+			imageWords.back().second += 1.0f;
+		else
+			imageWords.push_back(Entry(sorted[i], 1.0f));
+	}
+}
+
+void RetrievalIndex::finalize()
+{
+	int nbImage = (int) mImageWords.size();
+
+	//document frequency of each word
+	std::vector<int> frequencies(mInvertedFile.size(), 0);
+	for (int i=0; i<nbImage; ++i)
+		for (unsigned int j=0; j<mImageWords[i].size(); ++j)
+			frequencies[mImageWords[i][j].first]++;
+
+	for (unsigned int i=0; i<mInvertedFile.size(); ++i)
+	{
+		mInvertedFile[i].clear();
+		mInvertedFile[i].reserve(frequencies[i]);
+	}
+
+	//tf-idf vectors normalized to 1.0, words seen in every image have no weight and are dropped
+	for (int i=0; i<nbImage; ++i)
+	{
+		std::vector<Entry>& imageWords = mImageWords[i];
+		std::vector<Entry> weighted;
+		double norm = 0.0;
+		for (unsigned int j=0; j<imageWords.size(); ++j)
+		{
+			float idf = (float) log((double) nbImage / frequencies[imageWords[j].first]);
+			if (idf <= 0.0f)
+				continue;
+			float weight = imageWords[j].second * idf;
+			weighted.push_back(Entry(imageWords[j].first, weight));
+			norm += weight*weight;
+		}
+
+		norm = sqrt(norm);
+		for (unsigned int j=0; j<weighted.size(); ++j)
+		{
+			weighted[j].second = (float) (weighted[j].second / norm);
+			mInvertedFile[weighted[j].first].push_back(Entry(i, weighted[j].second));
+		}
+		imageWords.swap(weighted);
+	}
+}
+
+void RetrievalIndex::query(int imageIndex, int nbResult, std::vector<int>& results) const
+{
+	results.clear();
+
+	std::vector<float> scores(mImageWords.size(), 0.0f);
+	const std::vector<Entry>& imageWords = mImageWords[imageIndex];
+	for (unsigned int i=0; i<imageWords.size(); ++i)
+	{
+		const std::vector<Entry>& images = mInvertedFile[imageWords[i].first];
+		for (unsigned int j=0; j<images.size(); ++j)
+			scores[images[j].first] += imageWords[i].second * images[j].second;
+	}
+
+	std::vector<Entry> candidates;
+	for (unsigned int i=0; i<scores.size(); ++i)
+		if (scores[i] > 0.0f && (int) i != imageIndex)
+			candidates.push_back(Entry(i, scores[i]));
+
+	int nbCandidate = std::min((int) candidates.size(), nbResult);
+	std::partial_sort(candidates.begin(), candidates.begin() + nbCandidate, candidates.end(), compareScore);
+	for (int i=0; i<nbCandidate; ++i)
+		results.push_back(candidates[i].first);
+}
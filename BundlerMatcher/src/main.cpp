@@ -21,9 +21,13 @@
 */
 
 #include "BundlerMatcher.h"
+#include "Benchmark.h"
 
 int main(int argc, char* argv[])
 {
+	if (argc >= 2 && std::string(argv[1]) == "bench")
+		return runBenchmark(argc-2, argv+2);
+
 	if (argc < 7)
 	{
 		std::cout << "Usage: " << argv[0] << " <inputPath> <list.txt> <outfile matches> <distanceThreshold> <ratioThreshold> <firstOctave>" <<std::endl;
@@ -40,7 +44,31 @@ int main(int argc, char* argv[])
 		std::cout << "  - tilepercent FRACTION: use a fraction of the tile specified" << std::endl;
 		std::cout << "      -> example: tilepercent 0.9 will use 90% of a given tile" << std::endl;
 		std::cout << "  - pairs pairfile.txt: pairwise matching only using the pairs supplied" << std::endl;
+		std::cout << "  - retrieval NUMBER: only match each image with the NUMBER most similar images (vocabulary tree)" << std::endl;
+		std::cout << "      -> example: retrieval 30 (for large unordered photo collections)" << std::endl;
+		std::cout << "  - cpu: match features on CPU (used automatically when no opengl context is available)" << std::endl;
+		std::cout << "  - cpusift: extract features on CPU (used automatically when SiftGPU is not supported)" << std::endl;
+		std::cout << "  - extractmem MEGABYTES: RAM budget of the images decoded and extracted in parallel (default: 2048)" << std::endl;
+		std::cout << "      -> example: extractmem 8192 (CPU extraction of 20 MP images at first octave 0 needs about 1 GB per image)" << std::endl;
+		std::cout << "  - ann CHECKS: approximate CPU matching with k-d forests (CHECKS descriptors compared per feature)" << std::endl;
+		std::cout << "      -> example: ann 128 (higher is slower and closer to exact matching, recall is reported)" << std::endl;
+		std::cout << "  - verify PIXELS: keep the matches consistent with a fundamental matrix (RANSAC, PIXELS max epipolar distance)" << std::endl;
+		std::cout << "      -> example: verify 4 (pairs with less than 16 inliers are dropped)" << std::endl;
+		std::cout << "  - threads NUMBER: number of CPU matching and extraction threads (default: number of cores)" << std::endl;
+		std::cout << "  - compact: store descriptors as unsigned char in RAM (4x less memory)" << std::endl;
+		std::cout << "  - database: store binary features of all images in inputPath/features.db instead of one .key.bin per image" << std::endl;
+		std::cout << "  - binmatches: stream matches to <outfile matches>.bin while matching (converted to text at the end)" << std::endl;
+		std::cout << "  - incremental: only match pairs missing from the previous <outfile matches> (new images appended to list.txt)" << std::endl;
+		std::cout << "  - checkpoint SECONDS: log matched pairs to <outfile matches>.checkpoint (synced every SECONDS)," << std::endl;
+		std::cout << "      an interrupted run started again with the same arguments only matches the missing pairs" << std::endl;
+		std::cout << "      -> example: checkpoint 60 (for preemptible nodes)" << std::endl;
+		std::cout << "  - shard K/N: only match the K-th of N shards of the pairs (balanced by key-point counts, one shard per node)," << std::endl;
+		std::cout << "      matches are written to <outfile matches>.shardKofN, merge them with BundlerMatchConverter" << std::endl;
+		std::cout << "      -> example: shard 3/8 (needs the key files or the database of all images, only the images of the shard are loaded)" << std::endl;
+		std::cout << "  - cache MEGABYTES: keep at most MEGABYTES of features in RAM (others are reloaded from key files)" << std::endl;
 		std::cout << "Example: " << argv[0] << " your_folder/ list.txt gpu.matches.txt 0.6 0.8 1" << std::endl;
+		std::cout << "Benchmark: " << argv[0] << " bench [DESCRIPTORS [MEGAPIXELS]]: throughput of the CPU matching and scale space kernels supported by this CPU, and of the .key parser" << std::endl;
+		std::cout << "      -> example: " << argv[0] << " bench 8192 24 (single thread, synthetic descriptors and image)" << std::endl;
 
 		return -1;
 	}
@@ -53,6 +81,21 @@ int main(int argc, char* argv[])
 	float tilePercent = 1.0f;
 	bool pairMatching = false;
 	std::string pairfile = "";
+	bool cpuMatching = false;
+	bool cpuExtraction = false;
+	size_t extractionMemory = 0;
+	int nbThread = 0;
+	bool compactDescriptors = false;
+	size_t featureCacheSize = 0;
+	bool featureDatabase = false;
+	bool matchStreaming = false;
+	bool incrementalMatching = false;
+	int retrievalNeighbours = 0;
+	int approximateChecks = 0;
+	float verifyThreshold = 0.0f;
+	int checkpointPeriod = 0;
+	int shardIndex = 1;
+	int shardCount = 1;
 
 	for (int i=1; i<argc; ++i)
 	{
@@ -96,6 +139,83 @@ int main(int argc, char* argv[])
 				i++;
 			}
 		}
+		else if (current == "retrieval")
+		{
+			if (i+1<argc)
+			{
+				retrievalNeighbours = atoi(argv[i+1]);
+				i++;
+			}
+		}
+		else if (current == "ann")
+		{
+			if (i+1<argc)
+			{
+				approximateChecks = atoi(argv[i+1]);
+				i++;
+			}
+		}
+		else if (current == "verify")
+		{
+			if (i+1<argc)
+			{
+				verifyThreshold = (float) atof(argv[i+1]);
+				i++;
+			}
+		}
+		else if (current == "cpu")
+			cpuMatching = true;
+		else if (current == "cpusift")
+			cpuExtraction = true;
+		else if (current == "compact")
+			compactDescriptors = true;
+		else if (current == "database")
+			featureDatabase = true;
+		else if (current == "binmatches")
+			matchStreaming = true;
+		else if (current == "incremental")
+			incrementalMatching = true;
+		else if (current == "checkpoint")
+		{
+			if (i+1<argc)
+			{
+				checkpointPeriod = atoi(argv[i+1]);
+				i++;
+			}
+		}
+		else if (current == "shard")
+		{
+			if (i+1<argc)
+			{
+				if (sscanf(argv[i+1], "%d/%d", &shardIndex, &shardCount) != 2)
+					shardCount = 0;
+				i++;
+			}
+		}
+		else if (current == "extractmem")
+		{
+			if (i+1<argc)
+			{
+				extractionMemory = (size_t) atoi(argv[i+1]) * 1048576;
+				i++;
+			}
+		}
+		else if (current == "cache")
+		{
+			if (i+1<argc)
+			{
+				featureCacheSize = (size_t) atoi(argv[i+1]) * 1048576;
+				i++;
+			}
+		}
+		else if (current == "threads")
+		{
+			if (i+1<argc)
+			{
+				nbThread = atoi(argv[i+1]);
+				i++;
+			}
+		}
 	}
 
 	if(pairMatching && sequenceMatching)
@@ -110,8 +230,16 @@ int main(int argc, char* argv[])
 		return 1;
 	}
 
+	if(shardCount < 1 || shardIndex < 1 || shardIndex > shardCount)
+	{
+		std::cerr << "Shard ["<<shardIndex<<"/"<<shardCount<< "] invalid" << std::endl;
+		return 1;
+	}
+
 	BundlerMatcher matcher((float) atof(argv[4]),(float) atof(argv[5]), atoi(argv[6]), binnaryWritingEnabled,
-		sequenceMatching, sequenceMatchingLength, tileMatching, tileNum, tilePercent, pairMatching);
+		sequenceMatching, sequenceMatchingLength, tileMatching, tileNum, tilePercent, pairMatching, cpuMatching, nbThread,
+		compactDescriptors, featureCacheSize, featureDatabase, matchStreaming, incrementalMatching,
+		retrievalNeighbours, approximateChecks, verifyThreshold, checkpointPeriod, shardIndex, shardCount, cpuExtraction, extractionMemory);
 	matcher.open(std::string(argv[1]), std::string(argv[2]), std::string(argv[3]),pairfile);
 	
 	return 0;
@@ -0,0 +1,171 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include "KeyFile.h"
+
+//Golden file: formatAsciiKeyFile must give the bytes of the former std::ostream code
+//(KeyFileTest.key was written by it from the same fixture)
+
+static int sNbFailure = 0;
+
+#define CHECK(condition) if (!(condition)) { std::cout << "FAILED line " << __LINE__ << ": " #condition << std::endl; ++sNbFailure; }
+
+static unsigned int sSeed = 1;
+
+static unsigned int nextRandom()
+{
+	sSeed = sSeed*1103515245 + 12345;
+	return (sSeed >> 16) & 0x7FFF;
+}
+
+static void addPoint(FeatureInfo& info, float y, float x, float scale, float orientation)
+{
+	SiftGPU::SiftKeypoint point;
+	point.x = x;
+	point.y = y;
+	point.s = scale;
+	point.o = orientation;
+	info.points.push_back(point);
+}
+
+//values printed the same way by every CRT: zeros, negatives, decimal ties which are not
+//exact in binary (1.005 is 1.00499999...), huge values with few significant digits
+static void createFixture(FeatureInfo& info)
+{
+	addPoint(info, 0.0f, 0.0f, 0.0f, 0.0f);
+	addPoint(info, -1e-8f, -0.0004f, -1e-8f, -0.0004f); //rounded to zero, sign kept
+	addPoint(info, 1.005f, 2.675f, 0.0015f, 1.0005f);
+	addPoint(info, -1.005f, -2.675f, -0.0015f, -1.0005f);
+	addPoint(info, 0.994999f, 9.995f, 9.9995f, 0.9995f);  //carry into the integral part
+	addPoint(info, 4294967.5f, 4194303.9f, 4294967.0f, 4194303.9f); //around the 4e9 fast path limit
+	addPoint(info, 4.0e9f, -4.0e9f, 1099511627776.0f, -1099511627776.0f);
+	addPoint(info, 1543.2871f, 1023.9999f, 3.1415927f, -3.1415927f);
+
+	//descriptors: zeros, 0.5/512 ties of floor(0.5+512*d), values above 255 (not clamped)
+	info.descriptors.assign(info.points.size()*128, 0.0f);
+	for (int k=0; k<128; ++k)
+	{
+		info.descriptors[128+k]   = k/512.0f;
+		info.descriptors[2*128+k] = (k+0.5f)/512.0f;
+		info.descriptors[3*128+k] = (255+k)/512.0f;
+		info.descriptors[4*128+k] = 1.0f;
+		info.descriptors[5*128+k] = 100.0f;
+	}
+
+	//random key-points of typical images
+	for (int i=0; i<50; ++i)
+	{
+		addPoint(info, (nextRandom() % 300000)/100.0f + nextRandom()/32768.0f/100.0f, (nextRandom() % 400000)/100.0f + nextRandom()/32768.0f/100.0f,
+			1.0f + (nextRandom() % 40000)/1000.0f, (nextRandom() % 6283)/1000.0f - 3.1415f);
+		for (int k=0; k<128; ++k)
+			info.descriptors.push_back((nextRandom() % 4 == 0) ? (nextRandom() % 200)/512.0f : 0.0f);
+	}
+}
+
+//exact binary ties and signed zeros are formatted by the CRT (as std::ostream does): compared with sprintf
+static void checkCrtValues()
+{
+	const float values[] = {0.125f, -0.375f, 2.5f, 0.0625f, -0.0f, 1e20f, -1e30f};
+	for (unsigned int i=0; i<sizeof(values)/sizeof(values[0]); ++i)
+	{
+		FeatureInfo info(0, 0);
+		addPoint(info, values[i], values[i], values[i], values[i]);
+		info.descriptors.assign(128, 0.0f);
+
+		std::vector<char> buffer;
+		formatAsciiKeyFile(info, buffer);
+
+		char expected[1024];
+		sprintf(expected, "1 128\n%.2f %.2f %.3f %.3f\n", values[i], values[i], values[i], values[i]);
+		CHECK(buffer.size() >= strlen(expected) && memcmp(&buffer[0], expected, strlen(expected)) == 0);
+	}
+}
+
+//the reference must parse back to the fixture, a truncated text or a count the text can not hold must not
+static void checkParse(const FeatureInfo& fixture, const std::vector<char>& reference)
+{
+	FeatureInfo info(0, 0);
+	CHECK(parseAsciiKeyFile(&reference[0], reference.size(), info, true) == (int) fixture.points.size());
+	CHECK(info.points.size() == fixture.points.size());
+	CHECK(info.compactDescriptors.size() == 128*fixture.points.size());
+	for (size_t i=0; i<info.points.size() && i<fixture.points.size(); ++i)
+	{
+		CHECK(fabs(info.points[i].x - fixture.points[i].x) <= 0.005f*std::max(1.0f, fabs(fixture.points[i].x)));
+		CHECK(fabs(info.points[i].y - fixture.points[i].y) <= 0.005f*std::max(1.0f, fabs(fixture.points[i].y)));
+	}
+
+	FeatureInfo truncated(0, 0);
+	CHECK(parseAsciiKeyFile(&reference[0], reference.size()/2, truncated, true) == -1);
+
+	//33554432*128 wraps to 0 in 32 bits, the descriptors of the first key-point would overflow
+	std::string oversized = "33554432 128\n1 2 3 4\n";
+	for (int k=0; k<128; ++k)
+		oversized += " 1";
+	FeatureInfo huge(0, 0);
+	CHECK(parseAsciiKeyFile(oversized.c_str(), oversized.size(), huge, false) == -1);
+	CHECK(huge.points.empty() && huge.descriptors.empty());
+
+	const char* empty = "0 128\n";
+	FeatureInfo none(0, 0);
+	CHECK(parseAsciiKeyFile(empty, strlen(empty), none, false) == 0);
+}
+
+int main(int argc, char* argv[])
+{
+	std::string filename = (argc > 1 ? argv[1] : "KeyFileTest.key");
+
+	FeatureInfo info(0, 0);
+	createFixture(info);
+	std::vector<char> buffer;
+	formatAsciiKeyFile(info, buffer);
+
+	std::ifstream input(filename.c_str(), std::ios::in | std::ios::binary);
+	std::vector<char> reference((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+	CHECK(input.is_open());
+	CHECK(buffer.size() == reference.size());
+	size_t nbByte = std::min(buffer.size(), reference.size());
+	size_t first = 0;
+	while (first < nbByte && buffer[first] == reference[first])
+		++first;
+	CHECK(first == nbByte);
+	if (first < nbByte || buffer.size() != reference.size())
+		std::cout << "first difference at byte " << first << std::endl;
+
+	if (!reference.empty())
+		checkParse(info, reference);
+	checkCrtValues();
+
+	if (sNbFailure == 0)
+		std::cout << "KeyFileTest: OK" << std::endl;
+
+	return sNbFailure == 0 ? 0 : 1;
+}
@@ -24,6 +24,8 @@
 
 #include <Ogre.h>
 
+#include "SiftFile.h"
+
 struct BundlerCamera
 {
 	BundlerCamera(Ogre::Real _focalLength, Ogre::Real _radialDistort1, Ogre::Real _radialDistort2, Ogre::Matrix3 _rotation, Ogre::Vector3 _translation);
@@ -78,7 +80,7 @@ class BundlerToTracking
 		void logerror(const std::string& reason);
 		void parseFile(const std::string& filename);
 		void parseFileList(const std::string& filename);
-		std::vector<BundlerFeature> getFeaturesBin(const std::string& baseFilename);
+		std::vector<BundlerFeature> getFeatures(const SiftFile::Reader& input);
 
 		std::vector<BundlerCamera>  mCameras;
 		std::vector<Bundler3DPoint> m3DPoints;
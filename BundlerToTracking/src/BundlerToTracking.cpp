@@ -73,11 +73,21 @@ void BundlerToTracking::open(const std::string& inputPath, const std::string& bu
 {
 	parseFile(bundlerFilename);
 	parseFileList(bundlerListJpeg);
+
+	//BundlerMatcher can pack the features of all images in one database instead of .key.bin files
+	SiftFile::Database database;
+	database.open(inputPath + "features.db", true);
+
 	for (unsigned int i=0; i<mFilenames.size(); ++i)
 	{
-		std::stringstream filepath;
-		filepath << inputPath << mFilenames[i];
-		std::vector<BundlerFeature> features = getFeaturesBin(filepath.str());
+		SiftFile::Reader reader;
+		if (!database.read(mFilenames[i], reader))
+		{
+			std::stringstream filepath;
+			filepath << inputPath << mFilenames[i].substr(0, mFilenames[i].size()-4) << ".key.bin";
+			reader.open(filepath.str());
+		}
+		std::vector<BundlerFeature> features = getFeatures(reader);
 		mFeatures.push_back(features);
 	}	
 }
@@ -270,32 +280,24 @@ void BundlerToTracking::parseFile(const std::string& filename)
 	input.close();
 }
 
-std::vector<BundlerFeature> BundlerToTracking::getFeaturesBin(const std::string& baseFilename)
+std::vector<BundlerFeature> BundlerToTracking::getFeatures(const SiftFile::Reader& input)
 {
-	std::stringstream filename;
-	filename << baseFilename.substr(0, baseFilename.size()-4) << ".key.bin";	
 	std::vector<BundlerFeature> features;
 
-	std::ifstream input;
-	input.open(filename.str().c_str(), std::ios::binary);
-	if (input.is_open())
+	//current and legacy .key.bin layouts are handled by SiftFile::Reader (no feature if it failed to open)
+	unsigned int nbFeature = input.getFeatureCount();
+	const float* x           = input.getX();
+	const float* y           = input.getY();
+	const float* scale       = input.getScale();
+	const float* orientation = input.getOrientation();
+
+	features.reserve(nbFeature);
+	for (unsigned int i=0; i<nbFeature; ++i)
 	{
-		int nbFeature;
-		input.read((char*)&nbFeature, sizeof(int));
-		
-		for (int i=0; i<nbFeature; ++i)
-		{			
-			float x, y, scale, orientation;
-			float descriptor[128];
-			input.read((char*)&x, sizeof(x));
-			input.read((char*)&y, sizeof(y));
-			input.read((char*)&scale, sizeof(scale));
-			input.read((char*)&orientation, sizeof(orientation));
-			input.read((char*)&descriptor[0], sizeof(float)*128);
-			features.push_back(BundlerFeature(Ogre::Vector2(x,y), scale, orientation, descriptor));
-		}
+		float descriptor[128];
+		input.getDescriptor(i, descriptor);
+		features.push_back(BundlerFeature(Ogre::Vector2(x[i],y[i]), scale[i], orientation[i], descriptor));
 	}
-	input.close();
 
 	return features;
 }
\ No newline at end of file
@@ -0,0 +1,51 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <string>
+
+//Read-only memory mapping of a whole file or of a range of a file
+class MappedFile
+{
+	public:
+		MappedFile();
+		~MappedFile();
+
+		bool open(const std::string& filename);
+		bool open(const std::string& filename, unsigned long long offset, size_t size);
+		void close();
+
+		const char* getData() const { return mData; }
+		size_t getSize() const { return mSize; }
+
+	protected:
+		void*       mFile;
+		void*       mMapping;
+		void*       mView;     //mapping start (aligned on page or allocation granularity)
+		size_t      mViewSize;
+		const char* mData;
+		size_t      mSize;
+};
+
+//Shrink a file to size bytes (the file must not be mapped)
+bool truncateFile(const std::string& filename, unsigned long long size);
@@ -0,0 +1,155 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdio.h>
+
+#include "MappedFile.h"
+
+//Binary match file (compact replacement of gpu.matches.txt)
+//
+//Layout:
+//  MatchFileHeader
+//  one record per pair, appended as pairs are matched (any order): for each match
+//  the zigzag varint delta of the feature index in image A and the varint feature index in image B
+//  index: one MatchFileEntry per pair sorted by (indexA, indexB)
+//  MatchFileFooter
+//
+//Match log (checkpoint of the pairs matched so far, append only):
+//  MatchFileHeader ("SIFL")
+//  one MatchLogEntry followed by its record per pair, the log can be cut anywhere by a crash:
+//  readers stop at the first incomplete or corrupted entry
+namespace SiftFile
+{
+	typedef std::pair<unsigned int, unsigned int> FeatureMatch;
+	typedef std::vector<FeatureMatch> FeatureMatches;
+
+	struct MatchFileHeader
+	{
+		char         magic[4]; //"SIFM"
+		unsigned int version;
+		unsigned int byteOrder;
+		unsigned int nbImage;
+	};
+
+	struct MatchFileEntry
+	{
+		unsigned int       indexA;
+		unsigned int       indexB;
+		unsigned int       nbMatch;
+		unsigned int       size;   //record size in bytes
+		unsigned long long offset; //record offset in the file
+	};
+
+	struct MatchFileFooter
+	{
+		char               magic[4]; //"SIFM"
+		unsigned int       nbPair;
+		unsigned long long indexOffset;
+		unsigned int       indexChecksum; //crc32 of the index
+		unsigned int       reserved;
+	};
+
+	struct MatchLogEntry
+	{
+		unsigned int indexA;
+		unsigned int indexB;
+		unsigned int nbMatch;
+		unsigned int size;     //record size in bytes
+		unsigned int checksum; //crc32 of the 4 fields above and of the record
+	};
+
+	//Encode the matches of one pair (can be called from any thread)
+	void encodeMatches(const FeatureMatches& matches, std::vector<unsigned char>& record);
+
+	//Append encoded pairs to a match file, the index is written by close()
+	//append() must not be called concurrently.
+	class MatchWriter
+	{
+		public:
+			MatchWriter();
+			~MatchWriter();
+
+			bool open(const std::string& filename, unsigned int nbImage);
+			bool append(unsigned int indexA, unsigned int indexB, unsigned int nbMatch, const std::vector<unsigned char>& record);
+			bool close();
+
+			bool isOpen() const { return mOutput.is_open(); }
+
+		protected:
+			std::ofstream               mOutput;
+			unsigned long long          mOffset;
+			std::vector<MatchFileEntry> mIndex;
+	};
+
+	//Append encoded pairs to a match log, sync() makes the entries appended so far durable
+	//append() and sync() must not be called concurrently.
+	class MatchLog
+	{
+		public:
+			MatchLog();
+			~MatchLog();
+
+			bool open(const std::string& filename, unsigned int nbImage); //existing file is replaced
+			bool append(unsigned int indexA, unsigned int indexB, unsigned int nbMatch, const std::vector<unsigned char>& record);
+			bool sync();
+			bool close();
+
+			bool isOpen() const { return mOutput != NULL; }
+
+		protected:
+			FILE* mOutput;
+	};
+
+	//Read a match file in place from a memory mapping, pairs are sorted by (indexA, indexB)
+	class MatchReader
+	{
+		public:
+			MatchReader();
+
+			bool open(const std::string& filename);
+			bool openLog(const std::string& filename); //complete entries of a match log
+			void close();
+
+			unsigned int getImageCount() const { return mHeader.nbImage; }
+			unsigned int getPairCount() const  { return (unsigned int) mIndex.size(); }
+			const MatchFileEntry& getPair(unsigned int index) const { return mIndex[index]; }
+
+			bool getMatches(unsigned int index, FeatureMatches& matches) const;
+			const unsigned char* getRecord(unsigned int index) const; //encoded matches (getPair(index).size bytes)
+
+		protected:
+			MappedFile                  mFile;
+			MatchFileHeader             mHeader;
+			std::vector<MatchFileEntry> mIndex;
+	};
+
+	//Write pairs in Bundler text format (gpu.matches.txt)
+	bool writeMatchText(const MatchReader& reader, const std::string& filename);
+
+	//Append pairs of a Bundler text match file to a binary match file
+	bool readMatchText(const std::string& filename, MatchWriter& writer);
+}
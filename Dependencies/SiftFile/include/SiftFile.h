@@ -0,0 +1,194 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+
+#include "MappedFile.h"
+
+//Binary feature container (.key.bin) shared by BundlerMatcher and BundlerToTracking
+//
+//Layout (little-endian, native float):
+//  Header (64 bytes)
+//  x[n], y[n], scale[n], orientation[n] float arrays, each starting on a 64 bytes boundary
+//  n descriptors of 128 floats or 128 bytes starting on a 64 bytes boundary
+//Files written before the header existed (int count + 132 floats per key-point) are still read.
+//Version 1 files are rejected (their checksum did not cover the header), .key files are used instead.
+//
+//A project Database packs these files in a single file:
+//  files (each starting on a 64 bytes boundary), index, DatabaseFooter
+//Appending writes after the last footer, commit() appends a new index and footer.
+//Files appended after the last commit() are dropped (truncated) by the next open.
+namespace SiftFile
+{
+	enum DescriptorType
+	{
+		DESCRIPTOR_FLOAT = 0, //normalized to 1.0 as returned by SiftGPU
+		DESCRIPTOR_UCHAR = 1  //floor(0.5+512*d) as stored in .key files
+	};
+
+	enum
+	{
+		VERSION         = 1,
+		FEATURE_VERSION = 2, //version 1 checksum did not cover the header
+		ALIGNMENT       = 64
+	};
+
+	struct Header
+	{
+		char         magic[4];         //"SIFB"
+		unsigned int version;
+		unsigned int byteOrder;        //0x01020304 as written by the host
+		int          width;            //image width (0 if unknown)
+		int          height;           //image height (0 if unknown)
+		unsigned int nbFeature;
+		unsigned int descriptorType;   //DescriptorType
+		unsigned int keyPointOffset;   //offset of the x array
+		unsigned int keyPointStride;   //distance between x, y, scale and orientation arrays
+		unsigned int descriptorOffset; //offset of the first descriptor
+		unsigned int fileSize;
+		unsigned int checksum;         //crc32 of the whole file with this field set to 0
+		unsigned int reserved[4];
+	};
+
+	struct DatabaseFooter
+	{
+		char               magic[4];      //"SIFD"
+		unsigned int       version;
+		unsigned long long indexOffset;
+		unsigned long long indexSize;
+		unsigned int       indexChecksum; //crc32 of the index
+		unsigned int       byteOrder;
+		unsigned int       reserved[2];
+	};
+
+	unsigned int crc32(const void* data, size_t size, unsigned int crc = 0);
+
+	//Build a file in memory: fill arrays returned by the getters then save
+	class Writer
+	{
+		public:
+			Writer(unsigned int nbFeature, DescriptorType type, int width = 0, int height = 0);
+
+			float* getX();
+			float* getY();
+			float* getScale();
+			float* getOrientation();
+			float* getFloatDescriptor(unsigned int index);         //DESCRIPTOR_FLOAT only
+			unsigned char* getUcharDescriptor(unsigned int index); //DESCRIPTOR_UCHAR only
+
+			bool save(const std::string& filename); //checksum then one write
+			bool write(std::ostream& output);
+			size_t getSize() const { return mBuffer.size(); }
+
+		protected:
+			friend class Reader;
+
+			Header& getHeader();
+
+			std::vector<char> mBuffer;
+	};
+
+	//Read a file in place from a memory mapping (legacy files are converted in memory)
+	class Reader
+	{
+		public:
+			Reader();
+
+			bool open(const std::string& filename, bool verifyChecksum = true);
+			bool open(const std::string& filename, unsigned long long offset, size_t size, bool verifyChecksum = true);
+			bool open(const char* data, size_t size, bool verifyChecksum = true); //data is not copied
+			void close();
+
+			int getWidth() const             { return mHeader.width; }
+			int getHeight() const            { return mHeader.height; }
+			unsigned int getFeatureCount() const { return mHeader.nbFeature; }
+			DescriptorType getDescriptorType() const { return (DescriptorType) mHeader.descriptorType; }
+			bool isLegacy() const            { return mHeader.version == 0; }
+
+			const float* getX() const;
+			const float* getY() const;
+			const float* getScale() const;
+			const float* getOrientation() const;
+			const float* getFloatDescriptor(unsigned int index) const;         //DESCRIPTOR_FLOAT only
+			const unsigned char* getUcharDescriptor(unsigned int index) const; //DESCRIPTOR_UCHAR only
+
+			//descriptor value normalized to 1.0 whatever the storage
+			void getDescriptor(unsigned int index, float* descriptor) const;
+			//descriptor value as stored in .key file whatever the storage
+			void getQuantizedDescriptor(unsigned int index, unsigned char* descriptor) const;
+
+		protected:
+			bool parse(const char* data, size_t size, bool verifyChecksum);
+			bool parseLegacy(const char* data, size_t size);
+
+			Header            mHeader;
+			MappedFile        mFile;
+			const char*       mData;
+			std::vector<char> mLegacyData; //legacy file converted to the current layout
+	};
+
+	//Project feature database: one file for all images instead of one file per image
+	//append() and commit() must not be called concurrently, read() can be called from
+	//several threads once nothing is appended anymore.
+	class Database
+	{
+		public:
+			Database();
+			~Database();
+
+			bool open(const std::string& filename, bool readOnly = false); //false if the file exists but has no valid index
+			void close();
+
+			bool isOpen() const { return !mFilename.empty(); }
+			bool isReadOnly() const { return mReadOnly; } //never modified: no truncation, append() fails
+			bool contains(const std::string& name) const;
+			unsigned int getRecordCount() const { return (unsigned int) mIndex.size(); }
+
+			bool read(const std::string& name, Reader& reader, bool verifyChecksum = true) const;
+			bool append(const std::string& name, Writer& writer);
+			bool commit(); //make appended files visible to the next open
+
+		protected:
+			struct Record
+			{
+				unsigned long long offset;
+				unsigned long long size;
+			};
+
+			bool findIndex(unsigned long long& committedSize);
+			bool readIndex(std::istream& input, const DatabaseFooter& footer);
+			bool writePadding();
+
+			std::string                   mFilename;
+			std::map<std::string, Record> mIndex;
+			unsigned long long            mFileSize;
+			bool                          mModified;
+			bool                          mReadOnly;
+			std::ofstream                 mOutput;
+			MappedFile                    mMapping; //whole file when the address space is large enough
+	};
+}
@@ -0,0 +1,220 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include "MappedFile.h"
+
+#ifdef _WIN32
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+#define WHOLE_FILE ((size_t) -1)
+
+MappedFile::MappedFile()
+{
+	mFile     = NULL;
+	mMapping  = NULL;
+	mView     = NULL;
+	mViewSize = 0;
+	mData     = NULL;
+	mSize     = 0;
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const std::string& filename)
+{
+	return open(filename, 0, WHOLE_FILE);
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& filename, unsigned long long offset, size_t size)
+{
+	close();
+
+	//the file can still be appended by a writer while it is mapped
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	mFile = file;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+	{
+		close();
+		return false;
+	}
+
+	unsigned long long total = (unsigned long long) fileSize.QuadPart;
+	if (size == WHOLE_FILE)
+	{
+		if (total > (size_t) -1)
+		{
+			close();
+			return false;
+		}
+		size = (size_t) total;
+	}
+	if (offset > total || size > total - offset)
+	{
+		close();
+		return false;
+	}
+
+	//empty ranges can not be mapped
+	if (size == 0)
+		return true;
+
+	HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping)
+	{
+		close();
+		return false;
+	}
+	mMapping = mapping;
+
+	//views must start on the allocation granularity
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	size_t delta = (size_t) (offset % info.dwAllocationGranularity);
+	unsigned long long viewOffset = offset - delta;
+
+	mView = MapViewOfFile(mapping, FILE_MAP_READ, (DWORD) (viewOffset >> 32), (DWORD) (viewOffset & 0xFFFFFFFF), size + delta);
+	if (!mView)
+	{
+		close();
+		return false;
+	}
+	mViewSize = size + delta;
+	mData     = (const char*) mView + delta;
+	mSize     = size;
+
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (mView)
+		UnmapViewOfFile(mView);
+	if (mMapping)
+		CloseHandle((HANDLE) mMapping);
+	if (mFile)
+		CloseHandle((HANDLE) mFile);
+
+	mFile     = NULL;
+	mMapping  = NULL;
+	mView     = NULL;
+	mViewSize = 0;
+	mData     = NULL;
+	mSize     = 0;
+}
+
+bool truncateFile(const std::string& filename, unsigned long long size)
+{
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER position;
+	position.QuadPart = (LONGLONG) size;
+	bool truncated = SetFilePointerEx(file, position, NULL, FILE_BEGIN) && SetEndOfFile(file);
+	CloseHandle(file);
+
+	return truncated;
+}
+
+#else
+
+bool MappedFile::open(const std::string& filename, unsigned long long offset, size_t size)
+{
+	close();
+
+	int file = ::open(filename.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat status;
+	if (fstat(file, &status) != 0)
+	{
+		::close(file);
+		return false;
+	}
+
+	unsigned long long total = (unsigned long long) status.st_size;
+	if (size == WHOLE_FILE)
+		size = (size_t) total;
+	if (offset > total || size > total - offset)
+	{
+		::close(file);
+		return false;
+	}
+
+	//empty ranges can not be mapped, the descriptor is not needed once the file is mapped
+	if (size > 0)
+	{
+		//views must start on a page boundary
+		size_t delta = (size_t) (offset % sysconf(_SC_PAGESIZE));
+		void* view = mmap(NULL, size + delta, PROT_READ, MAP_PRIVATE, file, (off_t) (offset - delta));
+		if (view == MAP_FAILED)
+		{
+			::close(file);
+			return false;
+		}
+		madvise(view, size + delta, MADV_SEQUENTIAL);
+		mView     = view;
+		mViewSize = size + delta;
+		mData     = (const char*) view + delta;
+		mSize     = size;
+	}
+	::close(file);
+
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (mView)
+		munmap(mView, mViewSize);
+
+	mView     = NULL;
+	mViewSize = 0;
+	mData     = NULL;
+	mSize     = 0;
+}
+
+bool truncateFile(const std::string& filename, unsigned long long size)
+{
+	return truncate(filename.c_str(), (off_t) size) == 0;
+}
+
+#endif
@@ -0,0 +1,475 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include "MatchFile.h"
+#include "SiftFile.h"
+
+#include <algorithm>
+#include <string.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+	#include <io.h>
+#else
+	#include <unistd.h>
+#endif
+
+using namespace SiftFile;
+
+#define BYTE_ORDER_MARK 0x01020304
+
+static inline void writeVarint(std::vector<unsigned char>& record, unsigned int value)
+{
+	while (value >= 0x80)
+	{
+		record.push_back((unsigned char) (value | 0x80));
+		value >>= 7;
+	}
+	record.push_back((unsigned char) value);
+}
+
+static inline bool readVarint(const unsigned char*& cursor, const unsigned char* end, unsigned int& value)
+{
+	value = 0;
+	for (int shift = 0; shift < 35 && cursor < end; shift += 7)
+	{
+		unsigned char byte = *cursor++;
+		value |= (unsigned int) (byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+void SiftFile::encodeMatches(const FeatureMatches& matches, std::vector<unsigned char>& record)
+{
+	record.clear();
+	record.reserve(matches.size()*3);
+
+	//feature indices in image A mostly increase: zigzag delta, indices in image B are random: raw
+	unsigned int previous = 0;
+	for (size_t i=0; i<matches.size(); ++i)
+	{
+		int delta = (int) (matches[i].first - previous);
+		writeVarint(record, ((unsigned int) delta << 1) ^ (unsigned int) (delta >> 31));
+		writeVarint(record, matches[i].second);
+		previous = matches[i].first;
+	}
+}
+
+static bool compareEntry(const MatchFileEntry& a, const MatchFileEntry& b)
+{
+	if (a.indexA != b.indexA)
+		return a.indexA < b.indexA;
+	return a.indexB < b.indexB;
+}
+
+MatchWriter::MatchWriter()
+{
+	mOffset = 0;
+}
+
+MatchWriter::~MatchWriter()
+{
+	close();
+}
+
+bool MatchWriter::open(const std::string& filename, unsigned int nbImage)
+{
+	close();
+
+	mOutput.open(filename.c_str(), std::ios::out | std::ios::binary);
+	if (!mOutput.is_open())
+		return false;
+
+	MatchFileHeader header;
+	memcpy(header.magic, "SIFM", 4);
+	header.version   = VERSION;
+	header.byteOrder = BYTE_ORDER_MARK;
+	header.nbImage   = nbImage;
+
+	mOutput.write((const char*) &header, sizeof(header));
+	mOffset = sizeof(header);
+	mIndex.clear();
+
+	return !mOutput.fail();
+}
+
+bool MatchWriter::append(unsigned int indexA, unsigned int indexB, unsigned int nbMatch, const std::vector<unsigned char>& record)
+{
+	if (!mOutput.is_open())
+		return false;
+
+	MatchFileEntry entry;
+	entry.indexA  = indexA;
+	entry.indexB  = indexB;
+	entry.nbMatch = nbMatch;
+	entry.size    = (unsigned int) record.size();
+	entry.offset  = mOffset;
+
+	if (!record.empty())
+		mOutput.write((const char*) &record[0], record.size());
+	mOffset += record.size();
+	mIndex.push_back(entry);
+
+	return !mOutput.fail();
+}
+
+bool MatchWriter::close()
+{
+	if (!mOutput.is_open())
+		return true;
+
+	std::sort(mIndex.begin(), mIndex.end(), compareEntry);
+
+	MatchFileFooter footer;
+	memset(&footer, 0, sizeof(footer));
+	memcpy(footer.magic, "SIFM", 4);
+	footer.nbPair        = (unsigned int) mIndex.size();
+	footer.indexOffset   = mOffset;
+	footer.indexChecksum = crc32(mIndex.empty() ? NULL : &mIndex[0], mIndex.size()*sizeof(MatchFileEntry));
+
+	if (!mIndex.empty())
+		mOutput.write((const char*) &mIndex[0], mIndex.size()*sizeof(MatchFileEntry));
+	mOutput.write((const char*) &footer, sizeof(footer));
+	mOutput.close();
+
+	mIndex.clear();
+	mOffset = 0;
+
+	return !mOutput.fail();
+}
+
+static unsigned int logEntryChecksum(const MatchLogEntry& entry, const void* record)
+{
+	unsigned int crc = crc32(&entry, offsetof(MatchLogEntry, checksum));
+	return crc32(record, entry.size, crc);
+}
+
+MatchLog::MatchLog()
+{
+	mOutput = NULL;
+}
+
+MatchLog::~MatchLog()
+{
+	close();
+}
+
+bool MatchLog::open(const std::string& filename, unsigned int nbImage)
+{
+	close();
+
+	mOutput = fopen(filename.c_str(), "wb");
+	if (!mOutput)
+		return false;
+
+	MatchFileHeader header;
+	memcpy(header.magic, "SIFL", 4);
+	header.version   = VERSION;
+	header.byteOrder = BYTE_ORDER_MARK;
+	header.nbImage   = nbImage;
+
+	return fwrite(&header, sizeof(header), 1, mOutput) == 1 && sync();
+}
+
+bool MatchLog::append(unsigned int indexA, unsigned int indexB, unsigned int nbMatch, const std::vector<unsigned char>& record)
+{
+	if (!mOutput)
+		return false;
+
+	MatchLogEntry entry;
+	entry.indexA   = indexA;
+	entry.indexB   = indexB;
+	entry.nbMatch  = nbMatch;
+	entry.size     = (unsigned int) record.size();
+	entry.checksum = logEntryChecksum(entry, record.empty() ? NULL : &record[0]);
+
+	bool valid = fwrite(&entry, sizeof(entry), 1, mOutput) == 1;
+	if (valid && !record.empty())
+		valid = fwrite(&record[0], record.size(), 1, mOutput) == 1;
+
+	return valid;
+}
+
+bool MatchLog::sync()
+{
+	if (!mOutput)
+		return false;
+
+	//stdio buffer to the OS, then OS cache to the disk
+	if (fflush(mOutput) != 0)
+		return false;
+#ifdef _WIN32
+	return _commit(_fileno(mOutput)) == 0;
+#else
+	return fsync(fileno(mOutput)) == 0;
+#endif
+}
+
+bool MatchLog::close()
+{
+	if (!mOutput)
+		return true;
+
+	bool valid = sync();
+	valid = (fclose(mOutput) == 0) && valid;
+	mOutput = NULL;
+
+	return valid;
+}
+
+MatchReader::MatchReader()
+{
+	memset(&mHeader, 0, sizeof(mHeader));
+}
+
+bool MatchReader::open(const std::string& filename)
+{
+	close();
+
+	if (!mFile.open(filename))
+		return false;
+
+	const char* data = mFile.getData();
+	size_t size = mFile.getSize();
+
+	MatchFileFooter footer;
+	bool valid = size >= sizeof(MatchFileHeader) + sizeof(MatchFileFooter);
+	if (valid)
+	{
+		memcpy(&mHeader, data, sizeof(mHeader));
+		memcpy(&footer, data + size - sizeof(footer), sizeof(footer));
+		valid = memcmp(mHeader.magic, "SIFM", 4) == 0 && mHeader.version == VERSION && mHeader.byteOrder == BYTE_ORDER_MARK &&
+			memcmp(footer.magic, "SIFM", 4) == 0 && footer.indexOffset <= size - sizeof(footer) &&
+			(size - sizeof(footer) - footer.indexOffset) == (unsigned long long) footer.nbPair*sizeof(MatchFileEntry);
+	}
+
+	if (valid)
+	{
+		mIndex.resize(footer.nbPair);
+		if (!mIndex.empty())
+			memcpy(&mIndex[0], data + footer.indexOffset, mIndex.size()*sizeof(MatchFileEntry));
+		valid = crc32(mIndex.empty() ? NULL : &mIndex[0], mIndex.size()*sizeof(MatchFileEntry)) == footer.indexChecksum;
+
+		for (size_t i=0; valid && i<mIndex.size(); ++i)
+			valid = mIndex[i].offset >= sizeof(MatchFileHeader) && mIndex[i].offset + mIndex[i].size <= footer.indexOffset;
+	}
+
+	if (!valid)
+		close();
+
+	return valid;
+}
+
+bool MatchReader::openLog(const std::string& filename)
+{
+	close();
+
+	if (!mFile.open(filename))
+		return false;
+
+	const char* data = mFile.getData();
+	size_t size = mFile.getSize();
+
+	bool valid = size >= sizeof(MatchFileHeader);
+	if (valid)
+	{
+		memcpy(&mHeader, data, sizeof(mHeader));
+		valid = memcmp(mHeader.magic, "SIFL", 4) == 0 && mHeader.version == VERSION && mHeader.byteOrder == BYTE_ORDER_MARK;
+	}
+
+	if (valid)
+	{
+		//entries are complete up to the last sync: the tail written after it may be cut or garbage
+		size_t offset = sizeof(MatchFileHeader);
+		while (size - offset >= sizeof(MatchLogEntry))
+		{
+			MatchLogEntry logEntry;
+			memcpy(&logEntry, data + offset, sizeof(logEntry));
+			size_t recordOffset = offset + sizeof(logEntry);
+			if (logEntry.size > size - recordOffset || logEntryChecksum(logEntry, data + recordOffset) != logEntry.checksum)
+				break;
+
+			MatchFileEntry entry;
+			entry.indexA  = logEntry.indexA;
+			entry.indexB  = logEntry.indexB;
+			entry.nbMatch = logEntry.nbMatch;
+			entry.size    = logEntry.size;
+			entry.offset  = recordOffset;
+			mIndex.push_back(entry);
+
+			offset = recordOffset + logEntry.size;
+		}
+		std::stable_sort(mIndex.begin(), mIndex.end(), compareEntry);
+	}
+
+	if (!valid)
+		close();
+
+	return valid;
+}
+
+void MatchReader::close()
+{
+	mFile.close();
+	mIndex.clear();
+	memset(&mHeader, 0, sizeof(mHeader));
+}
+
+bool MatchReader::getMatches(unsigned int index, FeatureMatches& matches) const
+{
+	const MatchFileEntry& entry = mIndex[index];
+	const unsigned char* cursor = (const unsigned char*) mFile.getData() + entry.offset;
+	const unsigned char* end    = cursor + entry.size;
+
+	//each match takes at least 2 bytes: a count the record can not hold is corrupt
+	if (entry.nbMatch > entry.size/2)
+		return false;
+
+	matches.resize(entry.nbMatch);
+
+	unsigned int previous = 0;
+	for (unsigned int i=0; i<entry.nbMatch; ++i)
+	{
+		unsigned int zigzag;
+		unsigned int second;
+		if (!readVarint(cursor, end, zigzag) || !readVarint(cursor, end, second))
+			return false;
+
+		int delta = (int) (zigzag >> 1) ^ -(int) (zigzag & 1);
+		previous += (unsigned int) delta;
+		matches[i] = FeatureMatch(previous, second);
+	}
+
+	return true;
+}
+
+const unsigned char* MatchReader::getRecord(unsigned int index) const
+{
+	return (const unsigned char*) mFile.getData() + mIndex[index].offset;
+}
+
+static inline char* formatUnsigned(char* out, unsigned int value)
+{
+	char digits[10];
+	int nbDigit = 0;
+	do
+	{
+		digits[nbDigit++] = (char) ('0' + value%10);
+		value /= 10;
+	}
+	while (value);
+
+	while (nbDigit)
+		*out++ = digits[--nbDigit];
+
+	return out;
+}
+
+bool SiftFile::writeMatchText(const MatchReader& reader, const std::string& filename)
+{
+	std::ofstream output(filename.c_str());
+	if (!output.is_open())
+		return false;
+
+	//one buffer per pair: "indexA indexB", "nbMatch" then one "featureA featureB" line per match
+	FeatureMatches matches;
+	std::vector<char> buffer;
+	bool valid = true;
+	for (unsigned int i=0; i<reader.getPairCount() && valid; ++i)
+	{
+		const MatchFileEntry& entry = reader.getPair(i);
+		valid = reader.getMatches(i, matches);
+
+		buffer.resize(3*11 + 3 + matches.size()*22);
+		char* out = &buffer[0];
+		out = formatUnsigned(out, entry.indexA);
+		*out++ = ' ';
+		out = formatUnsigned(out, entry.indexB);
+		*out++ = '\n';
+		out = formatUnsigned(out, entry.nbMatch);
+		*out++ = '\n';
+		for (size_t j=0; j<matches.size(); ++j)
+		{
+			out = formatUnsigned(out, matches[j].first);
+			*out++ = ' ';
+			out = formatUnsigned(out, matches[j].second);
+			*out++ = '\n';
+		}
+		output.write(&buffer[0], out - &buffer[0]);
+	}
+	output.close();
+
+	return valid && !output.fail();
+}
+
+static bool parseUnsigned(const char*& cursor, const char* end, unsigned int& value)
+{
+	while (cursor < end && (*cursor == ' ' || *cursor == '\n' || *cursor == '\r' || *cursor == '\t'))
+		++cursor;
+	if (cursor == end || *cursor < '0' || *cursor > '9')
+		return false;
+
+	value = 0;
+	while (cursor < end && *cursor >= '0' && *cursor <= '9')
+		value = value*10 + (*cursor++ - '0');
+
+	return true;
+}
+
+bool SiftFile::readMatchText(const std::string& filename, MatchWriter& writer)
+{
+	MappedFile input;
+	if (!input.open(filename))
+		return false;
+
+	const char* cursor = input.getData();
+	const char* end    = cursor + input.getSize();
+
+	FeatureMatches matches;
+	std::vector<unsigned char> record;
+	unsigned int indexA;
+	while (parseUnsigned(cursor, end, indexA))
+	{
+		unsigned int indexB;
+		unsigned int nbMatch;
+		if (!parseUnsigned(cursor, end, indexB) || !parseUnsigned(cursor, end, nbMatch))
+			return false;
+
+		//untrusted count: each match takes at least 4 bytes (" 0 0")
+		if (nbMatch > (size_t) (end - cursor) / 4)
+			return false;
+		matches.resize(nbMatch);
+		for (unsigned int i=0; i<nbMatch; ++i)
+		{
+			if (!parseUnsigned(cursor, end, matches[i].first) || !parseUnsigned(cursor, end, matches[i].second))
+				return false;
+		}
+
+		encodeMatches(matches, record);
+		if (!writer.append(indexA, indexB, nbMatch, record))
+			return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,575 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include "SiftFile.h"
+
+#include <fstream>
+#include <algorithm>
+#include <string.h>
+#include <math.h>
+
+using namespace SiftFile;
+
+#define BYTE_ORDER_MARK 0x01020304
+
+static inline unsigned int alignOffset(unsigned int offset)
+{
+	return (offset + ALIGNMENT-1) & ~(ALIGNMENT-1);
+}
+
+static inline unsigned int getDescriptorSize(unsigned int type)
+{
+	return (type == DESCRIPTOR_UCHAR ? 128 : 128*sizeof(float));
+}
+
+//crc32 (IEEE 802.3) lookup table built at startup
+struct CrcTable
+{
+	CrcTable()
+	{
+		for (unsigned int i=0; i<256; ++i)
+		{
+			unsigned int value = i;
+			for (int k=0; k<8; ++k)
+				value = (value & 1) ? (0xEDB88320 ^ (value >> 1)) : (value >> 1);
+			values[i] = value;
+		}
+	}
+
+	unsigned int values[256];
+};
+
+static const CrcTable sCrcTable;
+
+unsigned int SiftFile::crc32(const void* data, size_t size, unsigned int crc)
+{
+	const unsigned char* bytes = (const unsigned char*) data;
+	crc = ~crc;
+	for (size_t i=0; i<size; ++i)
+		crc = sCrcTable.values[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+//the header is part of the checksum so that corrupted offsets are detected
+static unsigned int getChecksum(const char* data, size_t size)
+{
+	Header header;
+	memcpy(&header, data, sizeof(Header));
+	header.checksum = 0;
+
+	return crc32(data + sizeof(Header), size - sizeof(Header), crc32(&header, sizeof(Header)));
+}
+
+Writer::Writer(unsigned int nbFeature, DescriptorType type, int width, int height)
+{
+	unsigned int keyPointOffset   = alignOffset(sizeof(Header));
+	unsigned int keyPointStride   = alignOffset(nbFeature*sizeof(float));
+	unsigned int descriptorOffset = alignOffset(keyPointOffset + 4*keyPointStride);
+	unsigned int fileSize         = descriptorOffset + nbFeature*getDescriptorSize(type);
+
+	mBuffer.assign(fileSize, 0);
+
+	Header& header = getHeader();
+	memcpy(header.magic, "SIFB", 4);
+	header.version          = FEATURE_VERSION;
+	header.byteOrder        = BYTE_ORDER_MARK;
+	header.width            = width;
+	header.height           = height;
+	header.nbFeature        = nbFeature;
+	header.descriptorType   = type;
+	header.keyPointOffset   = keyPointOffset;
+	header.keyPointStride   = keyPointStride;
+	header.descriptorOffset = descriptorOffset;
+	header.fileSize         = fileSize;
+}
+
+Header& Writer::getHeader()
+{
+	return *(Header*) &mBuffer[0];
+}
+
+float* Writer::getX()
+{
+	return (float*) &mBuffer[getHeader().keyPointOffset];
+}
+
+float* Writer::getY()
+{
+	return (float*) &mBuffer[getHeader().keyPointOffset + getHeader().keyPointStride];
+}
+
+float* Writer::getScale()
+{
+	return (float*) &mBuffer[getHeader().keyPointOffset + 2*getHeader().keyPointStride];
+}
+
+float* Writer::getOrientation()
+{
+	return (float*) &mBuffer[getHeader().keyPointOffset + 3*getHeader().keyPointStride];
+}
+
+float* Writer::getFloatDescriptor(unsigned int index)
+{
+	return (float*) &mBuffer[getHeader().descriptorOffset + index*128*sizeof(float)];
+}
+
+unsigned char* Writer::getUcharDescriptor(unsigned int index)
+{
+	return (unsigned char*) &mBuffer[getHeader().descriptorOffset + index*128];
+}
+
+bool Writer::write(std::ostream& output)
+{
+	Header& header = getHeader();
+	header.checksum = getChecksum(&mBuffer[0], mBuffer.size());
+
+	output.write(&mBuffer[0], mBuffer.size());
+
+	return !output.fail();
+}
+
+bool Writer::save(const std::string& filename)
+{
+	std::ofstream output(filename.c_str(), std::ios::out | std::ios::binary);
+	if (!output.is_open())
+		return false;
+	bool written = write(output);
+	output.close();
+
+	return written && !output.fail();
+}
+
+Reader::Reader()
+{
+	memset(&mHeader, 0, sizeof(mHeader));
+	mData = NULL;
+}
+
+bool Reader::open(const std::string& filename, bool verifyChecksum)
+{
+	close();
+
+	if (!mFile.open(filename))
+		return false;
+
+	return parse(mFile.getData(), mFile.getSize(), verifyChecksum);
+}
+
+bool Reader::open(const std::string& filename, unsigned long long offset, size_t size, bool verifyChecksum)
+{
+	close();
+
+	if (!mFile.open(filename, offset, size))
+		return false;
+
+	return parse(mFile.getData(), mFile.getSize(), verifyChecksum);
+}
+
+bool Reader::open(const char* data, size_t size, bool verifyChecksum)
+{
+	close();
+
+	return parse(data, size, verifyChecksum);
+}
+
+bool Reader::parse(const char* data, size_t size, bool verifyChecksum)
+{
+	if (size < sizeof(Header) || memcmp(data, "SIFB", 4) != 0)
+	{
+		bool parsed = parseLegacy(data, size);
+		mFile.close();
+		if (!parsed)
+			close();
+		return parsed;
+	}
+
+	memcpy(&mHeader, data, sizeof(Header));
+
+	//bounds are checked in 64 bits: the header fields are untrusted and 32 bits products can wrap
+	unsigned long long keyPointSize = 4*(unsigned long long) mHeader.keyPointStride;
+	unsigned long long featureSize  = (unsigned long long) mHeader.nbFeature*sizeof(float);
+
+	bool valid = mHeader.version == FEATURE_VERSION && mHeader.byteOrder == BYTE_ORDER_MARK && mHeader.fileSize == size &&
+		(mHeader.descriptorType == DESCRIPTOR_FLOAT || mHeader.descriptorType == DESCRIPTOR_UCHAR) &&
+		mHeader.keyPointOffset >= sizeof(Header) && mHeader.keyPointStride >= featureSize &&
+		mHeader.descriptorOffset >= mHeader.keyPointOffset + keyPointSize && mHeader.descriptorOffset <= size &&
+		(size - mHeader.descriptorOffset)/getDescriptorSize(mHeader.descriptorType) >= mHeader.nbFeature;
+
+	if (valid && verifyChecksum)
+		valid = getChecksum(data, size) == mHeader.checksum;
+
+	if (!valid)
+	{
+		close();
+		return false;
+	}
+
+	mData = data;
+
+	return true;
+}
+
+bool Reader::parseLegacy(const char* data, size_t size)
+{
+	//int count then x, y, scale, orientation and 128 floats per key-point
+	int nbFeature = 0;
+	size_t recordSize = 132*sizeof(float);
+	if (size < sizeof(int))
+		return false;
+	memcpy(&nbFeature, data, sizeof(int));
+	if (nbFeature < 0 || (size-sizeof(int))/recordSize < (size_t) nbFeature)
+		return false;
+
+	Writer writer(nbFeature, DESCRIPTOR_FLOAT);
+	float* x           = writer.getX();
+	float* y           = writer.getY();
+	float* scale       = writer.getScale();
+	float* orientation = writer.getOrientation();
+
+	const char* record = data + sizeof(int);
+	for (int i=0; i<nbFeature; ++i, record += recordSize)
+	{
+		float point[4];
+		memcpy(point, record, sizeof(point));
+		x[i]           = point[0];
+		y[i]           = point[1];
+		scale[i]       = point[2];
+		orientation[i] = point[3];
+		memcpy(writer.getFloatDescriptor(i), record + sizeof(point), 128*sizeof(float));
+	}
+
+	mLegacyData.swap(writer.mBuffer);
+	memcpy(&mHeader, &mLegacyData[0], sizeof(Header));
+	mHeader.version = 0;
+	mData = &mLegacyData[0];
+
+	return true;
+}
+
+void Reader::close()
+{
+	mFile.close();
+	mLegacyData.clear();
+	memset(&mHeader, 0, sizeof(mHeader));
+	mData = NULL;
+}
+
+const float* Reader::getX() const
+{
+	return (const float*) (mData + mHeader.keyPointOffset);
+}
+
+const float* Reader::getY() const
+{
+	return (const float*) (mData + mHeader.keyPointOffset + mHeader.keyPointStride);
+}
+
+const float* Reader::getScale() const
+{
+	return (const float*) (mData + mHeader.keyPointOffset + 2*mHeader.keyPointStride);
+}
+
+const float* Reader::getOrientation() const
+{
+	return (const float*) (mData + mHeader.keyPointOffset + 3*mHeader.keyPointStride);
+}
+
+const float* Reader::getFloatDescriptor(unsigned int index) const
+{
+	return (const float*) (mData + mHeader.descriptorOffset + index*128*sizeof(float));
+}
+
+const unsigned char* Reader::getUcharDescriptor(unsigned int index) const
+{
+	return (const unsigned char*) (mData + mHeader.descriptorOffset + index*128);
+}
+
+void Reader::getDescriptor(unsigned int index, float* descriptor) const
+{
+	if (mHeader.descriptorType == DESCRIPTOR_FLOAT)
+	{
+		memcpy(descriptor, getFloatDescriptor(index), 128*sizeof(float));
+	}
+	else
+	{
+		const unsigned char* values = getUcharDescriptor(index);
+		for (int k=0; k<128; ++k)
+			descriptor[k] = values[k]/512.0f;
+	}
+}
+
+void Reader::getQuantizedDescriptor(unsigned int index, unsigned char* descriptor) const
+{
+	if (mHeader.descriptorType == DESCRIPTOR_UCHAR)
+	{
+		memcpy(descriptor, getUcharDescriptor(index), 128);
+	}
+	else
+	{
+		const float* values = getFloatDescriptor(index);
+		for (int k=0; k<128; ++k)
+		{
+			int quantized = (int) floor(0.5+512.0f*values[k]);
+			descriptor[k] = (unsigned char) (quantized < 0 ? 0 : (quantized > 255 ? 255 : quantized));
+		}
+	}
+}
+
+Database::Database()
+{
+	mFileSize = 0;
+	mModified = false;
+	mReadOnly = false;
+}
+
+Database::~Database()
+{
+	close();
+}
+
+bool Database::open(const std::string& filename, bool readOnly)
+{
+	close();
+
+	mFilename = filename;
+	mReadOnly = readOnly;
+
+	std::ifstream input(filename.c_str(), std::ios::in | std::ios::binary);
+	if (input.is_open())
+	{
+		input.seekg(0, std::ios::end);
+		mFileSize = (unsigned long long) input.tellg();
+	}
+	input.close();
+
+	if (mFileSize == 0)
+		return true;
+
+	//files appended after the last commit() are not in the index: drop them so that the next
+	//commit() does not leave unreachable records in the middle of the file (readers leave them)
+	unsigned long long committedSize = 0;
+	bool valid = findIndex(committedSize);
+	if (!valid)
+		mIndex.clear();
+	else if (!mReadOnly && committedSize < mFileSize && truncateFile(mFilename, committedSize))
+		mFileSize = committedSize;
+
+	//one mapping for the whole dataset, records are mapped one by one otherwise
+	if (sizeof(void*) >= 8)
+		mMapping.open(mFilename);
+
+	return valid;
+}
+
+bool Database::findIndex(unsigned long long& committedSize)
+{
+	std::ifstream input(mFilename.c_str(), std::ios::in | std::ios::binary);
+	if (!input.is_open())
+		return false;
+
+	//the last valid footer is at the end of the file unless files were appended after it:
+	//scan backward chunk by chunk (chunks overlap by a footer so that none is missed)
+	const unsigned long long chunkSize = 1 << 20;
+	std::vector<char> chunk;
+	unsigned long long end = mFileSize;
+	while (end > 0)
+	{
+		unsigned long long begin = end > chunkSize ? end - chunkSize : 0;
+		unsigned long long last  = std::min(end - 1 + sizeof(DatabaseFooter), mFileSize);
+		chunk.resize((size_t) (last - begin));
+		input.clear();
+		input.seekg((std::streamoff) begin);
+		input.read(&chunk[0], chunk.size());
+		if (input.fail())
+			return false;
+
+		for (size_t position = (size_t) (end - begin) - 1; ; --position)
+		{
+			DatabaseFooter footer;
+			if (chunk.size() - position >= sizeof(footer) && memcmp(&chunk[position], "SIFD", 4) == 0)
+			{
+				memcpy(&footer, &chunk[position], sizeof(footer));
+				unsigned long long offset = begin + position;
+				if (footer.indexSize <= offset && footer.indexOffset == offset - footer.indexSize && readIndex(input, footer))
+				{
+					committedSize = offset + sizeof(footer);
+					return true;
+				}
+				mIndex.clear();
+			}
+			if (position == 0)
+				break;
+		}
+		end = begin;
+	}
+
+	return false;
+}
+
+bool Database::readIndex(std::istream& input, const DatabaseFooter& footer)
+{
+	if (footer.version != VERSION || footer.byteOrder != BYTE_ORDER_MARK)
+		return false;
+
+	std::vector<char> index((size_t) footer.indexSize);
+	input.clear();
+	input.seekg((std::streamoff) footer.indexOffset);
+	if (!index.empty())
+		input.read(&index[0], index.size());
+	if (input.fail() || crc32(index.empty() ? NULL : &index[0], index.size()) != footer.indexChecksum)
+		return false;
+
+	//name length, name, offset and size per record
+	size_t position = 0;
+	while (position < index.size())
+	{
+		unsigned int length = 0;
+		Record record;
+		if (index.size() - position < sizeof(length))
+			return false;
+		memcpy(&length, &index[position], sizeof(length));
+		position += sizeof(length);
+		if (index.size() - position < length + sizeof(record))
+			return false;
+		std::string name(&index[position], length);
+		position += length;
+		memcpy(&record, &index[position], sizeof(record));
+		position += sizeof(record);
+
+		if (record.offset > footer.indexOffset || record.size > footer.indexOffset - record.offset)
+			return false;
+		mIndex[name] = record;
+	}
+
+	return true;
+}
+
+void Database::close()
+{
+	commit();
+	mOutput.close();
+	mMapping.close();
+	mIndex.clear();
+	mFilename.clear();
+	mFileSize = 0;
+	mModified = false;
+	mReadOnly = false;
+}
+
+bool Database::contains(const std::string& name) const
+{
+	return mIndex.find(name) != mIndex.end();
+}
+
+bool Database::read(const std::string& name, Reader& reader, bool verifyChecksum) const
+{
+	std::map<std::string, Record>::const_iterator it = mIndex.find(name);
+	if (it == mIndex.end())
+		return false;
+
+	const Record& record = it->second;
+	if (mMapping.getData() && record.offset + record.size <= mMapping.getSize())
+		return reader.open(mMapping.getData() + record.offset, (size_t) record.size, verifyChecksum);
+
+	return reader.open(mFilename, record.offset, (size_t) record.size, verifyChecksum);
+}
+
+bool Database::writePadding()
+{
+	if (!mOutput.is_open())
+	{
+		mOutput.open(mFilename.c_str(), std::ios::out | std::ios::binary | std::ios::app);
+		if (!mOutput.is_open())
+			return false;
+	}
+
+	static const char zeros[ALIGNMENT] = {0};
+	unsigned int padding = (unsigned int) ((ALIGNMENT - mFileSize%ALIGNMENT) % ALIGNMENT);
+	mOutput.write(zeros, padding);
+	mFileSize += padding;
+
+	return !mOutput.fail();
+}
+
+bool Database::append(const std::string& name, Writer& writer)
+{
+	if (mFilename.empty() || mReadOnly || !writePadding())
+		return false;
+
+	Record record;
+	record.offset = mFileSize;
+	record.size   = writer.getSize();
+
+	if (!writer.write(mOutput))
+		return false;
+
+	mFileSize += record.size;
+	mIndex[name] = record;
+	mModified = true;
+
+	return true;
+}
+
+bool Database::commit()
+{
+	if (!mModified)
+		return true;
+
+	std::vector<char> index;
+	for (std::map<std::string, Record>::const_iterator it = mIndex.begin(); it != mIndex.end(); ++it)
+	{
+		unsigned int length = (unsigned int) it->first.size();
+		size_t position = index.size();
+		index.resize(position + sizeof(length) + length + sizeof(Record));
+		memcpy(&index[position], &length, sizeof(length));
+		memcpy(&index[position + sizeof(length)], it->first.c_str(), length);
+		memcpy(&index[position + sizeof(length) + length], &it->second, sizeof(Record));
+	}
+
+	if (!writePadding())
+		return false;
+
+	DatabaseFooter footer;
+	memset(&footer, 0, sizeof(footer));
+	memcpy(footer.magic, "SIFD", 4);
+	footer.version       = VERSION;
+	footer.indexOffset   = mFileSize;
+	footer.indexSize     = index.size();
+	footer.indexChecksum = crc32(index.empty() ? NULL : &index[0], index.size());
+	footer.byteOrder     = BYTE_ORDER_MARK;
+
+	if (!index.empty())
+		mOutput.write(&index[0], index.size());
+	mOutput.write((const char*) &footer, sizeof(footer));
+	mOutput.flush();
+	if (mOutput.fail())
+		return false;
+
+	mFileSize += index.size() + sizeof(footer);
+	mModified = false;
+
+	if (sizeof(void*) >= 8)
+		mMapping.open(mFilename);
+
+	return true;
+}
@@ -0,0 +1,139 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+
+#include "SiftFile.h"
+
+//Database recovery: files appended after the last commit() (process killed before close)
+//must not make the database unreadable, and are dropped by the next open unless it is read-only
+
+static const char* sFilename = "DatabaseTest.db";
+static int sNbFailure = 0;
+
+#define CHECK(condition) if (!(condition)) { std::cout << "FAILED line " << __LINE__ << ": " #condition << std::endl; ++sNbFailure; }
+
+static void fillWriter(SiftFile::Writer& writer, unsigned char value)
+{
+	writer.getX()[0] = (float) value;
+	memset(writer.getUcharDescriptor(0), value, 128);
+}
+
+static unsigned long long getFileSize(const std::string& filename)
+{
+	std::ifstream input(filename.c_str(), std::ios::in | std::ios::binary);
+	input.seekg(0, std::ios::end);
+
+	return (unsigned long long) input.tellg();
+}
+
+//what append() leaves when the process is killed before commit(): padding then the file
+static void appendUncommitted(SiftFile::Writer& writer, size_t padding)
+{
+	std::ofstream output(sFilename, std::ios::out | std::ios::binary | std::ios::app);
+	output.write(std::string(padding, '\0').c_str(), padding);
+	writer.write(output);
+}
+
+static bool readValue(const SiftFile::Database& database, const std::string& name, unsigned char value)
+{
+	SiftFile::Reader reader;
+	if (!database.read(name, reader))
+		return false;
+	unsigned char descriptor[128];
+	reader.getQuantizedDescriptor(0, descriptor);
+
+	return reader.getFeatureCount() == 10 && reader.getX()[0] == (float) value && descriptor[0] == value;
+}
+
+int runDatabaseTest()
+{
+	remove(sFilename);
+
+	SiftFile::Writer a(10, SiftFile::DESCRIPTOR_UCHAR);
+	SiftFile::Writer b(5000, SiftFile::DESCRIPTOR_FLOAT); //larger than the chunks scanned by open
+	SiftFile::Writer c(10, SiftFile::DESCRIPTOR_UCHAR);
+	fillWriter(a, 1);
+	fillWriter(b, 2);
+	fillWriter(c, 3);
+
+	//one committed file
+	{
+		SiftFile::Database database;
+		CHECK(database.open(sFilename));
+		CHECK(database.append("a.jpg", a));
+		CHECK(database.commit());
+	}
+	unsigned long long committedSize = getFileSize(sFilename);
+
+	//append without commit, then a torn write
+	appendUncommitted(b, 16);
+	{
+		std::ofstream output(sFilename, std::ios::out | std::ios::binary | std::ios::app);
+		output.write("SIFD", 4);
+	}
+
+	//read-only: the committed file is read, the file is left as it is
+	unsigned long long tornSize = getFileSize(sFilename);
+	{
+		SiftFile::Database database;
+		CHECK(database.open(sFilename, true));
+		CHECK(database.getRecordCount() == 1);
+		CHECK(readValue(database, "a.jpg", 1));
+		CHECK(!database.append("c.jpg", c));
+		CHECK(database.commit());
+	}
+	CHECK(getFileSize(sFilename) == tornSize);
+
+	//reopen: the committed file is read, the tail is truncated
+	{
+		SiftFile::Database database;
+		CHECK(database.open(sFilename));
+		CHECK(database.getRecordCount() == 1);
+		CHECK(readValue(database, "a.jpg", 1));
+		CHECK(!database.contains("b.jpg"));
+		CHECK(getFileSize(sFilename) == committedSize);
+
+		CHECK(database.append("c.jpg", c));
+		CHECK(database.commit());
+	}
+
+	//the next commit keeps the previous files
+	{
+		SiftFile::Database database;
+		CHECK(database.open(sFilename));
+		CHECK(database.getRecordCount() == 2);
+		CHECK(readValue(database, "a.jpg", 1));
+		CHECK(readValue(database, "c.jpg", 3));
+	}
+
+	remove(sFilename);
+
+	if (sNbFailure == 0)
+		std::cout << "DatabaseTest: OK" << std::endl;
+
+	return sNbFailure;
+}
@@ -0,0 +1,227 @@
+/*
+	Copyright (c) 2010 ASTRE Henri (http://www.visual-experiments.com)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in
+	all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+	THE SOFTWARE.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+#include "MatchFile.h"
+
+//Match files: binary and text round trips, and corrupted files (cut by a crash or forged)
+//rejected instead of read out of bounds
+
+static const char* sBinFilename  = "MatchFileTest.bin";
+static const char* sTextFilename = "MatchFileTest.txt";
+static const char* sLogFilename  = "MatchFileTest.log";
+static int sNbFailure = 0;
+
+#define CHECK(condition) if (!(condition)) { std::cout << "FAILED line " << __LINE__ << ": " #condition << std::endl; ++sNbFailure; }
+
+struct TestPair
+{
+	unsigned int             indexA;
+	unsigned int             indexB;
+	SiftFile::FeatureMatches matches;
+};
+
+//decreasing indices in image A (negative deltas), large indices and an empty pair
+static void createPairs(std::vector<TestPair>& pairs)
+{
+	pairs.resize(3);
+	pairs[0].indexA = 1;
+	pairs[0].indexB = 2;
+	for (unsigned int i=0; i<300; ++i)
+		pairs[0].matches.push_back(SiftFile::FeatureMatch(i*3, (i*7919) % 5000));
+	pairs[0].matches.push_back(SiftFile::FeatureMatch(5, 0));
+	pairs[0].matches.push_back(SiftFile::FeatureMatch(0xFFFFFFFF, 0xFFFFFFFF));
+	pairs[0].matches.push_back(SiftFile::FeatureMatch(0, 127));
+
+	pairs[1].indexA = 0;
+	pairs[1].indexB = 2;
+	pairs[1].matches.push_back(SiftFile::FeatureMatch(128, 16384));
+
+	pairs[2].indexA = 0;
+	pairs[2].indexB = 1;
+}
+
+static bool writePairs(const std::vector<TestPair>& pairs, const std::string& filename)
+{
+	SiftFile::MatchWriter writer;
+	bool valid = writer.open(filename, 3);
+	std::vector<unsigned char> record;
+	for (size_t i=0; i<pairs.size(); ++i)
+	{
+		SiftFile::encodeMatches(pairs[i].matches, record);
+		valid = writer.append(pairs[i].indexA, pairs[i].indexB, (unsigned int) pairs[i].matches.size(), record) && valid;
+	}
+
+	return writer.close() && valid;
+}
+
+//pairs are read sorted by (indexA, indexB): pairs[2], pairs[1], pairs[0]
+static bool checkPairs(const SiftFile::MatchReader& reader, const std::vector<TestPair>& pairs)
+{
+	if (reader.getPairCount() != pairs.size())
+		return false;
+
+	for (unsigned int i=0; i<reader.getPairCount(); ++i)
+	{
+		const TestPair& pair = pairs[pairs.size()-1-i];
+		const SiftFile::MatchFileEntry& entry = reader.getPair(i);
+		SiftFile::FeatureMatches matches;
+		if (entry.indexA != pair.indexA || entry.indexB != pair.indexB || entry.nbMatch != pair.matches.size() ||
+			!reader.getMatches(i, matches) || matches != pair.matches)
+			return false;
+	}
+
+	return true;
+}
+
+static std::string readFile(const std::string& filename)
+{
+	std::ifstream input(filename.c_str(), std::ios::in | std::ios::binary);
+	return std::string((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+}
+
+static void writeFile(const std::string& filename, const std::string& content)
+{
+	std::ofstream output(filename.c_str(), std::ios::out | std::ios::binary);
+	output.write(content.c_str(), content.size());
+}
+
+int runMatchFileTest()
+{
+	std::vector<TestPair> pairs;
+	createPairs(pairs);
+
+	//binary round trip
+	CHECK(writePairs(pairs, sBinFilename));
+	{
+		SiftFile::MatchReader reader;
+		CHECK(reader.open(sBinFilename));
+		CHECK(reader.getImageCount() == 3);
+		CHECK(checkPairs(reader, pairs));
+
+		//text round trip: same pairs, then the same text
+		CHECK(SiftFile::writeMatchText(reader, sTextFilename));
+	}
+	std::string text = readFile(sTextFilename);
+	CHECK(text.compare(0, 14, "0 1\n0\n0 2\n1\n12") == 0);
+	{
+		SiftFile::MatchWriter writer;
+		CHECK(writer.open(sBinFilename, 3));
+		CHECK(SiftFile::readMatchText(sTextFilename, writer));
+		CHECK(writer.close());
+
+		SiftFile::MatchReader reader;
+		CHECK(reader.open(sBinFilename));
+		CHECK(checkPairs(reader, pairs));
+		CHECK(SiftFile::writeMatchText(reader, sTextFilename));
+	}
+	CHECK(readFile(sTextFilename) == text);
+
+	//binary file cut by a crash: rejected, so that the caller converts the text file instead
+	std::string binary = readFile(sBinFilename);
+	writeFile(sBinFilename, binary.substr(0, binary.size()-1));
+	{
+		SiftFile::MatchReader reader;
+		CHECK(!reader.open(sBinFilename));
+		CHECK(reader.getPairCount() == 0);
+	}
+
+	//count larger than the record (forged index with a valid checksum): getMatches fails
+	{
+		SiftFile::MatchWriter writer;
+		std::vector<unsigned char> record;
+		SiftFile::encodeMatches(pairs[1].matches, record);
+		CHECK(writer.open(sBinFilename, 3));
+		CHECK(writer.append(0, 2, 0x7FFFFFFF, record));
+		CHECK(writer.close());
+
+		SiftFile::MatchReader reader;
+		SiftFile::FeatureMatches matches;
+		CHECK(reader.open(sBinFilename));
+		CHECK(!reader.getMatches(0, matches));
+		CHECK(matches.empty());
+	}
+
+	//text count larger than the text: rejected
+	writeFile(sTextFilename, "0 1\n4000000000\n1 2\n");
+	{
+		SiftFile::MatchWriter writer;
+		CHECK(writer.open(sBinFilename, 3));
+		CHECK(!SiftFile::readMatchText(sTextFilename, writer));
+		writer.close();
+	}
+
+	//match log cut in the middle of the last entry, then garbage after the last complete entry
+	{
+		SiftFile::MatchLog log;
+		std::vector<unsigned char> record;
+		CHECK(log.open(sLogFilename, 3));
+		for (size_t i=0; i<pairs.size(); ++i)
+		{
+			SiftFile::encodeMatches(pairs[i].matches, record);
+			CHECK(log.append(pairs[i].indexA, pairs[i].indexB, (unsigned int) pairs[i].matches.size(), record));
+		}
+		CHECK(log.close());
+	}
+	{
+		SiftFile::MatchReader reader;
+		CHECK(reader.openLog(sLogFilename));
+		CHECK(checkPairs(reader, pairs));
+	}
+	std::string log = readFile(sLogFilename);
+	size_t lastEntry = log.size() - sizeof(SiftFile::MatchLogEntry); //pairs[2] has no match
+	for (size_t cut=lastEntry; cut<log.size(); cut+=7)
+	{
+		writeFile(sLogFilename, log.substr(0, cut));
+		SiftFile::MatchReader reader;
+		CHECK(reader.openLog(sLogFilename));
+		CHECK(reader.getPairCount() == 2 && reader.getPair(0).indexB == 2 && reader.getPair(1).indexA == 1);
+	}
+	writeFile(sLogFilename, log.substr(0, lastEntry) + std::string(sizeof(SiftFile::MatchLogEntry), '\x7F'));
+	{
+		SiftFile::MatchReader reader;
+		SiftFile::FeatureMatches matches;
+		CHECK(reader.openLog(sLogFilename));
+		CHECK(reader.getPairCount() == 2 && reader.getMatches(1, matches) && matches == pairs[0].matches);
+	}
+	writeFile(sLogFilename, log.substr(0, 10));
+	{
+		SiftFile::MatchReader reader;
+		CHECK(!reader.openLog(sLogFilename));
+	}
+
+	remove(sBinFilename);
+	remove(sTextFilename);
+	remove(sLogFilename);
+
+	if (sNbFailure == 0)
+		std::cout << "MatchFileTest: OK" << std::endl;
+
+	return sNbFailure;
+}
@@ -38,7 +38,7 @@ namespace Jpeg
 		size_t getBufferSize();
 	};
 	
-	bool load(const std::string& filename, Image& img);                      //load jpeg from file (this function allocate the buffer of img struct)
+	bool load(const std::string& filename, Image& img, bool grayscale = false); //load jpeg from file (this function allocate the buffer of img struct)
 	bool write(const std::string& filename, Image& img, int quality = 75);   //write jpeg (quality 0: bad, 100: good)
 	bool writeRaw(const std::string& filename, Image& img);                  //save image as raw binary
 	bool getDimension(const std::string& filename, int& width, int& height); //get dimension from header only
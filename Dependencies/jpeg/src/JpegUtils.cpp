@@ -26,6 +26,7 @@
 
 #include <fstream>
 #include <iostream>
+#include <setjmp.h>
 
 using namespace Jpeg;
 
@@ -42,18 +43,46 @@ size_t Image::getBufferSize()
 	return width * height * nbComponent;
 }
 
-bool Jpeg::load(const std::string& filename, Image& img)
+//libjpeg default error handler calls exit(): jump back to Jpeg::load instead
+struct ErrorManager
+{
+	struct jpeg_error_mgr pub;
+	jmp_buf               jump;
+};
+
+static void errorExit(j_common_ptr cinfo)
+{
+	ErrorManager* manager = (ErrorManager*) cinfo->err;
+	(*cinfo->err->output_message)(cinfo);
+	longjmp(manager->jump, 1);
+}
+
+bool Jpeg::load(const std::string& filename, Image& img, bool grayscale)
 {
 	FILE* fp = fopen(filename.c_str(), "rb");
 	if (fp)
 	{
 		struct jpeg_decompress_struct cinfo;
-		struct jpeg_error_mgr jerr;
+		ErrorManager jerr;
+
+		cinfo.err = jpeg_std_error(&jerr.pub);
+		jerr.pub.error_exit = errorExit;
+		img.buffer = NULL;
+
+		if (setjmp(jerr.jump))
+		{
+			jpeg_destroy_decompress(&cinfo);
+			fclose(fp);
+			delete[] img.buffer;
+			img.buffer = NULL;
+			return false;
+		}
 
-		cinfo.err = jpeg_std_error(&jerr);
 		jpeg_create_decompress(&cinfo);
 		jpeg_stdio_src(&cinfo, fp);
 		jpeg_read_header(&cinfo, true);
+		if (grayscale)
+			cinfo.out_color_space = JCS_GRAYSCALE; //luminance computed by the decoder
 		jpeg_start_decompress(&cinfo);
 
 		int width       = cinfo.output_width;
@@ -65,20 +94,18 @@ bool Jpeg::load(const std::string& filename, Image& img)
 		img.nbComponent = nbComponent;
 		img.buffer      = new unsigned char[img.getBufferSize()];
 		
+		//decode scanlines directly in the image buffer
 		size_t widthInBytes = width * nbComponent;
-		JSAMPROW row = new JSAMPLE[widthInBytes];
-
-		for (int y=0; y<height; y++) 
+		while (cinfo.output_scanline < cinfo.output_height)
 		{
+			JSAMPROW row = img.buffer + cinfo.output_scanline*widthInBytes;
 			jpeg_read_scanlines(&cinfo, &row, 1);
-			memcpy(img.buffer + y*widthInBytes, row, widthInBytes);
 		}
 
 		jpeg_finish_decompress(&cinfo);
 		jpeg_destroy_decompress(&cinfo);
 
 		fclose(fp);
-		delete[] row;
 
 		return true;
 	}
@@ -140,30 +167,36 @@ bool Jpeg::writeRaw(const std::string& filename, Image& img)
 
 bool Jpeg::getDimension(const std::string& filename, int& width, int& height)
 {
-	struct jpeg_decompress_struct cinfo;
-	struct jpeg_error_mgr jerr;
-
-	cinfo.err = jpeg_std_error(&jerr);
-	jpeg_create_decompress(&cinfo);
+	width  = 0;
+	height = 0;
 
 	FILE* fp = fopen(filename.c_str(), "rb");
-	if (fp)
-	{
-		jpeg_stdio_src(&cinfo, fp);
-		jpeg_read_header(&cinfo, true);
+	if (!fp)
+		return false;
 
-		width  = cinfo.image_width;
-		height = cinfo.image_height;
+	struct jpeg_decompress_struct cinfo;
+	ErrorManager jerr;
 
-		jpeg_destroy_decompress(&cinfo);
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = errorExit;
 
-		fclose(fp);
-		return true;
-	}
-	else
+	if (setjmp(jerr.jump))
 	{
-		width  = 0;
-		height = 0;
+		jpeg_destroy_decompress(&cinfo);
+		fclose(fp);
 		return false;
 	}
-}
\ No newline at end of file
+
+	//only the header is read, nothing is decoded
+	jpeg_create_decompress(&cinfo);
+	jpeg_stdio_src(&cinfo, fp);
+	jpeg_read_header(&cinfo, true);
+
+	width  = cinfo.image_width;
+	height = cinfo.image_height;
+
+	jpeg_destroy_decompress(&cinfo);
+	fclose(fp);
+
+	return true;
+}